@@ -1,7 +1,7 @@
 ﻿// Copyright Anupam Sahu. All Rights Reserved.
 
 #include "TrISMCManager.h"
-#include "Components/HierarchicalInstancedStaticMeshComponent.h"
+#include "Components/InstancedStaticMeshComponent.h"
 #include "Materials/MaterialInstance.h"
 
 ATrISMCManager::ATrISMCManager()
@@ -9,11 +9,12 @@ ATrISMCManager::ATrISMCManager()
 	PrimaryActorTick.bCanEverTick = false;
 }
 
-int32 ATrISMCManager::AddInstance(UStaticMesh* Mesh, UMaterialInstance* Material, const FTransform& Transform)
+UInstancedStaticMeshComponent* ATrISMCManager::FindOrAddISMC(UStaticMesh* Mesh, UMaterialInstance* Material)
 {
 	if(!ISMCMap.Contains(Mesh))
 	{
-		UHierarchicalInstancedStaticMeshComponent* NewISMC = Cast<UHierarchicalInstancedStaticMeshComponent>(AddComponentByClass(UHierarchicalInstancedStaticMeshComponent::StaticClass(), false, FTransform::Identity, false));
+		UInstancedStaticMeshComponent* NewISMC = Cast<UInstancedStaticMeshComponent>(AddComponentByClass(UInstancedStaticMeshComponent::StaticClass(), false, FTransform::Identity, false));
+		NewISMC->SetMobility(EComponentMobility::Movable);
 		NewISMC->SetStaticMesh(Mesh);
 		if(IsValid(Material))
 		{
@@ -21,8 +22,13 @@ int32 ATrISMCManager::AddInstance(UStaticMesh* Mesh, UMaterialInstance* Material
 		}
 		ISMCMap.Add(Mesh, NewISMC);
 	}
-	
-	return ISMCMap[Mesh]->AddInstance(Transform, true);
+
+	return ISMCMap[Mesh];
+}
+
+int32 ATrISMCManager::AddInstance(UStaticMesh* Mesh, UMaterialInstance* Material, const FTransform& Transform)
+{
+	return FindOrAddISMC(Mesh, Material)->AddInstance(Transform, true);
 }
 
 void ATrISMCManager::RemoveInstance(UStaticMesh* Mesh, const int32 InstanceIndex)
@@ -33,7 +39,52 @@ void ATrISMCManager::RemoveInstance(UStaticMesh* Mesh, const int32 InstanceIndex
 	}
 }
 
-UHierarchicalInstancedStaticMeshComponent* ATrISMCManager::GetISMC(const UStaticMesh* Mesh) const
+bool ATrISMCManager::WasRecentlyRendered(const UStaticMesh* Mesh, const float Tolerance) const
+{
+	const UInstancedStaticMeshComponent* ISMC = GetISMC(Mesh);
+	return !ISMC || ISMC->WasRecentlyRendered(Tolerance);
+}
+
+void ATrISMCManager::UpdateInstances(const UStaticMesh* Mesh, const TArray<FTransform>& Transforms, const int32 FirstDirty, const int32 EndDirty)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(ATrISMCManager::UpdateInstances)
+
+	UInstancedStaticMeshComponent* ISMC = GetISMC(Mesh);
+	if(!ISMC)
+	{
+		return;
+	}
+
+	const int32 NumInstances = Transforms.Num();
+	const int32 NumRendered = ISMC->GetInstanceCount();
+	if(NumRendered > NumInstances)
+	{
+		// Removing the last instances does not move any other instance.
+		IndicesScratch.Reset();
+		for(int32 Instance = NumRendered - 1; Instance >= NumInstances; --Instance)
+		{
+			IndicesScratch.Push(Instance);
+		}
+		ISMC->RemoveInstances(IndicesScratch);
+	}
+	else if(NumRendered < NumInstances)
+	{
+		TransformsScratch.Reset();
+		TransformsScratch.Append(Transforms.GetData() + NumRendered, NumInstances - NumRendered);
+		ISMC->AddInstances(TransformsScratch, false, true);
+	}
+
+	// Added instances already have their transforms.
+	const int32 UploadEnd = FMath::Min3(EndDirty, NumRendered, NumInstances);
+	if(FirstDirty < UploadEnd)
+	{
+		TransformsScratch.Reset();
+		TransformsScratch.Append(Transforms.GetData() + FirstDirty, UploadEnd - FirstDirty);
+		ISMC->BatchUpdateInstancesTransforms(FirstDirty, TransformsScratch, true, true, true);
+	}
+}
+
+UInstancedStaticMeshComponent* ATrISMCManager::GetISMC(const UStaticMesh* Mesh) const
 {
 	if(ISMCMap.Contains(Mesh))
 	{
@@ -6,6 +6,8 @@
 #include "GameFramework/Actor.h"
 #include "TrISMCManager.generated.h"
 
+class UInstancedStaticMeshComponent;
+
 UCLASS(NotPlaceable, Transient, NotBlueprintable)
 class TRAFFICAI_API ATrISMCManager : public AActor
 {
@@ -22,10 +24,19 @@ public:
 
 	void GetInstanceTransform(const UStaticMesh* Mesh, const int32 InstanceIndex, FTransform& OutTransform) const;
 
+	// Returns true if the component of a mesh was rendered within the last Tolerance seconds, or if there is no component.
+	bool WasRecentlyRendered(const UStaticMesh* Mesh, const float Tolerance) const;
+
 private:
 
 	// Get an InstancedStaticMeshComponent that renders a specific Mesh. 
-	UHierarchicalInstancedStaticMeshComponent* GetISMC(const UStaticMesh* Mesh) const;
+	UInstancedStaticMeshComponent* GetISMC(const UStaticMesh* Mesh) const;
+
+	/**
+	 * Get the InstancedStaticMeshComponent that renders a specific Mesh, creating it if needed.
+	 * Components are not hierarchical, since instances of moving vehicles would invalidate a cluster tree every frame.
+	 */
+	UInstancedStaticMeshComponent* FindOrAddISMC(UStaticMesh* Mesh, UMaterialInstance* Material = nullptr);
 
 	/**
 	 * Add an instance of Mesh to an Instanced Static Mesh Renderer.
@@ -35,8 +46,18 @@ private:
 
 	void RemoveInstance(UStaticMesh* Mesh, const int32 InstanceIndex);
 
+	/**
+	 * Makes the instances of a Mesh match an array of transforms.
+	 * Instances are added or removed at the end of the range, and only the transforms in [FirstDirty, EndDirty) are uploaded.
+	 */
+	void UpdateInstances(const UStaticMesh* Mesh, const TArray<FTransform>& Transforms, const int32 FirstDirty, const int32 EndDirty);
+
 private:
 
 	UPROPERTY()
-	TMap<UStaticMesh*, UHierarchicalInstancedStaticMeshComponent*> ISMCMap;
+	TMap<UStaticMesh*, UInstancedStaticMeshComponent*> ISMCMap;
+
+	// Transforms and indices passed to the components, kept between updates to avoid allocations.
+	TArray<FTransform> TransformsScratch;
+	TArray<int32> IndicesScratch;
 };
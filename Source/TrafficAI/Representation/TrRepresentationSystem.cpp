@@ -2,7 +2,7 @@
 
 #include "TrRepresentationSystem.h"
 
-#define SET_ACTOR_ENABLED(Actor, Value) Actor->SetActorEnableCollision(Value); Actor->SetActorHiddenInGame(!Value); Actor->SetActorTickEnabled(Value);
+#define SET_ACTOR_ENABLED(Actor, Value) Actor->SetActorEnableCollision(Value); Actor->SetActorHiddenInGame(!Value);
 
 #if UE_EDITOR
 #include "Editor.h"
@@ -10,44 +10,352 @@
 
 #include "TrISMCManager.h"
 #include "RpSpatialGraphComponent.h"
+#include "Engine/StaticMesh.h"
 #include "Kismet/KismetMathLibrary.h"
 #include "GameFramework/PlayerController.h"
-#include "Components/HierarchicalInstancedStaticMeshComponent.h"
+#include "Camera/PlayerCameraManager.h"
+#include "Components/InstancedStaticMeshComponent.h"
+#include "Async/ParallelFor.h"
 #include "TrafficAI/Simulation/TrSimulationSystem.h"
 
+constexpr int32 MAX_AMBIENT_START_ATTEMPTS = 16; // Edges tried for an ambient vehicle, before giving up until the next frame.
+constexpr float VIEW_CONE_MARGIN = 10.0f; // Degrees added to half the field of view, so that vehicles do not pop in at the edges of the screen.
+constexpr float MIN_AHEAD_SPEED = 100.0f; // Below this speed, ahead of the player is where the camera looks rather than where the player moves.
+constexpr float LOD_PRIORITY_LOOKAHEAD = 1.0f; // Seconds ahead at which the distance of an approaching vehicle is estimated, to prioritize LOD swaps.
+constexpr float DEFAULT_VEHICLE_RADIUS = 250.0f; // Bounding radius used to prioritize vehicles that do not have a static mesh.
+constexpr float VIEW_HYSTERESIS = 5.0f; // Degrees added to the view cones for vehicles that are already rendered, so that vehicles on the edge do not flicker.
+constexpr float RENDERED_VISIBILITY_TOLERANCE = 0.2f; // Seconds since a vehicle was last rendered, after which it is considered occluded.
+constexpr int32 INSTANCE_CHUNK_SIZE = 256; // Instances whose transforms are updated by a single task.
+
+// Returns true if a distance is within a range, widened by a margin on both sides.
+static bool ContainsWithMargin(const FFloatRange& Range, const float Distance, const float Margin)
+{
+	return !Range.IsEmpty()
+		&& (!Range.HasLowerBound() || Distance >= Range.GetLowerBoundValue() - Margin)
+		&& (!Range.HasUpperBound() || Distance <= Range.GetUpperBoundValue() + Margin);
+}
+
+// Returns true if a LOD has an actor bound to the vehicle.
+static bool HasActor(const EVehicleLOD LOD)
+{
+	return LOD == EVehicleLOD::Actor || LOD == EVehicleLOD::Kinematic;
+}
+
+// Distance beyond which vehicles have no LOD, or a negative value if one of the ranges is not bounded.
+static float GetRelevancyRadius(const FFloatRange& ActorRange, const FFloatRange& KinematicRange, const FFloatRange& MeshRange)
+{
+	float Radius = 0.0f;
+	for(const FFloatRange* Range : {&ActorRange, &KinematicRange, &MeshRange})
+	{
+		if(Range->IsEmpty())
+		{
+			continue;
+		}
+		if(!Range->HasUpperBound())
+		{
+			return -1.0f;
+		}
+		Radius = FMath::Max(Radius, Range->GetUpperBoundValue());
+	}
+	return Radius;
+}
+
+// Radius of the relevancy query of a focus, or zero if it is not bounded.
+static float GetFocusRadius(const FTrFocus& Focus, const float RelevancyRadius, const float LODHysteresis)
+{
+	// A focus without a radius makes all vehicles candidates when one of the ranges is not bounded.
+	float FocusRadius = RelevancyRadius < LODHysteresis ? 0.0f : RelevancyRadius * Focus.Weight;
+	if(Focus.Radius > 0.0f)
+	{
+		FocusRadius = FocusRadius > 0.0f ? FMath::Min(FocusRadius, Focus.Radius) : Focus.Radius;
+	}
+	return FocusRadius;
+}
+
+static FAutoConsoleCommandWithWorld CComPrintActorPoolStats
+(
+	TEXT("Traffic.ActorPoolStats"),
+	TEXT("Prints the number of actors spawned, bound to vehicles and free in the pool of each class."),
+	FConsoleCommandWithWorldDelegate::CreateLambda([](const UWorld* World)
+	{
+		if(const UTrRepresentationSystem* RepresentationSystem = World ? World->GetSubsystem<UTrRepresentationSystem>() : nullptr)
+		{
+			RepresentationSystem->LogActorPoolStats();
+		}
+	}),
+	ECVF_Default
+);
+
 void UTrRepresentationSystem::SpawnVehiclesOnGraph(const URpSpatialGraphComponent* NewGraphComponent, const UTrSpawnConfiguration* NewSpawnConfiguration)
 {
 	check(NewGraphComponent);
 	check(NewSpawnConfiguration);
+
+	TArray<FTrVehiclePathTransform> NewVehicleStarts;
+	FTrVehicleStartCreator::CreateVehicleStartsOnGraph(NewGraphComponent, NewSpawnConfiguration, MaxInstances, NewVehicleStarts);
+	SpawnVehicles(NewVehicleStarts, NewSpawnConfiguration);
+}
+
+void UTrRepresentationSystem::SpawnVehicles(const TArray<FTrVehiclePathTransform>& NewVehicleStarts, const UTrSpawnConfiguration* NewSpawnConfiguration)
+{
+	check(NewSpawnConfiguration);
 	check(NewSpawnConfiguration->VehicleVariants.Num() > 0);
 	
 	MeshPositionOffset = NewSpawnConfiguration->MeshPositionOffset;
-	FTrVehicleStartCreator::CreateVehicleStartsOnGraph(NewGraphComponent, NewSpawnConfiguration, MaxInstances, VehicleStarts);
+	VehicleStarts = NewVehicleStarts;
+	SpawnConfiguration = NewSpawnConfiguration;
+	bIsAmbientTrafficPopulated = false;
+
+	// Per-vehicle storage is allocated once, so that vehicles can be added and removed later without reallocation.
+	Actors.Reserve(MaxInstances);
+	ActorClasses.Reserve(MaxInstances);
+	VehicleInstances.Reserve(MaxInstances);
+	LODStates.Reserve(MaxInstances);
+	LODFrames.Reserve(MaxInstances);
+	VehicleTransforms.Reserve(MaxInstances);
+	PreviousTransforms.Reserve(MaxInstances);
 
+	// Actors are spawned before the first vehicle becomes relevant, rather than on the frame it does.
+	for(const FTrVehicleDefinition& Variant : NewSpawnConfiguration->VehicleVariants)
+	{
+		if(Variant.ActorClass)
+		{
+			PendingActorClasses.AddUnique(Variant.ActorClass);
+		}
+	}
+
+	// Ambient traffic is spawned around the player by UpdateAmbientTraffic.
+	if(NewSpawnConfiguration->bAmbientTraffic)
+	{
+		return;
+	}
+
+	SpawnRequests.Reserve(SpawnRequests.Num() + VehicleStarts.Num());
 	for (const FTrVehiclePathTransform& StartData : VehicleStarts)
 	{
-		FTrafficAISpawnRequest NewSpawnRequest;
-		NewSpawnRequest.Transform = StartData.Transform;
+		SpawnRequests.Push(MakeSpawnRequest(StartData));
+	}
+}
+
+void UTrRepresentationSystem::ProcessSpawnRequests()
+{
+	if(!IsSpawning())
+	{
+		return;
+	}
+
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTrRepresentationSystem::ProcessSpawnRequests)
+
+	const double EndTime = FPlatformTime::Seconds() + SpawnTimeBudget * 0.001;
+
+	// Pools are filled first, so that vehicles spawned near the player get an actor on their first update.
+	// The first actor or vehicle is always spawned, so that the queue drains even if the budget is zero.
+	bool bHasSpawned = false;
+	while(PendingActorClasses.Num() > 0)
+	{
+		if(bHasSpawned && FPlatformTime::Seconds() >= EndTime)
+		{
+			return;
+		}
+		if(SpawnPooledActor(PendingActorClasses.Last()))
+		{
+			bHasSpawned = true;
+		}
+		else
+		{
+			PendingActorClasses.Pop(false);
+		}
+	}
+
+	if(SpawnRequests.IsEmpty())
+	{
+		return;
+	}
+
+	const int32 BatchEnd = FMath::Min(SpawnRequests.Num(), NumProcessedSpawnRequests + ProcessingBatchSize);
+	while(NumProcessedSpawnRequests < BatchEnd && (!bHasSpawned || FPlatformTime::Seconds() < EndTime))
+	{
+		bHasSpawned = true;
+		if(!SpawnSingleVehicle(SpawnRequests[NumProcessedSpawnRequests++]).IsSet() && NumEntities >= static_cast<uint32>(FMath::Min(MaxInstances, SimulationSystem->GetCapacity())))
+		{
+			// Remaining requests can not fit either.
+			NumProcessedSpawnRequests = SpawnRequests.Num();
+		}
+	}
+
+	OnSpawnProgress.Broadcast(NumProcessedSpawnRequests, SpawnRequests.Num());
+	if(NumProcessedSpawnRequests == SpawnRequests.Num())
+	{
+		SpawnRequests.Reset();
+		NumProcessedSpawnRequests = 0;
+	}
+}
+
+FTrafficAISpawnRequest UTrRepresentationSystem::MakeSpawnRequest(const FTrVehiclePathTransform& StartData) const
+{
+	FTrafficAISpawnRequest NewSpawnRequest;
+	NewSpawnRequest.Transform = StartData.Transform;
+	NewSpawnRequest.Path = StartData.Path;
+	
+	FTrVehicleDefinition ChosenVariant = SpawnConfiguration->VehicleVariants[0];
+	for(const FTrVehicleDefinition& Variant : SpawnConfiguration->VehicleVariants)
+	{
+		if(UKismetMathLibrary::RandomBoolWithWeight(Variant.Ratio))
+		{
+			ChosenVariant = Variant;
+			break;
+		}
+	}
 		
-		FTrVehicleDefinition ChosenVariant = NewSpawnConfiguration->VehicleVariants[0];
-		for(const FTrVehicleDefinition& Variant : NewSpawnConfiguration->VehicleVariants)
+	// TODO : support for multiple definitions
+	NewSpawnRequest.LOD1_Actor = ChosenVariant.ActorClass;
+	NewSpawnRequest.LOD2_Mesh = ChosenVariant.StaticMesh;
+	NewSpawnRequest.Archetype = ChosenVariant.Archetype;
+	return NewSpawnRequest;
+}
+
+void UTrRepresentationSystem::UpdateAmbientTraffic()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTrRepresentationSystem::UpdateAmbientTraffic)
+
+	if(!SpawnConfiguration || !SpawnConfiguration->bAmbientTraffic)
+	{
+		return;
+	}
+
+	const APlayerController* PlayerController = GetWorld()->GetFirstPlayerController();
+	if(!PlayerController)
+	{
+		return;
+	}
+
+	FAmbientView View;
+	FRotator ViewRotation;
+	PlayerController->GetPlayerViewPoint(View.ViewLocation, ViewRotation);
+	View.ViewDirection = ViewRotation.Vector();
+	const float FieldOfView = PlayerController->PlayerCameraManager ? PlayerController->PlayerCameraManager->GetFOVAngle() : 90.0f;
+	View.CosHalfAngle = FMath::Cos(FMath::DegreesToRadians(FMath::Min(FieldOfView * 0.5f + VIEW_CONE_MARGIN, 180.0f)));
+
+	View.FocusLocation = View.ViewLocation;
+	View.AheadDirection = View.ViewDirection;
+	if(const APawn* Pawn = PlayerController->GetPawn())
+	{
+		View.FocusLocation = Pawn->GetActorLocation();
+		if(Pawn->GetVelocity().SizeSquared() > FMath::Square(MIN_AHEAD_SPEED))
+		{
+			View.AheadDirection = Pawn->GetVelocity();
+		}
+	}
+	View.AheadDirection = View.AheadDirection.GetSafeNormal2D();
+
+	// Simulated lanes do not include the offset applied to meshes.
+	const float MaxDistance = SpawnConfiguration->AmbientSpawnRange.GetUpperBoundValue();
+	AmbientEdges.Reset();
+	SimulationSystem->GetSegmentTree().FindInRadius(View.FocusLocation - MeshPositionOffset, MaxDistance, AmbientEdges);
+
+	const uint32 TargetCount = FMath::Max(0, FMath::Min(SpawnConfiguration->AmbientVehicleCount, MaxInstances));
+	FTrVehiclePathTransform Start;
+	if(!bIsAmbientTrafficPopulated)
+	{
+		while(NumEntities < TargetCount && FindAmbientStart(View, true, Start))
 		{
-			if(UKismetMathLibrary::RandomBoolWithWeight(Variant.Ratio))
+			if(!SpawnSingleVehicle(MakeSpawnRequest(Start)).IsSet())
 			{
-				ChosenVariant = Variant;
 				break;
 			}
 		}
-			
-		// TODO : support for multiple definitions
-		NewSpawnRequest.LOD1_Actor = ChosenVariant.ActorClass;
-		NewSpawnRequest.LOD2_Mesh = ChosenVariant.StaticMesh;
-		
-		SpawnSingleVehicle(NewSpawnRequest);
+		bIsAmbientTrafficPopulated = true;
+		return;
+	}
+
+	// Vehicles are visited from the last one, so that removals only swap vehicles that have already been visited.
+	int32 Budget = SpawnConfiguration->AmbientUpdatesPerFrame;
+	const float MaxDistanceSquared = FMath::Square(MaxDistance);
+	for(int32 Index = static_cast<int32>(NumEntities) - 1; Index >= 0 && Budget > 0; --Index)
+	{
+		const FVector& Location = VehicleTransforms[Index].GetLocation();
+		if(DetachedVehicles.Contains(Index) || FVector::DistSquared(Location, View.FocusLocation) <= MaxDistanceSquared || View.IsInView(Location))
+		{
+			continue;
+		}
+
+		--Budget;
+		if(NumEntities > TargetCount)
+		{
+			SimulationSystem->RemoveVehicle(SimulationSystem->GetVehicleHandle(Index));
+		}
+		else if(FindAmbientStart(View, false, Start))
+		{
+			// Recycled vehicles are not interpolated from where they were.
+			SimulationSystem->TeleportVehicle(Index, Start.Transform, Start.Path);
+			VehicleTransforms[Index] = Start.Transform;
+			VehicleTransforms[Index].AddToTranslation(MeshPositionOffset);
+			PreviousTransforms[Index] = VehicleTransforms[Index];
+		}
 	}
+
+	while(NumEntities < TargetCount && Budget-- > 0 && FindAmbientStart(View, false, Start))
+	{
+		SpawnSingleVehicle(MakeSpawnRequest(Start));
+	}
+}
+
+bool UTrRepresentationSystem::FindAmbientStart(const FAmbientView& View, const bool bAnywhere, FTrVehiclePathTransform& OutStart)
+{
+	if(AmbientEdges.IsEmpty())
+	{
+		return false;
+	}
+
+	const FTrRoadNetwork& Network = SimulationSystem->GetNetwork();
+	const float MinDistanceSquared = bAnywhere ? 0.0f : FMath::Square(SpawnConfiguration->AmbientSpawnRange.GetLowerBoundValue());
+	const float MaxDistanceSquared = FMath::Square(SpawnConfiguration->AmbientSpawnRange.GetUpperBoundValue());
+	for(int32 Attempt = 0; Attempt < MAX_AMBIENT_START_ATTEMPTS; ++Attempt)
+	{
+		const uint32 Edge = AmbientEdges[FMath::RandRange(0, AmbientEdges.Num() - 1)];
+		if(Network.GetEdgeLength(Edge) <= 2.0f * SpawnConfiguration->IntersectionCutoff)
+		{
+			continue;
+		}
+
+		// Starts follow the same spacing rules as vehicles spawned up front.
+		AmbientStarts.Reset();
+		const FVector& StartLocation = Network.GetNodeLocation(Network.GetEdgeStartNode(Edge));
+		const FVector& EndLocation = Network.GetNodeLocation(Network.GetEdgeEndNode(Edge));
+		FTrVehicleStartCreator::CreateStartTransformsOnEdge(StartLocation, EndLocation, SpawnConfiguration, AmbientStarts);
+		if(AmbientStarts.IsEmpty())
+		{
+			continue;
+		}
+
+		FTrVehiclePathTransform& Candidate = AmbientStarts[FMath::RandRange(0, AmbientStarts.Num() - 1)];
+		const FVector& Location = Candidate.Transform.GetLocation();
+		const FVector MeshLocation = Location + MeshPositionOffset;
+		const float DistanceSquared = FVector::DistSquared(MeshLocation, View.FocusLocation);
+		if(DistanceSquared < MinDistanceSquared || DistanceSquared > MaxDistanceSquared)
+		{
+			continue;
+		}
+
+		if(!bAnywhere && (View.IsInView(MeshLocation) || (MeshLocation - View.FocusLocation).Dot(View.AheadDirection) <= 0.0f))
+		{
+			continue;
+		}
+
+		const FVector Direction = Candidate.Transform.GetRotation().GetForwardVector();
+		if(SimulationSystem->IsLaneOccupied(Location, Direction, SpawnConfiguration->Separation.GetLowerBoundValue()))
+		{
+			continue;
+		}
+
+		Candidate.Path = Network.MakePath(Edge);
+		OutStart = Candidate;
+		return true;
+	}
+	return false;
 }
 
-void UTrRepresentationSystem::SpawnSingleVehicle(const FTrafficAISpawnRequest& SpawnRequest)
+FTrVehicleHandle UTrRepresentationSystem::SpawnSingleVehicle(const FTrafficAISpawnRequest& SpawnRequest)
 {
 	if(!ISMCManager)
 	{
@@ -55,113 +363,766 @@ void UTrRepresentationSystem::SpawnSingleVehicle(const FTrafficAISpawnRequest& S
 		check(ISMCManager);
 	}
 	
-	if(NumEntities >= FMath::Max<uint32>(MaxInstances, 0))
+	if(NumEntities >= static_cast<uint32>(FMath::Min(MaxInstances, SimulationSystem->GetCapacity())))
 	{
-		return;
+		return FTrVehicleHandle();
 	}
-			
+
+	// The simulation swaps the new vehicle into the chunk of its archetype, so its data is appended first.
+	const uint32 EntityIndex = NumEntities++;
+	UStaticMesh* Mesh = SpawnRequest.LOD2_Mesh;
+	if(Mesh && !MeshInstances.Contains(Mesh))
+	{
+		ISMCManager->FindOrAddISMC(Mesh);
+		MeshInstances.Add(Mesh);
+	}
+
+	// Actors and mesh instances are added by UpdateLODs, once the vehicle is within a relevancy range.
+	Actors.Push(nullptr);
+	ActorClasses.Push(SpawnRequest.LOD1_Actor.Get());
+	VehicleInstances.Push({Mesh, INDEX_NONE});
+	LODStates.Push(None);
+	LODFrames.Push(0);
+	FTransform MeshTransform = SpawnRequest.Transform;
+	MeshTransform.AddToTranslation(MeshPositionOffset);
+	VehicleTransforms.Push(MeshTransform);
+	PreviousTransforms.Push(MeshTransform);
+
+	const FTrVehicleHandle Handle = SimulationSystem->AddVehicle(SpawnRequest.Transform, SpawnRequest.Path, SpawnRequest.Archetype, SpawnRequest.Velocity);
+	if(!Handle.IsSet())
+	{
+		OnVehicleRemoved(EntityIndex);
+		return FTrVehicleHandle();
+	}
+	return Handle;
+}
+
+bool UTrRepresentationSystem::SpawnPooledActor(UClass* ActorClass)
+{
+	if(!ActorClass)
+	{
+		return false;
+	}
+
+	FActorPool& Pool = ActorPools.FindOrAdd(ActorClass);
+	if(Pool.NumSpawned >= MaxActorsPerClass)
+	{
+		return false;
+	}
+
 	static FActorSpawnParameters SpawnParameters;
 #if UE_EDITOR
 	SpawnParameters.bHideFromSceneOutliner = true;
 #endif
-	if (ATrVehicle* NewActor = Cast<ATrVehicle>(GetWorld()->SpawnActor(SpawnRequest.LOD1_Actor, &SpawnRequest.Transform, SpawnParameters)))
+
+	ATrVehicle* NewActor = Cast<ATrVehicle>(GetWorld()->SpawnActor(ActorClass, &FTransform::Identity, SpawnParameters));
+	if(!NewActor)
+	{
+		return false;
+	}
+
+	SET_ACTOR_ENABLED(NewActor, false);
+	Pool.FreeActors.Push(NewActor);
+	++Pool.NumSpawned;
+	return true;
+}
+
+ATrVehicle* UTrRepresentationSystem::AcquireActor(const uint32 Index)
+{
+	UClass* ActorClass = ActorClasses[Index];
+	if(!ActorClass)
+	{
+		return nullptr;
+	}
+
+	// Pools are only filled by ProcessSpawnRequests, within its time budget. Until then, vehicles keep their instance.
+	// Classes that are not part of the spawn configuration are queued on first use.
+	FActorPool* Pool = ActorPools.Find(ActorClass);
+	if(!Pool || Pool->FreeActors.IsEmpty())
 	{
-		Actors.Push(NewActor);
-		UStaticMesh* Mesh = SpawnRequest.LOD2_Mesh;
-		ISMCManager->AddInstance(Mesh, nullptr, SpawnRequest.Transform);
-		++NumEntities;
-		if(Mesh)
+		if(!Pool)
 		{
-			const uint32 EntityIndex = NumEntities - 1;
-			if(MeshIDs.Contains(Mesh))
-			{
-				MeshIDs[Mesh].Add(NumEntities - 1);
-			}
-			else
-			{
-				MeshIDs.Add(Mesh, {EntityIndex});
-			}
+			PendingActorClasses.AddUnique(ActorClass);
+		}
+		return nullptr;
+	}
+
+	ATrVehicle* Actor = Pool->FreeActors.Pop(false);
+	const FTrVehicleHandle Handle = SimulationSystem->GetVehicleHandle(Index);
+	Actor->OnPossessed.AddUObject(this, &UTrRepresentationSystem::OnVehiclePossessed, Handle);
+	Actor->OnUnpossessed.AddUObject(this, &UTrRepresentationSystem::OnVehicleUnpossessed, Handle);
+	SET_ACTOR_ENABLED(Actor, true);
+	Actors[Index] = Actor;
+	return Actor;
+}
+
+void UTrRepresentationSystem::ReleaseActor(const uint32 Index)
+{
+	ATrVehicle* Actor = Actors[Index];
+	Actors[Index] = nullptr;
+	if(!IsValid(Actor))
+	{
+		return;
+	}
+
+	Actor->OnPossessed.RemoveAll(this);
+	Actor->OnUnpossessed.RemoveAll(this);
+	ControlBatch.Remove(Actor);
+	SET_ACTOR_ENABLED(Actor, false);
+	ActorPools.FindOrAdd(Actor->GetClass()).FreeActors.Push(Actor);
+}
+
+void UTrRepresentationSystem::LogActorPoolStats() const
+{
+	for(const TPair<UClass*, FActorPool>& KVP : ActorPools)
+	{
+		const FActorPool& Pool = KVP.Value;
+		UE_LOG(LogTrafficAI, Display, TEXT("%s : %d / %d actors spawned, %d bound, %d free"),
+			*GetNameSafe(KVP.Key), Pool.NumSpawned, MaxActorsPerClass, Pool.NumSpawned - Pool.FreeActors.Num(), Pool.FreeActors.Num());
+	}
+}
+
+bool UTrRepresentationSystem::RemoveVehicle(const FTrVehicleHandle& Handle)
+{
+	const int32 Index = SimulationSystem->GetVehicleIndex(Handle);
+	if(Index == INDEX_NONE || DetachedVehicles.Contains(Index))
+	{
+		return false;
+	}
+
+	// Per-vehicle data is updated by the swap and removal delegates of the simulation.
+	return SimulationSystem->RemoveVehicle(Handle);
+}
+
+void UTrRepresentationSystem::OnVehiclesSwapped(const uint32 IndexA, const uint32 IndexB)
+{
+	Actors.Swap(IndexA, IndexB);
+	ActorClasses.Swap(IndexA, IndexB);
+	LODStates.Swap(IndexA, IndexB);
+	LODFrames.Swap(IndexA, IndexB);
+	VehicleTransforms.Swap(IndexA, IndexB);
+	PreviousTransforms.Swap(IndexA, IndexB);
+	VehicleInstances.Swap(IndexA, IndexB);
+
+	for(const uint32 Index : {IndexA, IndexB})
+	{
+		const TPair<UStaticMesh*, int32>& Instance = VehicleInstances[Index];
+		if(Instance.Value != INDEX_NONE)
+		{
+			MeshInstances[Instance.Key].Vehicles[Instance.Value] = Index;
 		}
-		SET_ACTOR_ENABLED(NewActor, false);
-		NewActor->OnPossessed.AddUObject(this, &UTrRepresentationSystem::OnVehiclePossessed, NumEntities - 1);
-		LODStates.Push(None);
-		VehicleTransforms.Push(SpawnRequest.Transform);
+	}
+
+	// Relevant vehicles are tracked by index, so both slots are checked again at the next update.
+	if(LODStates[IndexA] != EVehicleLOD::None || LODStates[IndexB] != EVehicleLOD::None
+		|| SimulationSystem->GetSimulationTier(IndexA) == ETrSimulationTier::Full || SimulationSystem->GetSimulationTier(IndexB) == ETrSimulationTier::Full)
+	{
+		RelevantVehicles.Push(IndexA);
+		RelevantVehicles.Push(IndexB);
+	}
+
+	const bool bIsADetached = DetachedVehicles.Contains(IndexA);
+	const bool bIsBDetached = DetachedVehicles.Contains(IndexB);
+	if(bIsADetached != bIsBDetached)
+	{
+		DetachedVehicles.Remove(bIsADetached ? IndexA : IndexB);
+		DetachedVehicles.Add(bIsADetached ? IndexB : IndexA);
 	}
 }
 
-void UTrRepresentationSystem::OnVehiclePossessed(const uint32 Index)
+void UTrRepresentationSystem::OnVehicleRemoved(const uint32 Index)
 {
+	check(Index == NumEntities - 1);
+
+	SetLOD(Index, EVehicleLOD::None, FVector::ZeroVector);
+	Actors.Pop(false);
+	ActorClasses.Pop(false);
+	VehicleInstances.Pop(false);
+	LODStates.Pop(false);
+	LODFrames.Pop(false);
+	VehicleTransforms.Pop(false);
+	PreviousTransforms.Pop(false);
+	DetachedVehicles.Remove(Index);
+	--NumEntities;
+}
+
+void UTrRepresentationSystem::OnVehicleDormant(const uint32 Index, FTrDormantVehicle& DormantVehicle)
+{
+	DormantVehicle.Mesh = VehicleInstances[Index].Key;
+	DormantVehicle.ActorClass = ActorClasses[Index];
+}
+
+void UTrRepresentationSystem::OnRegionLoaded(const int32 Region)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTrRepresentationSystem::OnRegionLoaded)
+
+	if(!SpawnConfiguration)
+	{
+		return;
+	}
+
+	// Vehicles that do not fit stay dormant until the region is loaded again.
+	TArray<FTrDormantVehicle>& DormantVehicles = SimulationSystem->GetDormantVehicles(Region);
+	while(DormantVehicles.Num() > 0)
+	{
+		const FTrDormantVehicle& DormantVehicle = DormantVehicles.Last();
+		FTrafficAISpawnRequest SpawnRequest = MakeSpawnRequest({DormantVehicle.Transform, DormantVehicle.Path});
+		if(DormantVehicle.Mesh || DormantVehicle.ActorClass)
+		{
+			SpawnRequest.LOD2_Mesh = DormantVehicle.Mesh;
+			SpawnRequest.LOD1_Actor = DormantVehicle.ActorClass;
+		}
+		SpawnRequest.Archetype = DormantVehicle.Archetype;
+		SpawnRequest.Velocity = DormantVehicle.Velocity;
+		if(!SpawnSingleVehicle(SpawnRequest).IsSet())
+		{
+			break;
+		}
+		DormantVehicles.Pop(false);
+	}
+}
+
+void UTrRepresentationSystem::OnVehiclePossessed(const FTrVehicleHandle Handle)
+{
+	const int32 Index = SimulationSystem->GetVehicleIndex(Handle);
+	if(Index == INDEX_NONE)
+	{
+		return;
+	}
+
+	// The player drives the actor with physics.
+	SetLOD(Index, EVehicleLOD::Actor, SimulationSystem->GetVelocities()[Index]);
 	SimulationSystem->DetachVehicle(Index);
 	DetachedVehicles.Add(Index);
 }
 
-const TArray<FTransform>& UTrRepresentationSystem::GetInitialTransforms() const
+void UTrRepresentationSystem::OnVehicleUnpossessed(const FTrVehicleHandle Handle)
 {
-	return VehicleTransforms;
+	// Vehicles are also unpossessed when the world is torn down.
+	if(!IsValid(SimulationSystem))
+	{
+		return;
+	}
+
+	const int32 Index = SimulationSystem->GetVehicleIndex(Handle);
+	if(!Actors.IsValidIndex(Index) || !Actors[Index])
+	{
+		return;
+	}
+
+	// Simulated positions do not include the offset applied to meshes.
+	FTransform Transform = Actors[Index]->GetTransform();
+	Transform.AddToTranslation(-MeshPositionOffset);
+	if(SimulationSystem->ReattachVehicle(Index, Transform, Actors[Index]->GetVelocity()))
+	{
+		DetachedVehicles.Remove(Index);
+	}
+}
+
+void UTrRepresentationSystem::OnSimulationTicked()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTrRepresentationSystem::OnSimulationTicked)
+
+	Swap(PreviousTransforms, VehicleTransforms);
+	SimulationSystem->GetVehicleTransforms(VehicleTransforms, MeshPositionOffset);
 }
 
-void UTrRepresentationSystem::UpdateLODs()
+FTransform UTrRepresentationSystem::GetInterpolatedTransform(const uint32 Index) const
+{
+	const FTransform& Previous = PreviousTransforms[Index];
+	const FTransform& Current = VehicleTransforms[Index];
+	return FTransform
+	{
+		FQuat::Slerp(Previous.GetRotation(), Current.GetRotation(), InterpolationAlpha),
+		FMath::Lerp(Previous.GetLocation(), Current.GetLocation(), InterpolationAlpha)
+	};
+}
+
+void UTrRepresentationSystem::UpdateLODs(const float Alpha)
 {
 	TRACE_CPUPROFILER_EVENT_SCOPE(UTrRepresentationSystem::UpdateLODLambda)
 
 	const TArray<FVector>& Velocities = SimulationSystem->GetVelocities();
-	SimulationSystem->GetVehicleTransforms(VehicleTransforms, MeshPositionOffset);
+	InterpolationAlpha = FMath::Clamp(Alpha, 0.0f, 1.0f);
 	
-	FVector FocusLocation(0.0f);
-	if(APawn* Pawn = GetWorld()->GetFirstPlayerController()->GetPawn())
+	UpdateFocuses();
+	if(bViewRelevancy && bUseRenderedVisibility)
+	{
+		for(TPair<UStaticMesh*, FMeshInstances>& KVP : MeshInstances)
+		{
+			KVP.Value.bWasRendered = ISMCManager->WasRecentlyRendered(KVP.Key, RENDERED_VISIBILITY_TOLERANCE);
+		}
+	}
+
+	for(const uint32 Index : DetachedVehicles)
+	{
+		SimulationSystem->OverrideTransform(Index, Actors[Index]->GetTransform());
+	}
+
+	// The candidates of all focuses are merged, each vehicle being marked by the first query that finds it.
+	// Simulated positions do not include the offset applied to meshes.
+	++LODFrame;
+	LODCandidates.Reset();
+	const float RelevancyRadius = GetRelevancyRadius(ActorRelevancyRange, KinematicRelevancyRange, StaticMeshRelevancyRange) + LODHysteresis;
+	for(const FTrFocus& Focus : ActiveFocuses)
+	{
+		const float FocusRadius = GetFocusRadius(Focus, RelevancyRadius, LODHysteresis);
+		if(FocusRadius <= 0.0f)
+		{
+			LODCandidates.Reset();
+			for(uint32 Index = 0; Index < NumEntities; ++Index)
+			{
+				LODFrames[Index] = LODFrame;
+				LODCandidates.Push(Index);
+			}
+			break;
+		}
+
+		const int32 FirstCandidate = LODCandidates.Num();
+		SimulationSystem->FindVehiclesInRadius(Focus.Location - MeshPositionOffset, FocusRadius, LODCandidates);
+		int32 NumFound = FirstCandidate;
+		for(int32 Candidate = FirstCandidate; Candidate < LODCandidates.Num(); ++Candidate)
+		{
+			const int32 Index = LODCandidates[Candidate];
+			if(LODFrames[Index] != LODFrame)
+			{
+				LODFrames[Index] = LODFrame;
+				LODCandidates[NumFound++] = Index;
+			}
+		}
+		LODCandidates.SetNum(NumFound, false);
+	}
+
+	// Candidates are classified in parallel. Changes of LOD touch actors and instance buffers, so they are applied on the game thread.
+	const int32 NumCandidates = LODCandidates.Num();
+	CandidateDistances.SetNumUninitialized(NumCandidates, false);
+	CandidateFocuses.SetNumUninitialized(NumCandidates, false);
+	CandidateLODs.SetNumUninitialized(NumCandidates, false);
+	CandidateVisibilities.SetNumUninitialized(NumCandidates, false);
+	ParallelFor(NumCandidates, [this](const int32 Candidate)
+	{
+		const int32 Index = LODCandidates[Candidate];
+		const FVector& Location = VehicleTransforms[Index].GetLocation();
+		CandidateFocuses[Candidate] = FindClosestFocus(Location, CandidateDistances[Candidate]);
+		CandidateLODs[Candidate] = CandidateFocuses[Candidate] != INDEX_NONE ? GetDesiredLOD(LODStates[Index], CandidateDistances[Candidate]) : EVehicleLOD::None;
+		CandidateVisibilities[Candidate] = !bViewRelevancy || IsInView(Location, LODStates[Index] != EVehicleLOD::None);
+
+		// Actors are kept out of view, where the player can still run into them.
+		if(!CandidateVisibilities[Candidate] && CandidateLODs[Candidate] != EVehicleLOD::Actor)
+		{
+			CandidateLODs[Candidate] = EVehicleLOD::None;
+		}
+	}, GetParallelForFlags(NumCandidates));
+
+	// Changes that bind or release an actor, or switch its physics, are deferred to the budget. Other changes are applied at once.
+	PendingPromotions.Reset();
+	PendingDemotions.Reset();
+	const auto RequestLOD = [&](const int32 Index, const EVehicleLOD NewLOD, const int32 Focus)
+	{
+		EVehicleLOD OldLOD = LODStates[Index];
+		if(HasActor(OldLOD) == HasActor(NewLOD) && (OldLOD == EVehicleLOD::Actor) == (NewLOD == EVehicleLOD::Actor))
+		{
+			SetLOD(Index, NewLOD, Velocities[Index]);
+			return;
+		}
+
+		// Vehicles waiting for an actor are shown by their instance meanwhile, so they never pop in late.
+		if(OldLOD == EVehicleLOD::None && VehicleInstances[Index].Key)
+		{
+			SetLOD(Index, EVehicleLOD::StaticMesh, Velocities[Index]);
+			OldLOD = EVehicleLOD::StaticMesh;
+		}
+
+		// LODs are ordered from the most detailed. Vehicles outside of all focuses are demoted first.
+		const float Priority = Focus != INDEX_NONE ? GetLODPriority(Index, ActiveFocuses[Focus], Velocities[Index]) : 0.0f;
+		(NewLOD > OldLOD ? PendingDemotions : PendingPromotions).Push({Index, NewLOD, Priority});
+	};
+
+	// Vehicles that were relevant at the last update, and have not been found this time, left the relevancy radius of all focuses.
+	int32 NumRelevant = 0;
+	for(const int32 Index : RelevantVehicles)
 	{
-		FocusLocation = Pawn->GetActorLocation();	
+		if(Index >= static_cast<int32>(NumEntities) || LODFrames[Index] == LODFrame || DetachedVehicles.Contains(Index))
+		{
+			continue;
+		}
+
+		// Slots pushed twice by swaps are only visited once.
+		LODFrames[Index] = LODFrame;
+		SimulationSystem->SetSimulationTier(Index, ETrSimulationTier::Reduced);
+		RequestLOD(Index, EVehicleLOD::None, INDEX_NONE);
+		if(HasActor(LODStates[Index]))
+		{
+			RelevantVehicles[NumRelevant++] = Index;
+		}
+	}
+	RelevantVehicles.SetNum(NumRelevant, false);
+
+	for(int32 Candidate = 0; Candidate < NumCandidates; ++Candidate)
+	{
+		const int32 Index = LODCandidates[Candidate];
+		if(CandidateLODs[Candidate] != LODStates[Index] && !DetachedVehicles.Contains(Index))
+		{
+			RequestLOD(Index, CandidateLODs[Candidate], CandidateFocuses[Candidate]);
+		}
+
+		// Candidates are tracked even without a LOD, so that their simulation tier is reduced once they leave.
+		const bool bIsVisible = CandidateVisibilities[Candidate] && (!bUseRenderedVisibility || WasRecentlyRendered(Index));
+		SimulationSystem->SetSimulationTier(Index, bIsVisible || LODStates[Index] == EVehicleLOD::Actor ? ETrSimulationTier::Full : ETrSimulationTier::Reduced);
+		RelevantVehicles.Push(Index);
 	}
 
-	for (uint32 EntityIndex = 0; EntityIndex < NumEntities; ++EntityIndex) 
+	// Actors are released from the least visible vehicles, and bound to the most visible ones.
+	// Both share the budget, and demotions come first so that their actors return to the pools.
+	PendingDemotions.Sort([](const FLODSwap& A, const FLODSwap& B) { return A.Priority < B.Priority; });
+	PendingPromotions.Sort([](const FLODSwap& A, const FLODSwap& B) { return A.Priority > B.Priority; });
+	int32 NumSwaps = 0;
+	for(const TArray<FLODSwap>* PendingSwaps : {&PendingDemotions, &PendingPromotions})
 	{
-		if(DetachedVehicles.Contains(EntityIndex))
+		for(int32 Swap = 0; Swap < PendingSwaps->Num() && NumSwaps < MaxActorSwapsPerFrame; ++Swap, ++NumSwaps)
+		{
+			const FLODSwap& LODSwap = (*PendingSwaps)[Swap];
+			SetLOD(LODSwap.Index, LODSwap.LOD, Velocities[LODSwap.Index]);
+		}
+	}
+
+	// Relevant vehicles are made unique, so that each actor is moved once.
+	++LODFrame;
+	NumRelevant = 0;
+	for(const int32 Index : RelevantVehicles)
+	{
+		if(LODFrames[Index] == LODFrame)
 		{
-			SimulationSystem->OverrideTransform(EntityIndex, Actors[EntityIndex]->GetTransform());
 			continue;
 		}
-		
-		const float Distance = FVector::Distance(FocusLocation, VehicleTransforms[EntityIndex].GetLocation());
-		const bool bIsActorRelevant = ActorRelevancyRange.Contains(Distance);
-		SET_ACTOR_ENABLED(Actors[EntityIndex], bIsActorRelevant);
-		
-		if(bIsActorRelevant)
+
+		LODFrames[Index] = LODFrame;
+		RelevantVehicles[NumRelevant++] = Index;
+		if(!DetachedVehicles.Contains(Index))
+		{
+			UpdateActorTransform(Index);
+		}
+	}
+	RelevantVehicles.SetNum(NumRelevant, false);
+
+	for(TPair<UStaticMesh*, FMeshInstances>& KVP : MeshInstances)
+	{
+		FMeshInstances& Instances = KVP.Value;
+		UpdateInstanceTransforms(Instances);
+		ISMCManager->UpdateInstances(KVP.Key, Instances.Transforms, Instances.FirstDirty, Instances.EndDirty);
+		Instances.FirstDirty = MAX_int32;
+		Instances.EndDirty = 0;
+	}
+}
+
+void UTrRepresentationSystem::SetLOD(const uint32 Index, EVehicleLOD NewLOD, const FVector& Velocity)
+{
+	const EVehicleLOD OldLOD = LODStates[Index];
+	if(NewLOD == OldLOD)
+	{
+		return;
+	}
+
+	// Vehicles left without an actor by an exhausted pool keep their instance within the actor and kinematic relevancy ranges.
+	if(HasActor(NewLOD) && !HasActor(OldLOD) && !AcquireActor(Index))
+	{
+		NewLOD = EVehicleLOD::StaticMesh;
+		if(NewLOD == OldLOD)
 		{
-			if(LODStates[EntityIndex] == EVehicleLOD::StaticMesh)
+			return;
+		}
+	}
+
+	if(OldLOD == EVehicleLOD::StaticMesh)
+	{
+		HideInstance(Index);
+	}
+	else if(HasActor(OldLOD) && !HasActor(NewLOD))
+	{
+		ReleaseActor(Index);
+	}
+	else if(OldLOD == EVehicleLOD::Actor)
+	{
+		ControlBatch.Remove(Actors[Index]);
+	}
+
+	if(HasActor(NewLOD))
+	{
+		ATrVehicle* Actor = Actors[Index];
+		const FTransform Transform = GetInterpolatedTransform(Index);
+		Actor->SetPhysicsEnabled(NewLOD == EVehicleLOD::Actor);
+		Actor->OnActivated(Transform, Velocity);
+		if(NewLOD == EVehicleLOD::Actor)
+		{
+			ControlBatch.Add(Actor, Transform);
+		}
+	}
+	else if(NewLOD == EVehicleLOD::StaticMesh)
+	{
+		ShowInstance(Index);
+	}
+	LODStates[Index] = NewLOD;
+}
+
+EVehicleLOD UTrRepresentationSystem::GetDesiredLOD(const EVehicleLOD CurrentLOD, const float Distance) const
+{
+	if((CurrentLOD == EVehicleLOD::Actor && ContainsWithMargin(ActorRelevancyRange, Distance, LODHysteresis))
+		|| (CurrentLOD == EVehicleLOD::Kinematic && ContainsWithMargin(KinematicRelevancyRange, Distance, LODHysteresis))
+		|| (CurrentLOD == EVehicleLOD::StaticMesh && ContainsWithMargin(StaticMeshRelevancyRange, Distance, LODHysteresis)))
+	{
+		return CurrentLOD;
+	}
+	return ActorRelevancyRange.Contains(Distance) ? EVehicleLOD::Actor
+		: KinematicRelevancyRange.Contains(Distance) ? EVehicleLOD::Kinematic
+		: StaticMeshRelevancyRange.Contains(Distance) ? EVehicleLOD::StaticMesh
+		: EVehicleLOD::None;
+}
+
+float UTrRepresentationSystem::GetLODPriority(const uint32 Index, const FTrFocus& Focus, const FVector& Velocity) const
+{
+	const FVector& Location = VehicleTransforms[Index].GetLocation();
+	const FVector ToFocus = Focus.Location - Location;
+	const float ApproachSpeed = (Velocity - Focus.Velocity).Dot(ToFocus.GetSafeNormal());
+	const float PredictedDistance = FMath::Max(ToFocus.Length() - ApproachSpeed * LOD_PRIORITY_LOOKAHEAD, 1.0f);
+
+	const UStaticMesh* Mesh = VehicleInstances[Index].Key;
+	const float Radius = Mesh ? Mesh->GetBounds().SphereRadius : DEFAULT_VEHICLE_RADIUS;
+	return Radius * Focus.Weight / PredictedDistance;
+}
+
+void UTrRepresentationSystem::UpdateFocuses()
+{
+	ActiveFocuses.Reset();
+	FocusViews.Reset();
+	const auto AddView = [this](const FTrFocus& Focus, const FVector& ViewLocation)
+	{
+		const float HalfAngle = Focus.FieldOfView * 0.5f + VIEW_CONE_MARGIN;
+		const bool bHasView = !Focus.ViewDirection.IsNearlyZero();
+		FocusViews.Push(
+		{
+			ViewLocation,
+			Focus.ViewDirection.GetSafeNormal(),
+			bHasView ? FMath::Cos(FMath::DegreesToRadians(FMath::Min(HalfAngle, 180.0f))) : -1.0f,
+			bHasView ? FMath::Cos(FMath::DegreesToRadians(FMath::Min(HalfAngle + VIEW_HYSTERESIS, 180.0f))) : -1.0f
+		});
+	};
+
+	if(bFocusOnPlayers)
+	{
+		for(FConstPlayerControllerIterator Iterator = GetWorld()->GetPlayerControllerIterator(); Iterator; ++Iterator)
+		{
+			const APlayerController* PlayerController = Iterator->Get();
+			if(!PlayerController)
 			{
-				LODStates[EntityIndex] = EVehicleLOD::Actor;
-				Actors[EntityIndex]->OnActivated(VehicleTransforms[EntityIndex], Velocities[EntityIndex]);
+				continue;
 			}
-			else
+
+			// The view is seen from the camera, which may be away from the pawn.
+			FTrFocus& Focus = ActiveFocuses.AddDefaulted_GetRef();
+			FVector ViewLocation;
+			FRotator ViewRotation;
+			PlayerController->GetPlayerViewPoint(ViewLocation, ViewRotation);
+			Focus.Location = ViewLocation;
+			Focus.ViewDirection = ViewRotation.Vector();
+			if(PlayerController->PlayerCameraManager)
 			{
-				Actors[EntityIndex]->SetDesiredTransform(VehicleTransforms[EntityIndex]);
+				Focus.FieldOfView = PlayerController->PlayerCameraManager->GetFOVAngle();
 			}
+			if(const APawn* Pawn = PlayerController->GetPawn())
+			{
+				Focus.Location = Pawn->GetActorLocation();
+				Focus.Velocity = Pawn->GetVelocity();
+			}
+			AddView(Focus, ViewLocation);
 		}
-		else
+	}
+
+	for(auto Iterator = Focuses.CreateIterator(); Iterator; ++Iterator)
+	{
+		FTrFocus& Focus = Iterator.Value();
+		if(!Focus.Actor.IsExplicitlyNull())
 		{
-			LODStates[EntityIndex] = EVehicleLOD::StaticMesh;
+			const AActor* Actor = Focus.Actor.Get();
+			if(!Actor)
+			{
+				Iterator.RemoveCurrent();
+				continue;
+			}
+			Focus.Location = Actor->GetActorLocation();
+			Focus.Velocity = Actor->GetVelocity();
+			if(!Focus.ViewDirection.IsNearlyZero())
+			{
+				Focus.ViewDirection = Actor->GetActorForwardVector();
+			}
 		}
+		ActiveFocuses.Push(Focus);
+		AddView(Focus, Focus.Location);
 	}
-	
-	for(auto KVP : MeshIDs)
+
+	for(FTrFocus& Focus : ActiveFocuses)
+	{
+		Focus.Weight = FMath::Max(Focus.Weight, UE_KINDA_SMALL_NUMBER);
+	}
+
+	// Regions are streamed around the same points of view, at least as far as vehicles are relevant, so that no rendered vehicle goes dormant.
+	FocusLocations.Reset();
+	float MinLoadingRange = 0.0f;
+	const float RelevancyRadius = GetRelevancyRadius(ActorRelevancyRange, KinematicRelevancyRange, StaticMeshRelevancyRange) + LODHysteresis;
+	for(const FTrFocus& Focus : ActiveFocuses)
+	{
+		FocusLocations.Push(Focus.Location - MeshPositionOffset);
+		const float FocusRadius = GetFocusRadius(Focus, RelevancyRadius, LODHysteresis);
+		MinLoadingRange = FocusRadius > 0.0f ? FMath::Max(MinLoadingRange, FocusRadius) : TNumericLimits<float>::Max();
+	}
+	SimulationSystem->SetStreamingSources(FocusLocations, MinLoadingRange);
+}
+
+int32 UTrRepresentationSystem::FindClosestFocus(const FVector& Location, float& OutDistance) const
+{
+	int32 ClosestFocus = INDEX_NONE;
+	OutDistance = TNumericLimits<float>::Max();
+	for(int32 Focus = 0; Focus < ActiveFocuses.Num(); ++Focus)
 	{
-		const TArray<uint32>& Indices = KVP.Value;
-		TArray<FTransform> Transforms;
-		for(uint32 Index : Indices)
+		const FTrFocus& CurrentFocus = ActiveFocuses[Focus];
+		const float Distance = FVector::Distance(CurrentFocus.Location, Location);
+		if((CurrentFocus.Radius <= 0.0f || Distance <= CurrentFocus.Radius) && Distance / CurrentFocus.Weight < OutDistance)
 		{
-			Transforms.Push(VehicleTransforms[Index]);
-			const float Distance = FVector::Distance(FocusLocation, VehicleTransforms[Index].GetLocation());
-			const bool bIsMeshRelevant = StaticMeshRelevancyRange.Contains(Distance);
-			Transforms.Last().SetScale3D(bIsMeshRelevant * FVector::OneVector);
+			OutDistance = Distance / CurrentFocus.Weight;
+			ClosestFocus = Focus;
+		}
+	}
+	return ClosestFocus;
+}
+
+bool UTrRepresentationSystem::IsInView(const FVector& Location, const bool bWasVisible) const
+{
+	for(int32 Focus = 0; Focus < ActiveFocuses.Num(); ++Focus)
+	{
+		const FTrFocus& CurrentFocus = ActiveFocuses[Focus];
+		if(CurrentFocus.Radius > 0.0f && FVector::DistSquared(CurrentFocus.Location, Location) > FMath::Square(CurrentFocus.Radius))
+		{
+			continue;
+		}
+
+		const FFocusView& View = FocusViews[Focus];
+		const FVector ToLocation = Location - View.Location;
+		if(ToLocation.Dot(View.Direction) >= (bWasVisible ? View.CosHalfAngleWide : View.CosHalfAngle) * ToLocation.Length())
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool UTrRepresentationSystem::WasRecentlyRendered(const uint32 Index) const
+{
+	if(LODStates[Index] == EVehicleLOD::Kinematic)
+	{
+		return Actors[Index]->WasRecentlyRendered(RENDERED_VISIBILITY_TOLERANCE);
+	}
+	if(LODStates[Index] == EVehicleLOD::StaticMesh)
+	{
+		// Vehicles whose variant has no static mesh have no instance, so nothing of them is rendered.
+		const FMeshInstances* Instances = MeshInstances.Find(VehicleInstances[Index].Key);
+		return Instances && Instances->bWasRendered;
+	}
+	return true;
+}
+
+void UTrRepresentationSystem::UpdateActorTransform(const uint32 Index)
+{
+	if(LODStates[Index] == EVehicleLOD::Actor)
+	{
+		ControlBatch.SetDesiredTransform(Actors[Index], GetInterpolatedTransform(Index));
+	}
+	else if(LODStates[Index] == EVehicleLOD::Kinematic)
+	{
+		Actors[Index]->SetActorTransform(GetInterpolatedTransform(Index), false, nullptr, ETeleportType::TeleportPhysics);
+	}
+}
+
+void UTrRepresentationSystem::ShowInstance(const uint32 Index)
+{
+	TPair<UStaticMesh*, int32>& Instance = VehicleInstances[Index];
+	if(!Instance.Key || Instance.Value != INDEX_NONE)
+	{
+		return;
+	}
+
+	// The slot may still be rendered, if an instance was hidden during the same update.
+	FMeshInstances& Instances = MeshInstances[Instance.Key];
+	Instance.Value = Instances.Vehicles.Push(Index);
+	Instances.Transforms.Push(GetInterpolatedTransform(Index));
+	Instances.MarkDirty(Instance.Value);
+}
+
+void UTrRepresentationSystem::HideInstance(const uint32 Index)
+{
+	TPair<UStaticMesh*, int32>& Instance = VehicleInstances[Index];
+	if(Instance.Value == INDEX_NONE)
+	{
+		return;
+	}
+
+	FMeshInstances& Instances = MeshInstances[Instance.Key];
+	const int32 LastInstance = Instances.Vehicles.Num() - 1;
+	if(Instance.Value != LastInstance)
+	{
+		const int32 LastVehicle = Instances.Vehicles[LastInstance];
+		Instances.Vehicles[Instance.Value] = LastVehicle;
+		Instances.Transforms[Instance.Value] = Instances.Transforms[LastInstance];
+		Instances.MarkDirty(Instance.Value);
+		VehicleInstances[LastVehicle].Value = Instance.Value;
+	}
+
+	Instances.Vehicles.Pop(false);
+	Instances.Transforms.Pop(false);
+	Instance.Value = INDEX_NONE;
+}
+
+void UTrRepresentationSystem::UpdateInstanceTransforms(FMeshInstances& Instances)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTrRepresentationSystem::UpdateInstanceTransforms)
+
+	// Each chunk writes its own instances, and the range of those that moved. Ranges are merged once all chunks are done.
+	const int32 NumInstances = Instances.Vehicles.Num();
+	const int32 NumChunks = FMath::DivideAndRoundUp(NumInstances, INSTANCE_CHUNK_SIZE);
+	ChunkDirtyRanges.SetNumUninitialized(NumChunks, false);
+	ParallelFor(NumChunks, [this, &Instances, NumInstances](const int32 Chunk)
+	{
+		int32 FirstDirty = MAX_int32;
+		int32 EndDirty = 0;
+		const int32 ChunkEnd = FMath::Min((Chunk + 1) * INSTANCE_CHUNK_SIZE, NumInstances);
+		for(int32 Instance = Chunk * INSTANCE_CHUNK_SIZE; Instance < ChunkEnd; ++Instance)
+		{
+			const FTransform Transform = GetInterpolatedTransform(Instances.Vehicles[Instance]);
+			if(!Instances.Transforms[Instance].Equals(Transform))
+			{
+				Instances.Transforms[Instance] = Transform;
+				FirstDirty = FMath::Min(FirstDirty, Instance);
+				EndDirty = Instance + 1;
+			}
+		}
+		ChunkDirtyRanges[Chunk] = {FirstDirty, EndDirty};
+	}, GetParallelForFlags(NumInstances));
+
+	for(const TPair<int32, int32>& DirtyRange : ChunkDirtyRanges)
+	{
+		if(DirtyRange.Value > 0)
+		{
+			Instances.MarkDirty(DirtyRange.Key);
+			Instances.MarkDirty(DirtyRange.Value - 1);
 		}
-		
-		ISMCManager->GetISMC(KVP.Key)->BatchUpdateInstancesTransforms(0, Transforms, true, true, true);
 	}
 }
 
 void UTrRepresentationSystem::PostInitialize()
 {
 	SimulationSystem = GetWorld()->GetSubsystem<UTrSimulationSystem>();
+	SimulationSystem->OnVehiclesSwapped.AddUObject(this, &UTrRepresentationSystem::OnVehiclesSwapped);
+	SimulationSystem->OnVehicleRemoved.AddUObject(this, &UTrRepresentationSystem::OnVehicleRemoved);
+	SimulationSystem->OnVehicleDormant.AddUObject(this, &UTrRepresentationSystem::OnVehicleDormant);
+	SimulationSystem->OnRegionLoaded.AddUObject(this, &UTrRepresentationSystem::OnRegionLoaded);
 	Super::PostInitialize();
 }
 
@@ -240,6 +1201,44 @@ void FTrVehicleStartCreator::CreateVehicleStartsOnGraph
 	}
 }
 
+void FTrVehicleStartCreator::CreateVehicleStartsOnNetwork
+(
+	const FTrRoadNetwork& Network,
+	const UTrSpawnConfiguration* SpawnConfiguration,
+	const int MaxInstances,
+	TArray<FTrVehiclePathTransform>& OutVehicleStarts
+)
+{
+	check(SpawnConfiguration);
+
+	TArray<FTrVehiclePathTransform> TempVehicleStarts;
+	for(int32 Edge = 0; Edge < Network.GetNumEdges(); ++Edge)
+	{
+		if(Network.GetEdgeLength(Edge) <= 2.0f * SpawnConfiguration->IntersectionCutoff)
+		{
+			continue;
+		}
+
+		const uint32 StartNode = Network.GetEdgeStartNode(Edge);
+		const uint32 EndNode = Network.GetEdgeEndNode(Edge);
+		const FVector& StartLocation = Network.GetNodeLocation(StartNode);
+		const FVector& EndLocation = Network.GetNodeLocation(EndNode);
+
+		TempVehicleStarts.Reset();
+		CreateStartTransformsOnEdge(StartLocation, EndLocation, SpawnConfiguration, TempVehicleStarts);
+		for(FTrVehiclePathTransform& StartData : TempVehicleStarts)
+		{
+			if(OutVehicleStarts.Num() >= MaxInstances)
+			{
+				return;
+			}
+
+			StartData.Path = Network.MakePath(Edge);
+			OutVehicleStarts.Push(StartData);
+		}
+	}
+}
+
 void FTrVehicleStartCreator::CreateStartTransformsOnEdge
 (
 	const FVector& Start,
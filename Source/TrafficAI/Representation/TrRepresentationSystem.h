@@ -3,17 +3,59 @@
 #pragma once
 #include "CoreMinimal.h"
 #include "TrTypes.h"
+#include "TrafficAI/Simulation/TrRoadNetwork.h"
 #include "TrafficAI/Vehicles/TrVehicle.h"
+#include "TrafficAI/Vehicles/TrVehicleControlBatch.h"
 #include "TrRepresentationSystem.generated.h"
 
+// Broadcast after each batch of spawn requests, with the number of requests processed and the number of requests queued since the queue was last empty.
+DECLARE_MULTICAST_DELEGATE_TwoParams(FTrOnSpawnProgress, const int32, const int32);
+
 UENUM()
 enum EVehicleLOD
 {
 	Actor,
+	Kinematic,
 	StaticMesh,
 	None
 };
 
+/**
+ * A point of view around which vehicles are relevant, such as a player, a spectator or a cinematic camera.
+ * Vehicles take the LOD given by the focus they are the closest to, relative to its weight.
+ */
+USTRUCT(BlueprintType)
+struct TRAFFICAI_API FTrFocus
+{
+	GENERATED_BODY()
+
+	// Actor followed by the focus. When set, the location and velocity of the focus are read from it at each update, and the focus is dropped once it is destroyed.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	TWeakObjectPtr<AActor> Actor;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	FVector Location = FVector::ZeroVector;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	FVector Velocity = FVector::ZeroVector;
+
+	// Distances to this focus are divided by its weight, so vehicles keep more detail farther from a focus with a larger weight.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = 0.01, UIMin = 0.01))
+	float Weight = 1.0f;
+
+	// Distance beyond which this focus makes no vehicle relevant, or zero to only be limited by the relevancy ranges.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (Units = "cm", ClampMin = 0, UIMin = 0))
+	float Radius = 0.0f;
+
+	// Direction the focus looks at, or zero for a focus that sees in all directions. It follows the forward vector of the actor, if there is one.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	FVector ViewDirection = FVector::ZeroVector;
+
+	// Horizontal field of view of the focus.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (Units = "deg", ClampMin = 0, UIMin = 0, ClampMax = 360, UIMax = 360))
+	float FieldOfView = 90.0f;
+};
+
 // Information required to spawn an Entity.
 USTRUCT(BlueprintType)
 struct TRAFFICAI_API FTrafficAISpawnRequest
@@ -31,6 +73,17 @@ struct TRAFFICAI_API FTrafficAISpawnRequest
 	// Initial transform when the Entity is spawned.
 	UPROPERTY(EditAnywhere, BlueprintReadWrite)
 	FTransform Transform;
+
+	// Archetype whose dynamics are used by the simulation. The default dynamics are used if it is not set.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	FName Archetype;
+
+	// Initial velocity of the Entity.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	FVector Velocity = FVector::ZeroVector;
+
+	// Path the Entity starts on. Entities spawned without a path start on the lane closest to their transform.
+	FTrPath Path;
 };
 
 class TRAFFICAI_API FTrVehicleStartCreator
@@ -52,6 +105,20 @@ public:
 		TArray<FTrVehiclePathTransform>& OutVehicleStarts
 	);
 
+	/**
+	 * \brief Creates vehicle start positions along the edges of a road network.
+	 *
+	 * Used for networks that do not come from a spatial graph, such as imported networks.
+	 * Edges too short to hold a vehicle outside of the intersection cutoff, like turns inside intersections, are skipped.
+	 */
+	static void CreateVehicleStartsOnNetwork
+	(
+		const FTrRoadNetwork& Network,
+		const UTrSpawnConfiguration* SpawnConfiguration,
+		const int MaxInstances,
+		TArray<FTrVehiclePathTransform>& OutVehicleStarts
+	);
+
 	/**
 	 * \brief Creates vehicle start positions along an edge between specified start and destination points.
 	 *
@@ -75,6 +142,20 @@ public:
  * It provides methods to spawn vehicles on a specified graph and to push requests to spawn single vehicles.
  * It also provides methods to retrieve references to the spawned entities and the vehicle start transforms.
  * The UTrRepresentationSystem class is a part of the Traffic AI system in the game.
+ *
+ * Relevancy is the union of a set of focuses: the players, and the focuses added with SetFocus. Vehicles found around all of them are classified
+ * in a single pass, which also sets the simulation tier of each vehicle, and the focuses are the streaming sources of the simulation regions.
+ * Vehicles outside of the views of all focuses are not rendered beyond the actor relevancy range, and are simulated at the reduced tier.
+ *
+ * Per-vehicle data is indexed like the dense arrays of the simulation system, and kept in sync through its swap and removal delegates.
+ * Only vehicles with the static mesh LOD have a mesh instance. Instances are kept compact, so rendering costs scale with visible vehicles,
+ * and only the range of instances whose transform changed is uploaded at each update.
+ *
+ * Actors are not owned by vehicles. Each actor class has a pool of at most MaxActorsPerClass actors, spawned up front and disabled.
+ * An actor is bound to a vehicle when it enters the actor relevancy range, and returned to the pool when it leaves.
+ * Vehicles that enter the range while the pool of their class is exhausted keep their static mesh instance.
+ * Within the kinematic relevancy range, actors are bound without physics, and placed at the simulated transforms every frame,
+ * so that skeletal details are shown while rigid body simulation is kept to the vehicles closest to the player.
  */
 UCLASS(config = Game, DefaultConfig, DisplayName = "Traffic Representation System")
 class TRAFFICAI_API UTrRepresentationSystem : public UWorldSubsystem
@@ -83,28 +164,101 @@ class TRAFFICAI_API UTrRepresentationSystem : public UWorldSubsystem
 
 public:
 	
-	// Spawn Vehicles
+	// Spawn Vehicles. The simulation system must have been initialized.
 	UFUNCTION(BlueprintCallable)
 	void SpawnVehiclesOnGraph(const URpSpatialGraphComponent* NewGraphComponent, const UTrSpawnConfiguration* NewRequestData);
 
-	// Push a request to spawn an Entity. The request is not guaranteed to be processed immediately.
+	/**
+	 * @brief Queues a vehicle on each of the provided starts, for instance starts loaded from baked traffic data.
+	 * Actor pools are filled, and vehicles spawned, by ProcessSpawnRequests over the next frames.
+	 */
+	void SpawnVehicles(const TArray<FTrVehiclePathTransform>& NewVehicleStarts, const UTrSpawnConfiguration* NewSpawnConfiguration);
+
+	/**
+	 * @brief Spawns an Entity, and adds it to the simulation.
+	 * @return A handle to the vehicle, that is not set if the maximum number of Entities has been reached.
+	 */
+	UFUNCTION(BlueprintCallable)
+	FTrVehicleHandle SpawnSingleVehicle(const FTrafficAISpawnRequest& SpawnRequest);
+
+	// Removes an Entity from the simulation. Vehicles possessed by the player can not be removed.
+	UFUNCTION(BlueprintCallable)
+	bool RemoveVehicle(const FTrVehicleHandle& Handle);
+
+	/**
+	 * @brief Spawns the queued actors and vehicles, at most ProcessingBatchSize vehicles and for at most SpawnTimeBudget.
+	 * At least one actor or vehicle is spawned per call, whatever the budget. Each vehicle joins the simulation as soon as it is spawned.
+	 * Must be called every frame.
+	 */
+	void ProcessSpawnRequests();
+
+	// Returns true while spawn requests or actors of the pools are left to spawn.
+	UFUNCTION(BlueprintCallable)
+	bool IsSpawning() const { return SpawnRequests.Num() > 0 || PendingActorClasses.Num() > 0; }
+
+	// Number of spawn requests queued and not processed yet.
+	int32 GetNumPendingSpawns() const { return SpawnRequests.Num() - NumProcessedSpawnRequests; }
+
+	void OnVehiclePossessed(const FTrVehicleHandle Handle);
+
+	// Hands a vehicle released by the player back to the simulation.
+	void OnVehicleUnpossessed(const FTrVehicleHandle Handle);
+
+	// Adds a focus, or replaces the focus of the same name.
+	UFUNCTION(BlueprintCallable)
+	void SetFocus(const FName Name, const FTrFocus& Focus) { Focuses.Add(Name, Focus); }
+
 	UFUNCTION(BlueprintCallable)
-	void SpawnSingleVehicle(const FTrafficAISpawnRequest& SpawnRequest);
-	void OnVehiclePossessed(uint32 Index);
+	void RemoveFocus(const FName Name) { Focuses.Remove(Name); }
 
 	// Returns a const reference to an array of Vehicle Start Transforms.
 	const TArray<FTrVehiclePathTransform>& GetVehicleStarts() const { return VehicleStarts; }
 
-	const TArray<FTransform>& GetInitialTransforms() const;
+	// Returns the maximum number of vehicles that can be spawned.
+	int GetMaxInstances() const { return MaxInstances; }
+
+	// Returns the maximum number of actors of each class, bound to the vehicles within the actor relevancy range.
+	int32 GetMaxActorsPerClass() const { return MaxActorsPerClass; }
+
+	// Prints the number of actors spawned, bound and free in the pool of each class.
+	void LogActorPoolStats() const;
 	
 	// Reset SharedPtrs to Entities.
 	virtual void BeginDestroy() override;
 
+	FTrOnSpawnProgress OnSpawnProgress;
+
 	// Create this Subsystem only if playing in PIE or in game.
 	virtual bool ShouldCreateSubsystem(UObject* Outer) const override;
 
-	//This method iterates through the entities in the system and switches their LODs based on the distance to the player. 
-	void UpdateLODs();
+	/**
+	 * @brief Switches the LODs of vehicles based on their distance to the focuses.
+	 *
+	 * Only the vehicles found within the relevancy ranges of a focus by radius queries on the simulation, and the vehicles that were relevant
+	 * at the last update, are visited. Actors are bound and released, and mesh instances shown and hidden, only when a LOD changes.
+	 * Candidates are classified, and instance transforms written, in parallel. Only changes of LOD and actor transforms are applied serially.
+	 *
+	 * @param Alpha Time elapsed since the last simulation step, as a fraction of the step interval.
+	 * Relevant vehicles are placed between the transforms of the last two steps, so motion is smooth when the simulation ticks below the frame rate.
+	 */
+	void UpdateLODs(const float Alpha = 1.0f);
+
+	// Captures the transforms of a simulation step. The transforms of the previous step are kept for interpolation.
+	void OnSimulationTicked();
+
+	// Drives the actors of active vehicles towards their interpolated transforms. Must be called every frame, after UpdateLODs.
+	void UpdateVehicleControls(const float DeltaSeconds) { ControlBatch.Update(DeltaSeconds); }
+
+	// Returns the interval between two simulation steps, or zero if the simulation ticks once per frame.
+	float GetTickRate() const { return TickRate; }
+
+	/**
+	 * @brief Keeps the number of vehicles around the player constant, when ambient traffic is enabled in the spawn configuration.
+	 *
+	 * Vehicles are spawned until the target count is reached. Vehicles left beyond the spawn range, and out of view,
+	 * are recycled onto lanes ahead of the player, outside of the view cone, so that they never appear or disappear on screen.
+	 */
+	void UpdateAmbientTraffic();
 	
 	virtual void PostInitialize() override;
 
@@ -113,22 +267,67 @@ protected:
 	UPROPERTY()
 	TObjectPtr<class ATrISMCManager> ISMCManager;
 
-	uint32 NumEntities;
+	uint32 NumEntities = 0;
 
 private:
 
+	// The players are focuses, in addition to the focuses added with SetFocus. Pawns are used when players have one, and view points otherwise.
+	UPROPERTY(Config, EditAnywhere, Category = "Representation System | Update Settings")
+	bool bFocusOnPlayers = true;
+
+	/**
+	 * Vehicles outside of the view cones of all focuses lose their LOD beyond the actor relevancy range, and are simulated at the reduced tier.
+	 * Actors within the actor relevancy range are kept, since the player can run into them.
+	 */
+	UPROPERTY(Config, EditAnywhere, Category = "Representation System | Update Settings")
+	bool bViewRelevancy = true;
+
+	/**
+	 * Vehicles in view whose actor, or whose instanced static mesh component as a whole, was not rendered recently are considered occluded,
+	 * and are simulated at the reduced tier. Their LOD is kept, so that they are rendered as soon as they are no longer occluded.
+	 */
+	UPROPERTY(Config, EditAnywhere, Category = "Representation System | Update Settings", meta = (EditCondition = "bViewRelevancy"))
+	bool bUseRenderedVisibility = false;
+
 	// Maximum number of Entities that can be spawned.
 	UPROPERTY(Config, EditAnywhere, Category = "Representation System | Spawn Settings", meta = (TitleProperty = "Maximum number of Entities", ClampMin = 0, UIMin = 0))
 	int MaxInstances = 1000;
 	
-	// Amount of Entities updated in a single batch.
+	/**
+	 * Interval between two simulation steps, in seconds, or zero to tick the simulation once per frame.
+	 * Between steps, vehicles are interpolated every frame. 0.033 to 0.1 (30 to 10 Hz) keeps motion smooth at a fraction of the simulation cost.
+	 */
+	UPROPERTY(Config, EditAnywhere, Category = "Representation System | Update Settings", meta = (Units = "s", ClampMin = 0, UIMin = 0, ClampMax = 0.1, UIMax = 0.1))
+	float TickRate = 0.05f;
+
+	// Maximum number of queued Entities spawned in a single frame.
 	UPROPERTY(Config, EditAnywhere, Category = "Representation System | Update Settings", meta = (TitleProperty = "Entity Spawn & Update Batch Size", ClampMin = 1, UIMin = 1))
 	uint8 ProcessingBatchSize = 100;
 
+	// Time spent spawning queued actors and Entities in a single frame. The batch ends early once it is exceeded.
+	UPROPERTY(Config, EditAnywhere, Category = "Representation System | Spawn Settings", meta = (Units = "ms", ClampMin = 0, UIMin = 0))
+	float SpawnTimeBudget = 2.0f;
+
 	// The range in which Actors become relevant. Since Actors have physics simulations, they are more expensive to simulate.
 	UPROPERTY(Config, EditAnywhere, Category = "Representation System | Update Settings")
 	FFloatRange ActorRelevancyRange;
 
+	// Distance a vehicle must move past the bounds of the range of its LOD before it switches to another one, so that vehicles on a boundary do not switch back and forth.
+	UPROPERTY(Config, EditAnywhere, Category = "Representation System | Update Settings", meta = (Units = "cm", ClampMin = 0, UIMin = 0))
+	float LODHysteresis = 500.0f;
+
+	// Maximum number of Actors bound to vehicles or given physics, released or made kinematic, in a single update. Releases come first, then vehicles that are close, large and approaching are swapped first.
+	UPROPERTY(Config, EditAnywhere, Category = "Representation System | Update Settings", meta = (ClampMin = 1, UIMin = 1))
+	int32 MaxActorSwapsPerFrame = 4;
+
+	// Maximum number of Actors of each class. It should cover the number of vehicles expected within the actor and kinematic relevancy ranges.
+	UPROPERTY(Config, EditAnywhere, Category = "Representation System | Update Settings", meta = (ClampMin = 0, UIMin = 0))
+	int32 MaxActorsPerClass = 32;
+
+	// The range within which Actors follow the simulation without physics, between the actor and static mesh relevancy ranges.
+	UPROPERTY(Config, EditAnywhere, Category = "Representation System | Update Settings")
+	FFloatRange KinematicRelevancyRange;
+
 	// The range within which Static Mesh Instances replace Actors.
 	UPROPERTY(Config, EditAnywhere, Category = "Representation System | Update Settings")
 	FFloatRange StaticMeshRelevancyRange;
@@ -138,17 +337,232 @@ private:
 	
 private:
 
+	// Mirrors a swap of two vehicles in the simulation.
+	void OnVehiclesSwapped(const uint32 IndexA, const uint32 IndexB);
+
+	// Releases the actor and the static mesh instance of the last vehicle.
+	void OnVehicleRemoved(const uint32 Index);
+
+	// Stores the variant of a vehicle that becomes dormant.
+	void OnVehicleDormant(const uint32 Index, FTrDormantVehicle& DormantVehicle);
+
+	// Spawns the dormant vehicles of a region that has been loaded, with the variant, archetype and velocity they had.
+	void OnRegionLoaded(const int32 Region);
+
+	// Makes a request to spawn a vehicle on a start, with a variant picked at random from the spawn configuration.
+	FTrafficAISpawnRequest MakeSpawnRequest(const FTrVehiclePathTransform& StartData) const;
+
+	// Spawns a disabled actor into the pool of a class. Returns false if the pool is full, or the actor could not be spawned.
+	bool SpawnPooledActor(UClass* ActorClass);
+
+	/**
+	 * @brief Binds a free actor from the pool of the class of a vehicle to it. Actors are never spawned here, see ProcessSpawnRequests.
+	 * @return The actor, or null if the pool of the class has no free actor, because it is exhausted or still being filled.
+	 */
+	ATrVehicle* AcquireActor(const uint32 Index);
+
+	// Unbinds the actor of a vehicle, if any, and returns it disabled to its pool.
+	void ReleaseActor(const uint32 Index);
+
+	/**
+	 * @brief Switches a vehicle to a LOD, binding or releasing its actor, switching its physics and hiding its mesh instance as needed.
+	 * Vehicles that can not get an actor are switched to the static mesh LOD instead.
+	 */
+	void SetLOD(const uint32 Index, EVehicleLOD NewLOD, const FVector& Velocity);
+
+	// Adds a mesh instance for a vehicle, at the end of the instances of its mesh.
+	void ShowInstance(const uint32 Index);
+
+	// Removes the mesh instance of a vehicle, moving the last instance of its mesh into its place.
+	void HideInstance(const uint32 Index);
+
+	// Transform of a vehicle between the last two simulation steps.
+	FTransform GetInterpolatedTransform(const uint32 Index) const;
+
+	// Moves the actor of a vehicle, if it has one, to its interpolated transform.
+	void UpdateActorTransform(const uint32 Index);
+
+	// Gathers the players and the focuses that were added, dropping focuses whose actor has been destroyed.
+	void UpdateFocuses();
+
+	/**
+	 * @brief Returns the focus for which a location has the smallest distance divided by weight, among the focuses whose radius contains it.
+	 * @return The index of the focus in ActiveFocuses, or INDEX_NONE if no focus contains the location.
+	 */
+	int32 FindClosestFocus(const FVector& Location, float& OutDistance) const;
+
+	// Returns true if a location is in the view cone of a focus whose radius contains it. Cones are widened for vehicles that are already rendered.
+	bool IsInView(const FVector& Location, const bool bWasVisible) const;
+
+	// Returns false if the vehicle has an actor or an instance, and it was not rendered recently.
+	bool WasRecentlyRendered(const uint32 Index) const;
+
+	// Returns the LOD of a vehicle at a weighted distance from its closest focus. The range of its current LOD is widened by LODHysteresis.
+	EVehicleLOD GetDesiredLOD(const EVehicleLOD CurrentLOD, const float Distance) const;
+
+	/**
+	 * @brief Returns the priority of a vehicle for a LOD change that binds or releases its actor, or switches its physics.
+	 * It is the screen size of the vehicle, estimated from its bounds and its distance to a focus a moment ahead, scaled by the weight of the focus.
+	 */
+	float GetLODPriority(const uint32 Index, const FTrFocus& Focus, const FVector& Velocity) const;
+
+	// Point of view of the player, used to place ambient traffic.
+	struct FAmbientView
+	{
+		FVector FocusLocation;
+		FVector AheadDirection;
+		FVector ViewLocation;
+		FVector ViewDirection;
+		float CosHalfAngle;
+
+		// Returns true if a location is inside the view cone.
+		bool IsInView(const FVector& Location) const
+		{
+			const FVector ToLocation = Location - ViewLocation;
+			return ToLocation.Dot(ViewDirection) >= CosHalfAngle * ToLocation.Length();
+		}
+	};
+
+	/**
+	 * @brief Finds a free start for an ambient vehicle, on one of the lanes found around the player.
+	 * Unless bAnywhere is set, starts must be ahead of the player, outside of the view cone, and beyond the lower bound of the spawn range.
+	 */
+	bool FindAmbientStart(const FAmbientView& View, const bool bAnywhere, FTrVehiclePathTransform& OutStart);
+
+private:
+
+	// Actor bound to each vehicle, or null for vehicles outside of the actor and kinematic relevancy ranges.
 	UPROPERTY()
 	TArray<ATrVehicle*> Actors;
-	
-	TMap<UStaticMesh*, TArray<uint32>> MeshIDs;
+
+	// Class of the actor of each vehicle, picked when it is spawned.
+	UPROPERTY()
+	TArray<UClass*> ActorClasses;
+
+	// Actors of a class, spawned up to MaxActorsPerClass.
+	struct FActorPool
+	{
+		TArray<ATrVehicle*> FreeActors;
+		int32 NumSpawned = 0;
+	};
+
+	TMap<UClass*, FActorPool> ActorPools;
+
+	// PID controllers of the bound actors.
+	FTrVehicleControlBatch ControlBatch;
+
+	// Instances of a static mesh, and the vehicle they represent. Buffers are kept between updates to avoid allocations.
+	struct FMeshInstances
+	{
+		TArray<int32> Vehicles;
+		TArray<FTransform> Transforms;
+
+		// Whether the component of the mesh was rendered recently, read at the start of each update.
+		bool bWasRendered = true;
+
+		// Range of instances whose transform changed since the last upload.
+		int32 FirstDirty = MAX_int32;
+		int32 EndDirty = 0;
+
+		void MarkDirty(const int32 Instance)
+		{
+			FirstDirty = FMath::Min(FirstDirty, Instance);
+			EndDirty = FMath::Max(EndDirty, Instance + 1);
+		}
+	};
+
+	TMap<UStaticMesh*, FMeshInstances> MeshInstances;
+
+	/**
+	 * @brief Writes the interpolated transforms of the instances of a mesh that moved, in parallel chunks of instances.
+	 * Instances are sent to the renderer at the end of the update.
+	 */
+	void UpdateInstanceTransforms(FMeshInstances& Instances);
+
+	// First and end instance that moved in each chunk of the current mesh, kept between updates to avoid allocations.
+	TArray<TPair<int32, int32>> ChunkDirtyRanges;
+
+	// Mesh and instance index of each vehicle. Vehicles without the static mesh LOD have an instance index of INDEX_NONE.
+	TArray<TPair<UStaticMesh*, int32>> VehicleInstances;
+
 	TArray<EVehicleLOD> LODStates;
 
+	// Focuses added with SetFocus, and focuses of the current update including the players.
+	TMap<FName, FTrFocus> Focuses;
+	TArray<FTrFocus> ActiveFocuses;
+	TArray<FVector> FocusLocations;
+
+	// View cone of each active focus. Focuses that see in all directions have a cone of 360 degrees.
+	struct FFocusView
+	{
+		FVector Location;
+		FVector Direction;
+		float CosHalfAngle;
+		float CosHalfAngleWide;
+	};
+
+	TArray<FFocusView> FocusViews;
+
+	// Last pass in which each vehicle was found within the relevancy radius of a focus or left it, or was moved. Each update runs two passes.
+	TArray<uint32> LODFrames;
+	uint32 LODFrame = 0;
+
+	// Vehicles found by the last relevancy queries, and vehicles that were found or had a LOD at the end of the last update.
+	TArray<int32> LODCandidates;
+	TArray<int32> RelevantVehicles;
+
+	// Weighted distance to the closest focus, closest focus and desired LOD of each candidate, computed in parallel.
+	TArray<float> CandidateDistances;
+	TArray<int32> CandidateFocuses;
+	TArray<EVehicleLOD> CandidateLODs;
+	TArray<bool> CandidateVisibilities;
+
+	// A change of LOD that binds or releases an actor, or switches its physics, applied within the budget of MaxActorSwapsPerFrame.
+	struct FLODSwap
+	{
+		int32 Index;
+		EVehicleLOD LOD;
+		float Priority;
+	};
+
+	// Swaps requested by the current update. Swaps left out of the budget are requested again by the next update.
+	TArray<FLODSwap> PendingPromotions;
+	TArray<FLODSwap> PendingDemotions;
+
 	TSet<uint32> DetachedVehicles;
 	
 	FVector MeshPositionOffset;
+
+	// Transforms of the last simulation step, and of the step before, including the mesh offset.
 	TArray<FTransform> VehicleTransforms;
+	TArray<FTransform> PreviousTransforms;
 
+	// Interpolation factor between PreviousTransforms and VehicleTransforms of the current update.
+	float InterpolationAlpha = 1.0f;
+
+	// Queued requests, processed in order by ProcessSpawnRequests. The queue is emptied once all of them have been processed.
+	// Meshes and classes of the requests are referenced until then.
+	UPROPERTY()
 	TArray<FTrafficAISpawnRequest> SpawnRequests;
+	int32 NumProcessedSpawnRequests = 0;
+
+	// Classes whose pools are filled by ProcessSpawnRequests, before the queued vehicles are spawned.
+	UPROPERTY()
+	TArray<UClass*> PendingActorClasses;
+
 	TArray<FTrVehiclePathTransform> VehicleStarts;
+
+	UPROPERTY()
+	TObjectPtr<const UTrSpawnConfiguration> SpawnConfiguration;
+
+#pragma region Ambient Traffic
+
+	// The first update of ambient traffic fills the spawn range at once, before anything is rendered.
+	bool bIsAmbientTrafficPopulated = false;
+
+	// Edges around the player, and starts generated on one of them. Kept between updates to avoid allocations.
+	TArray<uint32> AmbientEdges;
+	TArray<FTrVehiclePathTransform> AmbientStarts;
+
+#pragma endregion
 };
@@ -4,6 +4,7 @@
 
 #include "CoreMinimal.h"
 #include "Engine/DataAsset.h"
+#include "Engine/EngineTypes.h"
 #include "TrSimulationData.generated.h"
 
 /**
@@ -66,6 +67,22 @@ struct TRAFFICAI_API FTrVehicleDynamics
 #pragma endregion
 };
 
+/**
+ * A class of vehicles sharing the same dynamics, such as cars, buses or trucks.
+ * Vehicle definitions of the spawn configuration refer to an archetype by name.
+ */
+USTRUCT(BlueprintType)
+struct TRAFFICAI_API FTrVehicleArchetype
+{
+	GENERATED_BODY()
+
+	UPROPERTY(EditAnywhere)
+	FName Name;
+
+	UPROPERTY(EditAnywhere)
+	FTrVehicleDynamics Dynamics;
+};
+
 // This struct represents the configuration parameters for path following.
 USTRUCT(BlueprintType)
 struct TRAFFICAI_API FTrPathFollowingConfiguration
@@ -87,6 +104,10 @@ struct TRAFFICAI_API FTrPathFollowingConfiguration
 	UPROPERTY(EditAnywhere, meta = (Units = "cm"))
 	float PathFollowOffset = 250.0f; 
 
+	// Distance between the center lines of two neighbouring lanes, on edges with more than one lane.
+	UPROPERTY(EditAnywhere, meta = (Units = "cm", UIMin = 0.0, ClampMin = 0.0))
+	float LaneWidth = 350.0f;
+
 	/**
 	 * The LookAheadDistance is a float variable that stores the distance that an entity should look ahead when following a path.
 	 * It is used in the TrSimulationSystem class for calculating the future position of an entity and determining its goal on the path.
@@ -101,11 +122,183 @@ struct TRAFFICAI_API FTrPathFollowingConfiguration
 	UPROPERTY(EditAnywhere, meta = (Units = "cm"))
 	float GoalUpdateDistance = 500.0f;
 	
-	// This variable determines the time interval after which all traffic signals should switch.
+	// This variable determines the time interval after which all traffic signals should switch, when signals use fixed timing.
 	UPROPERTY(EditAnywhere, meta = (Units = "s"))
 	float SignalSwitchInterval = 10.0f;
 };
 
+/**
+ * This struct defines the configuration options for lane changes on edges with more than one lane.
+ * Lane changes are decided with MOBIL (Minimizing Overall Braking Induced by Lane changes),
+ * which weighs the acceleration a vehicle gains against the deceleration it imposes on its new and old followers.
+ */
+USTRUCT(BlueprintType)
+struct TRAFFICAI_API FTrLaneChangeConfiguration
+{
+	GENERATED_BODY()
+
+	// When disabled, vehicles stay on the lane they entered an edge on.
+	UPROPERTY(EditAnywhere)
+	bool bEnableLaneChanges = true;
+
+	// Weight of the accelerations of other vehicles. 0 is selfish, 1 is as considerate to others as to oneself.
+	UPROPERTY(EditAnywhere, meta = (UIMin = 0.0, ClampMin = 0.0, UIMax = 1.0, EditCondition = "bEnableLaneChanges"))
+	float Politeness = 0.3f;
+
+	// Minimum gain of acceleration required to change lane, which prevents vehicles from switching back and forth.
+	UPROPERTY(EditAnywhere, meta = (ForceUnits = "cm/s2", UIMin = 0.0, ClampMin = 0.0, EditCondition = "bEnableLaneChanges"))
+	float SwitchingThreshold = 20.0f;
+
+	// A lane change is refused if the new follower would have to brake harder than this.
+	UPROPERTY(EditAnywhere, meta = (ForceUnits = "cm/s2", UIMin = 0.0, ClampMin = 0.0, EditCondition = "bEnableLaneChanges"))
+	float SafeDeceleration = 400.0f;
+
+	// Gain added to changes towards the outer lanes, and removed from changes towards the inner lanes, so that inner lanes are used to overtake.
+	UPROPERTY(EditAnywhere, meta = (ForceUnits = "cm/s2", UIMin = 0.0, ClampMin = 0.0, EditCondition = "bEnableLaneChanges"))
+	float KeepOuterBias = 10.0f;
+
+	// Minimum time between two lane changes of a vehicle.
+	UPROPERTY(EditAnywhere, meta = (Units = "s", UIMin = 0.0, ClampMin = 0.0, EditCondition = "bEnableLaneChanges"))
+	float Cooldown = 3.0f;
+};
+
+// Determines how traffic signals allocate green time to the approaches of an intersection.
+UENUM()
+enum class ETrSignalControlMode : uint8
+{
+	// Every approach receives a green phase of SignalSwitchInterval, in a fixed cyclic order.
+	FixedTime,
+
+	// Green phases are extended, shortened or skipped based on the queues measured by approach detectors.
+	Actuated
+};
+
+/**
+ * This struct defines the configuration options for demand-actuated traffic signals.
+ * Each node of an intersection acts as an approach, and owns a detector that counts
+ * the vehicles heading towards it within DetectorRange.
+ */
+USTRUCT(BlueprintType)
+struct TRAFFICAI_API FTrIntersectionConfiguration
+{
+	GENERATED_BODY()
+
+	// Signal control strategy used by all intersections.
+	UPROPERTY(EditAnywhere)
+	ETrSignalControlMode ControlMode = ETrSignalControlMode::FixedTime;
+
+	// Maximum distance from an approach node at which a vehicle is counted in the approach's queue.
+	UPROPERTY(EditAnywhere, meta = (Units = "cm", EditCondition = "ControlMode == ETrSignalControlMode::Actuated"))
+	float DetectorRange = 3000.0f;
+
+	// A green phase is never terminated before this duration has passed.
+	UPROPERTY(EditAnywhere, meta = (Units = "s", EditCondition = "ControlMode == ETrSignalControlMode::Actuated"))
+	float MinimumGreenTime = 5.0f;
+
+	// A green phase is always terminated after this duration, if another approach has demand.
+	UPROPERTY(EditAnywhere, meta = (Units = "s", EditCondition = "ControlMode == ETrSignalControlMode::Actuated"))
+	float MaximumGreenTime = 30.0f;
+
+	/**
+	 * A green phase is terminated early (gap-out) when its detector has been empty for this duration
+	 * while another approach is waiting.
+	 */
+	UPROPERTY(EditAnywhere, meta = (Units = "s", EditCondition = "ControlMode == ETrSignalControlMode::Actuated"))
+	float GapOutTime = 2.0f;
+
+	// Duration of the amber phase that separates two green phases.
+	UPROPERTY(EditAnywhere, meta = (Units = "s", EditCondition = "ControlMode == ETrSignalControlMode::Actuated"))
+	float AmberTime = 3.0f;
+};
+
+/**
+ * This struct defines the configuration options for destination-based routing.
+ * Every vehicle is assigned a random destination node, and follows the shortest route to it.
+ * Routes are computed with A* on worker threads, in batches, and cached.
+ */
+USTRUCT(BlueprintType)
+struct TRAFFICAI_API FTrRoutingConfiguration
+{
+	GENERATED_BODY()
+
+	// When disabled, vehicles pick a random turn at every node.
+	UPROPERTY(EditAnywhere)
+	bool bEnableRouting = true;
+
+	// Maximum number of route requests dispatched to worker threads at once.
+	UPROPERTY(EditAnywhere, meta = (UIMin = 1, ClampMin = 1, EditCondition = "bEnableRouting"))
+	int32 BatchSize = 256;
+
+	// Maximum number of routes kept in the cache, the least recently used routes are evicted first.
+	UPROPERTY(EditAnywhere, meta = (UIMin = 0, ClampMin = 0, EditCondition = "bEnableRouting"))
+	int32 CacheSize = 4096;
+
+	// A search is abandoned after expanding this many edges, and the vehicle is given another destination.
+	UPROPERTY(EditAnywhere, meta = (UIMin = 1, ClampMin = 1, EditCondition = "bEnableRouting"))
+	int32 MaxExpandedEdges = 100000;
+};
+
+/**
+ * This struct defines how the road network is split into regions that are streamed in and out around the players.
+ * Vehicles of unloaded regions are stored as dormant records, and cost neither memory in the simulation arrays nor CPU time.
+ */
+USTRUCT(BlueprintType)
+struct TRAFFICAI_API FTrRegionConfiguration
+{
+	GENERATED_BODY()
+
+	// When disabled, the whole network is simulated.
+	UPROPERTY(EditAnywhere)
+	bool bEnableRegions = false;
+
+	// Size of a region. Match the cell size of the World Partition runtime grid, so that regions stream with the level.
+	UPROPERTY(EditAnywhere, meta = (Units = "cm", UIMin = 100.0, ClampMin = 100.0, EditCondition = "bEnableRegions"))
+	float CellSize = 25600.0f;
+
+	// Regions closer than this distance to a player or a streaming source are loaded. Match the loading range of the World Partition runtime grid.
+	// The range is extended to the relevancy radius of the representation, so that vehicles in view never go dormant.
+	UPROPERTY(EditAnywhere, meta = (Units = "cm", UIMin = 0.0, ClampMin = 0.0, EditCondition = "bEnableRegions"))
+	float LoadingRange = 25600.0f;
+
+	// Time between two updates of the loaded regions.
+	UPROPERTY(EditAnywhere, meta = (Units = "s", UIMin = 0.0, ClampMin = 0.0, EditCondition = "bEnableRegions"))
+	float StreamingInterval = 0.5f;
+};
+
+/**
+ * This struct defines how vehicles are placed on the road surface.
+ * Heights and normals of the roads are sampled once along every edge, then looked up by the simulation instead of tracing per vehicle.
+ */
+USTRUCT(BlueprintType)
+struct TRAFFICAI_API FTrGroundingConfiguration
+{
+	GENERATED_BODY()
+
+	// When disabled, vehicles keep the height they were spawned at, and are never pitched or rolled.
+	UPROPERTY(EditAnywhere)
+	bool bEnableGrounding = false;
+
+	// Distance between two rows of samples along an edge.
+	UPROPERTY(EditAnywhere, meta = (Units = "cm", UIMin = 10.0, ClampMin = 10.0, EditCondition = "bEnableGrounding"))
+	float SampleSpacing = 200.0f;
+
+	// Width of the road sampled around the center line of an edge. It must cover the lanes of both directions.
+	UPROPERTY(EditAnywhere, meta = (Units = "cm", UIMin = 10.0, ClampMin = 10.0, EditCondition = "bEnableGrounding"))
+	float Width = 1000.0f;
+
+	// Number of samples across the width of an edge.
+	UPROPERTY(EditAnywhere, meta = (UIMin = 2, ClampMin = 2, EditCondition = "bEnableGrounding"))
+	int32 NumLateralSamples = 3;
+
+	// Samples are traced from this distance above the center line of an edge, to the same distance below it.
+	UPROPERTY(EditAnywhere, meta = (Units = "cm", UIMin = 0.0, ClampMin = 0.0, EditCondition = "bEnableGrounding"))
+	float TraceHeight = 500.0f;
+
+	// Collision channel the road surface blocks.
+	UPROPERTY(EditAnywhere, meta = (EditCondition = "bEnableGrounding"))
+	TEnumAsByte<ECollisionChannel> TraceChannel = ECC_WorldStatic;
+};
+
 /**
  * This struct defines the configuration options for the Implicit Grid system.
  */
@@ -125,6 +318,13 @@ struct TRAFFICAI_API FTrImplicitGridConfiguration
 	 */
 	UPROPERTY(EditAnywhere, meta = (UIMin = 1, ClampMin = 1))
 	uint32 Resolution = 20;
+
+	/**
+	 * Size of the cells of the spatial hash of vehicles, used for queries over large radii such as the relevancy of LODs.
+	 * @remark It should be close to the smallest radius queried, so that queries visit few cells with few vehicles outside of the radius.
+	 */
+	UPROPERTY(EditAnywhere, meta = (Units = "cm", UIMin = 100, ClampMin = 100))
+	float HashCellSize = 5000.0f;
 };
 
 // Represents the configuration for a traffic simulation.
@@ -139,10 +339,34 @@ public:
 	UPROPERTY(EditAnywhere, Category = "Vehicle")
 	FTrVehicleDynamics VehicleConfig;
 
+	// Dynamics of other classes of vehicles. Vehicles that do not refer to one of these archetypes use VehicleConfig.
+	UPROPERTY(EditAnywhere, Category = "Vehicle", meta = (TitleProperty = "Name"))
+	TArray<FTrVehicleArchetype> Archetypes;
+
 	// Represents the configuration settings for path following behavior.
 	UPROPERTY(EditAnywhere, Category = "Path Follow")
 	FTrPathFollowingConfiguration PathFollowingConfig;
 
+	// The configuration parameters for lane changes.
+	UPROPERTY(EditAnywhere, Category = "Path Follow")
+	FTrLaneChangeConfiguration LaneChangeConfig;
+
+	// The configuration parameters for traffic signals.
+	UPROPERTY(EditAnywhere, Category = "Intersections")
+	FTrIntersectionConfiguration IntersectionConfig;
+
+	// The configuration parameters for route planning.
+	UPROPERTY(EditAnywhere, Category = "Routing")
+	FTrRoutingConfiguration RoutingConfig;
+
+	// The configuration parameters for the streaming of traffic regions.
+	UPROPERTY(EditAnywhere, Category = "Regions")
+	FTrRegionConfiguration RegionConfig;
+
+	// The configuration parameters for the placement of vehicles on the road surface.
+	UPROPERTY(EditAnywhere, Category = "Grounding")
+	FTrGroundingConfiguration GroundingConfig;
+
 	// The configuration parameters for the spatial acceleration grid.
 	UPROPERTY(EditAnywhere, Category = "Spatial Acceleration Grid")
 	FTrImplicitGridConfiguration GridConfiguration;
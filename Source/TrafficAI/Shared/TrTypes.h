@@ -4,8 +4,19 @@
 
 #include "CoreMinimal.h"
 #include "UObject/ObjectSaveContext.h"
+#include "Async/ParallelFor.h"
 #include "TrTypes.generated.h"
 
+TRAFFICAI_API DECLARE_LOG_CATEGORY_EXTERN(LogTrafficAI, Log, All);
+
+constexpr int32 MIN_PARALLEL_ITEMS = 512; // Below this number of vehicles or instances, passes run on a single thread since scheduling would cost more than it saves.
+
+// Flags of a ParallelFor over Num vehicles or instances, shared by the simulation and the representation.
+inline EParallelForFlags GetParallelForFlags(const int32 Num)
+{
+	return Num < MIN_PARALLEL_ITEMS ? EParallelForFlags::ForceSingleThread : EParallelForFlags::None;
+}
+
 /**
  * A traffic vehicle is represented by a static mesh and an actor class.
  * The ratio property determines the probability of generating this vehicle in relation to other vehicles.
@@ -23,6 +34,10 @@ struct TRAFFICAI_API FTrVehicleDefinition
 	
 	UPROPERTY(EditAnywhere, meta = (UIMin = 0.0, UIMax = 1.0, ClampMin = 0.0, ClampMax = 1.0))
 	float Ratio = 1.0f;
+
+	// Name of the archetype of the simulation configuration that drives this vehicle. The default dynamics are used when empty.
+	UPROPERTY(EditAnywhere)
+	FName Archetype;
 };
 
 /**
@@ -54,6 +69,22 @@ public:
 	// Traffic Archetypes defined by their LODs
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Spawn Configuration")
 	TArray<FTrVehicleDefinition> VehicleVariants;
+
+	// Keep a constant number of vehicles around the player instead of populating the whole network, so that cost does not depend on the size of the map.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Ambient Traffic")
+	bool bAmbientTraffic = false;
+
+	// Number of vehicles kept around the player. It is limited by the maximum number of instances of the representation system.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Ambient Traffic", meta = (EditCondition = "bAmbientTraffic", ClampMin = 0, UIMin = 0))
+	int32 AmbientVehicleCount = 150;
+
+	// Vehicles are spawned ahead of the player within this range, and recycled once they are further than its upper bound.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Ambient Traffic", meta = (EditCondition = "bAmbientTraffic", Units = "cm"))
+	FFloatRange AmbientSpawnRange = FFloatRange(8000, 20000);
+
+	// Maximum number of vehicles spawned or recycled in a single frame.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Ambient Traffic", meta = (EditCondition = "bAmbientTraffic", ClampMin = 1, UIMin = 1))
+	int32 AmbientUpdatesPerFrame = 8;
 	
 private:
 	
@@ -111,4 +142,27 @@ struct TRAFFICAI_API FTrVehiclePathTransform
 {
 	FTransform Transform;
 	FTrPath Path;
+};
+
+/**
+ * A stable reference to a simulated vehicle.
+ *
+ * Vehicles are stored densely and move around when others are removed, so their index must not be kept across frames.
+ * A handle refers to a slot that keeps track of the dense index of its vehicle. The generation of a slot is incremented
+ * when its vehicle is removed, so that handles to removed vehicles are detected even after the slot has been reused.
+ */
+USTRUCT(BlueprintType)
+struct TRAFFICAI_API FTrVehicleHandle
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	int32 Slot = INDEX_NONE;
+
+	UPROPERTY()
+	uint32 Generation = 0;
+
+	bool IsSet() const { return Slot != INDEX_NONE; }
+
+	bool operator==(const FTrVehicleHandle& Other) const { return Slot == Other.Slot && Generation == Other.Generation; }
 };
\ No newline at end of file
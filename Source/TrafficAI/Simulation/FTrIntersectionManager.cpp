@@ -1,44 +1,177 @@
 ﻿#include "FTrIntersectionManager.h"
 
-void FTrIntersectionManager::Initialize(const TArray<FTrIntersection>& NewIntersections)
+void FTrIntersectionManager::Initialize(const TArray<FTrIntersection>& NewIntersections, const uint32 NumNodes, const FTrIntersectionConfiguration& NewConfiguration)
 {
 	Intersections = NewIntersections;
-	PreviouslyUnblockedNodes.Init(0, Intersections.Num());
-	for(const FTrIntersection& Intersection : NewIntersections)
+	Configuration = NewConfiguration;
+	ElapsedTime = 0.0f;
+
+	SignalStates.Init(FTrSignalState(), Intersections.Num());
+	NodeApproaches.Init(INDEX_NONE, NumNodes);
+	ApproachOffsets.Reset(Intersections.Num());
+	ApproachIntersections.Reset();
+	for(int IntersectionIndex = 0; IntersectionIndex < Intersections.Num(); ++IntersectionIndex)
 	{
-		for(const uint32 Node : Intersection.Nodes)
+		ApproachOffsets.Push(ApproachIntersections.Num());
+		for(const uint32 Node : Intersections[IntersectionIndex].Nodes)
 		{
-			IntersectionNodes.Add(Node);
+			check(NodeApproaches.IsValidIndex(Node));
+			NodeApproaches[Node] = ApproachIntersections.Num();
+			ApproachIntersections.Push(IntersectionIndex);
 		}
+
+		// Start with the last approach so that the first green goes to the first node, like fixed timing.
+		SignalStates[IntersectionIndex].GreenApproach = FMath::Max(0, Intersections[IntersectionIndex].Nodes.Num() - 1);
 	}
-		
+	ApproachQueues.Init(0, ApproachIntersections.Num());
+
 	SwitchToGreen();
 }
 
 bool FTrIntersectionManager::IsNodeBlocked(const uint32 NodeIndex) const
 {
-	if(IntersectionNodes.Contains(NodeIndex))
+	if(!IsIntersectionNode(NodeIndex))
 	{
-		return !UnblockedNodes.Contains(NodeIndex);
+		return false;
 	}
 
-	return false;
+	const int32 Approach = NodeApproaches[NodeIndex];
+	const int32 IntersectionIndex = ApproachIntersections[Approach];
+	const FTrSignalState& State = SignalStates[IntersectionIndex];
+	return State.bIsAmber || State.GreenApproach != Approach - ApproachOffsets[IntersectionIndex];
 }
 
 void FTrIntersectionManager::SwitchToGreen()
 {
-	UnblockedNodes.Empty();
 	for(int Index = 0; Index < Intersections.Num(); ++Index)
 	{
-		const FTrIntersection& Intersection = Intersections[Index];
-		uint32 PreviousNode = PreviouslyUnblockedNodes[Index];
-		uint32 NextNode = (PreviousNode + 1) % Intersection.Nodes.Num();
-		PreviouslyUnblockedNodes[Index] = NextNode;
-		UnblockedNodes.Add(Intersection.Nodes[NextNode]);
+		const int32 NumApproaches = Intersections[Index].Nodes.Num();
+		if(NumApproaches > 0)
+		{
+			StartGreen(Index, (SignalStates[Index].GreenApproach + 1) % NumApproaches);
+		}
 	}
 }
 
 void FTrIntersectionManager::SwitchToAmber()
 {
-	UnblockedNodes.Empty();
+	for(FTrSignalState& State : SignalStates)
+	{
+		State.bIsAmber = true;
+		State.PhaseTime = 0.0f;
+	}
+}
+
+void FTrIntersectionManager::ResetDetectors()
+{
+	FMemory::Memzero(ApproachQueues.GetData(), ApproachQueues.Num() * ApproachQueues.GetTypeSize());
+}
+
+void FTrIntersectionManager::DetectVehicle(const uint32 NodeIndex)
+{
+	if(IsIntersectionNode(NodeIndex))
+	{
+		++ApproachQueues[NodeApproaches[NodeIndex]];
+	}
+}
+
+void FTrIntersectionManager::OnVehicleServed(const uint32 NodeIndex)
+{
+	if(IsIntersectionNode(NodeIndex))
+	{
+		++SignalStates[ApproachIntersections[NodeApproaches[NodeIndex]]].NumServedVehicles;
+	}
+}
+
+void FTrIntersectionManager::Tick(const float DeltaSeconds)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(FTrIntersectionManager::Tick)
+
+	ElapsedTime += DeltaSeconds;
+	if(Configuration.ControlMode != ETrSignalControlMode::Actuated)
+	{
+		return;
+	}
+
+	for(int Index = 0; Index < Intersections.Num(); ++Index)
+	{
+		if(Intersections[Index].Nodes.Num() == 0)
+		{
+			continue;
+		}
+		
+		FTrSignalState& State = SignalStates[Index];
+		State.PhaseTime += DeltaSeconds;
+
+		if(State.bIsAmber)
+		{
+			if(State.PhaseTime >= Configuration.AmberTime)
+			{
+				// Serve the next waiting approach, or the next one in order if the intersection is empty.
+				const int32 NextApproach = FindNextDemandedApproach(Index);
+				StartGreen(Index, NextApproach != INDEX_NONE ? NextApproach : (State.GreenApproach + 1) % Intersections[Index].Nodes.Num());
+			}
+			continue;
+		}
+
+		const bool bIsGreenOccupied = ApproachQueues[ApproachOffsets[Index] + State.GreenApproach] > 0;
+		State.GapTime = bIsGreenOccupied ? 0.0f : State.GapTime + DeltaSeconds;
+
+		// Rest in green while no other approach is waiting.
+		if(State.PhaseTime < Configuration.MinimumGreenTime || FindNextDemandedApproach(Index) == INDEX_NONE)
+		{
+			continue;
+		}
+
+		const bool bGapOut = State.GapTime >= Configuration.GapOutTime;
+		const bool bMaxOut = State.PhaseTime >= Configuration.MaximumGreenTime;
+		if(bGapOut || bMaxOut)
+		{
+			State.bIsAmber = true;
+			State.PhaseTime = 0.0f;
+		}
+	}
+}
+
+float FTrIntersectionManager::GetThroughput(const int32 IntersectionIndex) const
+{
+	const float ElapsedMinutes = ElapsedTime / 60.0f;
+	return ElapsedMinutes > 0.0f ? SignalStates[IntersectionIndex].NumServedVehicles / ElapsedMinutes : 0.0f;
+}
+
+uint32 FTrIntersectionManager::GetQueueLength(const int32 IntersectionIndex) const
+{
+	uint32 QueueLength = 0;
+	const int32 Offset = ApproachOffsets[IntersectionIndex];
+	for(int Approach = 0; Approach < Intersections[IntersectionIndex].Nodes.Num(); ++Approach)
+	{
+		QueueLength += ApproachQueues[Offset + Approach];
+	}
+	return QueueLength;
+}
+
+void FTrIntersectionManager::StartGreen(const int32 IntersectionIndex, const int32 ApproachIndex)
+{
+	FTrSignalState& State = SignalStates[IntersectionIndex];
+	State.GreenApproach = ApproachIndex;
+	State.bIsAmber = false;
+	State.PhaseTime = 0.0f;
+	State.GapTime = 0.0f;
+}
+
+int32 FTrIntersectionManager::FindNextDemandedApproach(const int32 IntersectionIndex) const
+{
+	const FTrSignalState& State = SignalStates[IntersectionIndex];
+	const int32 NumApproaches = Intersections[IntersectionIndex].Nodes.Num();
+	const int32 Offset = ApproachOffsets[IntersectionIndex];
+	for(int Step = 1; Step < NumApproaches; ++Step)
+	{
+		const int32 Approach = (State.GreenApproach + Step) % NumApproaches;
+		if(ApproachQueues[Offset + Approach] > 0)
+		{
+			return Approach;
+		}
+	}
+
+	return INDEX_NONE;
 }
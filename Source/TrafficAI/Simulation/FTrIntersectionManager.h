@@ -1,4 +1,5 @@
 ﻿#pragma once
+#include "TrSimulationData.h"
 #include "TrafficAI/Utility/TrSpatialGraphComponent.h"
 
 
@@ -7,13 +8,22 @@
 class FTrIntersectionManager
 {
 public:
-	
-	// Initializes the FTrIntersectionManager with new intersections.
-	void Initialize(const TArray<FTrIntersection>& NewIntersections);
+
+	/**
+	 * @brief Initializes the FTrIntersectionManager with new intersections.
+	 *
+	 * @param NewIntersections Intersections of the spatial graph. Each node of an intersection is treated as an approach.
+	 * @param NumNodes Number of nodes in the spatial graph, used to build a node to approach lookup table.
+	 * @param NewConfiguration Signal control settings.
+	 */
+	void Initialize(const TArray<FTrIntersection>& NewIntersections, const uint32 NumNodes, const FTrIntersectionConfiguration& NewConfiguration);
 
 	// This method checks if the specified node is blocked or not.
 	bool IsNodeBlocked(const uint32 NodeIndex) const;
 
+	// Returns true if the node is an approach of any intersection.
+	bool IsIntersectionNode(const uint32 NodeIndex) const { return NodeApproaches.IsValidIndex(NodeIndex) && NodeApproaches[NodeIndex] != INDEX_NONE; }
+
 	/**
 	 * @brief Switches the traffic signal to the green state, allowing traffic to move through the intersections.
 	 *
@@ -26,8 +36,75 @@ public:
 	// This method is responsible for switching the traffic light at an intersection to amber, indicating that the signals are about to change.
 	void SwitchToAmber();
 
+#pragma region Detectors
+
+	// Clears the queues of all approach detectors. Must be called before vehicles are detected for a new simulation step.
+	void ResetDetectors();
+
+	// Registers a vehicle heading towards NodeIndex. Nodes that are not an intersection approach are ignored.
+	void DetectVehicle(const uint32 NodeIndex);
+
+	// Registers a vehicle that has been released into the intersection through NodeIndex.
+	void OnVehicleServed(const uint32 NodeIndex);
+
+#pragma endregion
+
+	/**
+	 * @brief Advances the signal controllers of all intersections.
+	 *
+	 * In actuated mode, a green phase is held for at least MinimumGreenTime.
+	 * After that, it is terminated when its queue has been empty for GapOutTime (gap-out) or when it reaches MaximumGreenTime (max-out),
+	 * provided that another approach is waiting. The next green phase is given to the next approach in cyclic order that has demand,
+	 * so empty approaches are skipped. When no other approach has demand, the current green is extended.
+	 *
+	 * Fixed timing is driven by SwitchToGreen and SwitchToAmber, in that case this method only accumulates the time used by throughput metrics.
+	 */
+	void Tick(const float DeltaSeconds);
+
+#pragma region Metrics
+
+	int32 GetNumIntersections() const { return Intersections.Num(); }
+
+	// Returns the number of vehicles released by an intersection per minute, since the signals were initialized.
+	float GetThroughput(const int32 IntersectionIndex) const;
+
+	// Returns the total number of vehicles released by an intersection, since the signals were initialized.
+	uint32 GetNumServedVehicles(const int32 IntersectionIndex) const { return SignalStates[IntersectionIndex].NumServedVehicles; }
+
+	// Returns the number of vehicles currently waiting at an intersection.
+	uint32 GetQueueLength(const int32 IntersectionIndex) const;
+
+#pragma endregion
+
+private:
+
+	// Switches the intersection to the green phase of ApproachIndex.
+	void StartGreen(const int32 IntersectionIndex, const int32 ApproachIndex);
+
+	// Returns the next approach after the current green one that has a vehicle waiting, or INDEX_NONE if there is no demand.
+	int32 FindNextDemandedApproach(const int32 IntersectionIndex) const;
+
 private:
-	
+
+	// Runtime state of the signal controller of a single intersection.
+	struct FTrSignalState
+	{
+		// Index of the approach (in FTrIntersection::Nodes) that currently has, or last had the right of way.
+		int32 GreenApproach = 0;
+
+		// True while the signals of the intersection are amber, in which case all approaches are blocked.
+		bool bIsAmber = false;
+
+		// Time spent in the current phase.
+		float PhaseTime = 0.0f;
+
+		// Time since a vehicle was last detected on the green approach.
+		float GapTime = 0.0f;
+
+		// Number of vehicles released by the intersection.
+		uint32 NumServedVehicles = 0;
+	};
+
 	/**
 	 * This array stores the intersections that are managed by the FTrIntersectionManager class.
 	 * Each intersection represents a set of nodes in a spatial graph.
@@ -35,25 +112,29 @@ private:
 	 * for each intersection when switching the traffic signal to the green state.
 	 */
 	TArray<FTrIntersection> Intersections;
-	
+
+	// Signal controller state for each intersection.
+	TArray<FTrSignalState> SignalStates;
+
 	/**
-	 * This array stores the indices of nodes that make up the intersections in the simulation.
-	 * Each element represents a node index in the spatial graph that belongs to an intersection.
+	 * This array maps each node of the spatial graph to a flattened approach index, or INDEX_NONE if the node is not part of an intersection.
+	 * The approach of an intersection is found at ApproachOffsets[Intersection] + the index of the node in FTrIntersection::Nodes.
 	 *
 	 * This is mainly used to speed-up lookups.
 	 */
-	TArray<uint32> IntersectionNodes;
-	
-	/**
-	 * @brief Array of previously unblocked nodes.
-	 *
-	 * This array stores the indices of the previously unblocked nodes from each intersection.
-	 * It is used by the FTrIntersectionManager class to determine the next node in the intersection for each intersection
-	 * when switching the traffic signal to the green state.
-	 */
-	TArray<uint32> PreviouslyUnblockedNodes;
+	TArray<int32> NodeApproaches;
+
+	// Intersection that owns each flattened approach.
+	TArray<int32> ApproachIntersections;
+
+	// Index of the first approach of each intersection in the flattened approach arrays.
+	TArray<int32> ApproachOffsets;
+
+	// Number of vehicles detected on each flattened approach during the last simulation step.
+	TArray<uint32> ApproachQueues;
+
+	FTrIntersectionConfiguration Configuration;
 
-	// Set of Nodes on the Spatial Graph that are allowed to release traffic.
-	TSet<uint32> UnblockedNodes;
-	
+	// Time elapsed since the intersections were initialized.
+	float ElapsedTime = 0.0f;
 };
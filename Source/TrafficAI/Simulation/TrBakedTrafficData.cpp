@@ -0,0 +1,289 @@
+﻿// Copyright Anupam Sahu. All Rights Reserved.
+
+#include "TrBakedTrafficData.h"
+#include "Async/MappedFileHandle.h"
+#include "HAL/PlatformFileManager.h"
+#include "Misc/FileHelper.h"
+
+namespace TrBakedTrafficData
+{
+	enum class ESection : uint32
+	{
+		NodeLocations,
+		NodeEdgeOffsets,
+		EdgeStartNodes,
+		EdgeEndNodes,
+		EdgeLengths,
+		EdgeDirections,
+		LaneStarts,
+		LaneEnds,
+		LaneOutwards,
+		EdgeLaneCounts,
+		TurnOffsets,
+		TurnEdges,
+		IntersectionOffsets,
+		IntersectionNodes,
+		VehicleStarts,
+		HeightFieldOffsets,
+		HeightFieldHeights,
+		HeightFieldNormals,
+		Num
+	};
+
+	// Location of a flat array in the file, relative to the start of the file.
+	struct FSectionEntry
+	{
+		uint64 Offset;
+		uint64 Count;
+		uint32 ElementSize;
+		uint32 Padding;
+	};
+
+	struct FFileHeader
+	{
+		uint32 Magic;
+		uint32 Version;
+		uint32 NumSections;
+		uint32 SourceHash;
+		float LaneOffset;
+		float HeightFieldSpacing;
+		float HeightFieldWidth;
+		int32 HeightFieldColumns;
+		uint32 HeightFieldChecksum;
+		FSectionEntry Sections[static_cast<uint32>(ESection::Num)];
+	};
+
+	// Vehicle starts only store node indices, path end points are recovered from the network.
+	struct FVehicleStart
+	{
+		FVector Location;
+		FQuat Rotation;
+		uint32 StartNodeIndex;
+		uint32 EndNodeIndex;
+	};
+
+	// Sections are aligned so that they can be read in place from a mapped file.
+	constexpr int32 SECTION_ALIGNMENT = 16;
+
+	template<typename ElementType>
+	void WriteSection(TArray<uint8>& Buffer, FFileHeader& Header, const ESection Section, const TArray<ElementType>& Elements)
+	{
+		const int32 Offset = Align(Buffer.Num(), SECTION_ALIGNMENT);
+		const int32 NumBytes = Elements.Num() * sizeof(ElementType);
+		Buffer.SetNumZeroed(Offset + NumBytes);
+		FMemory::Memcpy(Buffer.GetData() + Offset, Elements.GetData(), NumBytes);
+
+		FSectionEntry& Entry = Header.Sections[static_cast<uint32>(Section)];
+		Entry.Offset = Offset;
+		Entry.Count = Elements.Num();
+		Entry.ElementSize = sizeof(ElementType);
+	}
+
+	template<typename ElementType>
+	bool ReadSection(const uint8* Data, const int64 Size, const FFileHeader& Header, const ESection Section, TArray<ElementType>& OutElements)
+	{
+		const FSectionEntry& Entry = Header.Sections[static_cast<uint32>(Section)];
+		if(Entry.ElementSize != sizeof(ElementType) || Entry.Count > MAX_int32 || Entry.Offset + Entry.Count * sizeof(ElementType) > static_cast<uint64>(Size))
+		{
+			return false;
+		}
+
+		OutElements.SetNumUninitialized(Entry.Count);
+		FMemory::Memcpy(OutElements.GetData(), Data + Entry.Offset, Entry.Count * sizeof(ElementType));
+		return true;
+	}
+}
+
+bool FTrBakedTrafficData::Save
+(
+	const FString& Filename,
+	const FTrRoadNetwork& Network,
+	const TArray<FTrIntersection>& Intersections,
+	const TArray<FTrVehiclePathTransform>& VehicleStarts,
+	const FTrRoadHeightField& HeightField,
+	const uint32 SourceHash
+)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(FTrBakedTrafficData::Save)
+	using namespace TrBakedTrafficData;
+
+	FFileHeader Header;
+	FMemory::Memzero(Header);
+	Header.Magic = FileMagic;
+	Header.Version = FileVersion;
+	Header.NumSections = static_cast<uint32>(ESection::Num);
+	Header.SourceHash = SourceHash;
+	Header.LaneOffset = Network.LaneOffset;
+	Header.HeightFieldSpacing = HeightField.SampleSpacing;
+	Header.HeightFieldWidth = HeightField.Width;
+	Header.HeightFieldColumns = HeightField.NumColumns;
+	Header.HeightFieldChecksum = HeightField.NetworkChecksum;
+
+	TArray<uint32> IntersectionOffsets;
+	TArray<uint32> IntersectionNodes;
+	for(const FTrIntersection& Intersection : Intersections)
+	{
+		IntersectionOffsets.Push(IntersectionNodes.Num());
+		IntersectionNodes.Append(Intersection.Nodes);
+	}
+	IntersectionOffsets.Push(IntersectionNodes.Num());
+
+	TArray<uint8> EdgeLaneCounts;
+	EdgeLaneCounts.SetNumUninitialized(Network.GetNumEdges());
+	for(int32 Edge = 0; Edge < Network.GetNumEdges(); ++Edge)
+	{
+		EdgeLaneCounts[Edge] = Network.GetLaneCount(Edge);
+	}
+
+	TArray<FVehicleStart> Starts;
+	Starts.Reserve(VehicleStarts.Num());
+	for(const FTrVehiclePathTransform& VehicleStart : VehicleStarts)
+	{
+		Starts.Push({VehicleStart.Transform.GetLocation(), VehicleStart.Transform.GetRotation(), VehicleStart.Path.StartNodeIndex, VehicleStart.Path.EndNodeIndex});
+	}
+
+	TArray<uint8> Buffer;
+	Buffer.SetNumZeroed(sizeof(FFileHeader));
+	WriteSection(Buffer, Header, ESection::NodeLocations, Network.NodeLocations);
+	WriteSection(Buffer, Header, ESection::NodeEdgeOffsets, Network.NodeEdgeOffsets);
+	WriteSection(Buffer, Header, ESection::EdgeStartNodes, Network.EdgeStartNodes);
+	WriteSection(Buffer, Header, ESection::EdgeEndNodes, Network.EdgeEndNodes);
+	WriteSection(Buffer, Header, ESection::EdgeLengths, Network.EdgeLengths);
+	WriteSection(Buffer, Header, ESection::EdgeDirections, Network.EdgeDirections);
+	WriteSection(Buffer, Header, ESection::LaneStarts, Network.LaneStarts);
+	WriteSection(Buffer, Header, ESection::LaneEnds, Network.LaneEnds);
+	WriteSection(Buffer, Header, ESection::LaneOutwards, Network.LaneOutwards);
+	WriteSection(Buffer, Header, ESection::EdgeLaneCounts, EdgeLaneCounts);
+	WriteSection(Buffer, Header, ESection::TurnOffsets, Network.TurnOffsets);
+	WriteSection(Buffer, Header, ESection::TurnEdges, Network.TurnEdges);
+	WriteSection(Buffer, Header, ESection::IntersectionOffsets, IntersectionOffsets);
+	WriteSection(Buffer, Header, ESection::IntersectionNodes, IntersectionNodes);
+	WriteSection(Buffer, Header, ESection::VehicleStarts, Starts);
+	WriteSection(Buffer, Header, ESection::HeightFieldOffsets, HeightField.EdgeOffsets);
+	WriteSection(Buffer, Header, ESection::HeightFieldHeights, HeightField.Heights);
+	WriteSection(Buffer, Header, ESection::HeightFieldNormals, HeightField.Normals);
+	FMemory::Memcpy(Buffer.GetData(), &Header, sizeof(FFileHeader));
+
+	return FFileHelper::SaveArrayToFile(Buffer, *Filename);
+}
+
+bool FTrBakedTrafficData::Load(const FString& Filename)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(FTrBakedTrafficData::Load)
+
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	if(!PlatformFile.FileExists(*Filename))
+	{
+		return false;
+	}
+
+	// Mapping the file avoids copying it into an intermediate buffer.
+	TUniquePtr<IMappedFileHandle> MappedFile(PlatformFile.OpenMapped(*Filename));
+	if(MappedFile)
+	{
+		TUniquePtr<IMappedFileRegion> MappedRegion(MappedFile->MapRegion(0, MappedFile->GetFileSize()));
+		if(MappedRegion)
+		{
+			return LoadFromMemory(MappedRegion->GetMappedPtr(), MappedRegion->GetMappedSize());
+		}
+	}
+
+	TArray64<uint8> Buffer;
+	if(!FFileHelper::LoadFileToArray(Buffer, *Filename))
+	{
+		return false;
+	}
+	return LoadFromMemory(Buffer.GetData(), Buffer.Num());
+}
+
+bool FTrBakedTrafficData::LoadFromMemory(const uint8* Data, const int64 Size)
+{
+	using namespace TrBakedTrafficData;
+
+	if(Size < static_cast<int64>(sizeof(FFileHeader)))
+	{
+		return false;
+	}
+
+	FFileHeader Header;
+	FMemory::Memcpy(&Header, Data, sizeof(FFileHeader));
+	if(Header.Magic != FileMagic || Header.Version != FileVersion || Header.NumSections != static_cast<uint32>(ESection::Num))
+	{
+		return false;
+	}
+
+	TArray<uint32> IntersectionOffsets;
+	TArray<uint32> IntersectionNodes;
+	TArray<FVehicleStart> Starts;
+	TArray<uint8> EdgeLaneCounts;
+
+	Network.Reset();
+	HeightField.Reset();
+	const bool bIsValid =
+		ReadSection(Data, Size, Header, ESection::NodeLocations, Network.NodeLocations) &&
+		ReadSection(Data, Size, Header, ESection::NodeEdgeOffsets, Network.NodeEdgeOffsets) &&
+		ReadSection(Data, Size, Header, ESection::EdgeStartNodes, Network.EdgeStartNodes) &&
+		ReadSection(Data, Size, Header, ESection::EdgeEndNodes, Network.EdgeEndNodes) &&
+		ReadSection(Data, Size, Header, ESection::EdgeLengths, Network.EdgeLengths) &&
+		ReadSection(Data, Size, Header, ESection::EdgeDirections, Network.EdgeDirections) &&
+		ReadSection(Data, Size, Header, ESection::LaneStarts, Network.LaneStarts) &&
+		ReadSection(Data, Size, Header, ESection::LaneEnds, Network.LaneEnds) &&
+		ReadSection(Data, Size, Header, ESection::LaneOutwards, Network.LaneOutwards) &&
+		ReadSection(Data, Size, Header, ESection::EdgeLaneCounts, EdgeLaneCounts) &&
+		ReadSection(Data, Size, Header, ESection::TurnOffsets, Network.TurnOffsets) &&
+		ReadSection(Data, Size, Header, ESection::TurnEdges, Network.TurnEdges) &&
+		ReadSection(Data, Size, Header, ESection::IntersectionOffsets, IntersectionOffsets) &&
+		ReadSection(Data, Size, Header, ESection::IntersectionNodes, IntersectionNodes) &&
+		ReadSection(Data, Size, Header, ESection::VehicleStarts, Starts) &&
+		ReadSection(Data, Size, Header, ESection::HeightFieldOffsets, HeightField.EdgeOffsets) &&
+		ReadSection(Data, Size, Header, ESection::HeightFieldHeights, HeightField.Heights) &&
+		ReadSection(Data, Size, Header, ESection::HeightFieldNormals, HeightField.Normals) &&
+		Network.NodeEdgeOffsets.Num() == Network.NodeLocations.Num() + 1 &&
+		Network.TurnOffsets.Num() == Network.EdgeEndNodes.Num() + 1 &&
+		EdgeLaneCounts.Num() == Network.EdgeEndNodes.Num() &&
+		IntersectionOffsets.Num() > 0;
+
+	if(!bIsValid)
+	{
+		Network.Reset();
+		HeightField.Reset();
+		return false;
+	}
+	Network.LaneOffset = Header.LaneOffset;
+	SourceHash = Header.SourceHash;
+	Network.SetLaneCounts(EdgeLaneCounts);
+
+	HeightField.SampleSpacing = Header.HeightFieldSpacing;
+	HeightField.Width = Header.HeightFieldWidth;
+	HeightField.NumColumns = Header.HeightFieldColumns;
+	HeightField.NetworkChecksum = Header.HeightFieldChecksum;
+	if(!HeightField.IsEmpty() && !HeightField.IsValidFor(Network))
+	{
+		HeightField.Reset();
+	}
+
+	Intersections.SetNum(IntersectionOffsets.Num() - 1);
+	for(int Index = 0; Index < Intersections.Num(); ++Index)
+	{
+		const uint32 First = IntersectionOffsets[Index];
+		Intersections[Index].Nodes = TArray<uint32>(IntersectionNodes.GetData() + First, IntersectionOffsets[Index + 1] - First);
+	}
+
+	VehicleStarts.Reset(Starts.Num());
+	for(const FVehicleStart& Start : Starts)
+	{
+		if(!Network.NodeLocations.IsValidIndex(Start.StartNodeIndex) || !Network.NodeLocations.IsValidIndex(Start.EndNodeIndex))
+		{
+			continue;
+		}
+		
+		FTrPath Path;
+		Path.StartNodeIndex = Start.StartNodeIndex;
+		Path.EndNodeIndex = Start.EndNodeIndex;
+		Path.Start = Network.GetNodeLocation(Start.StartNodeIndex);
+		Path.End = Network.GetNodeLocation(Start.EndNodeIndex);
+		VehicleStarts.Push({FTransform(Start.Rotation, Start.Location, FVector::One()), Path});
+	}
+
+	return true;
+}
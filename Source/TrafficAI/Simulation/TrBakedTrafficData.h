@@ -0,0 +1,83 @@
+﻿// Copyright Anupam Sahu. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "TrTypes.h"
+#include "TrRoadHeightField.h"
+#include "TrRoadNetwork.h"
+#include "TrafficAI/Utility/TrSpatialGraphComponent.h"
+
+/**
+ * @class FTrBakedTrafficData
+ *
+ * Reads and writes the baked road network, intersections, vehicle starts and road height field of a traffic manager.
+ *
+ * The file is a versioned, position-independent binary blob:
+ * a fixed-size header holds a magic number, a format version and a table of sections,
+ * each section is a flat array of trivially copyable elements referenced by its byte offset from the start of the file.
+ * Nothing in the file depends on the address it is loaded at, so it can be memory mapped and copied section by section
+ * straight into the arrays used by the simulation, without per-node allocations.
+ *
+ * Files are produced when a level is cooked, or on demand in the editor, see ATrTrafficManager.
+ * The header also stores a hash of the spatial graph and configurations the file was baked from, so that stale files can be rejected.
+ */
+class TRAFFICAI_API FTrBakedTrafficData
+{
+public:
+
+	// Identifies a traffic data file.
+	static constexpr uint32 FileMagic = 0x54524446; // 'TRDF'
+
+	// Incremented whenever the layout of the file changes. Files with a different version are rejected.
+	static constexpr uint32 FileVersion = 6;
+
+	/**
+	 * @brief Writes a baked traffic data file.
+	 * The height field is optional, its sections are left empty if it has not been built.
+	 * @param SourceHash Hash of the data the file is baked from, or zero if it is not baked from a spatial graph, like imported networks.
+	 * @return True if the file was written successfully.
+	 */
+	static bool Save
+	(
+		const FString& Filename,
+		const FTrRoadNetwork& Network,
+		const TArray<FTrIntersection>& Intersections,
+		const TArray<FTrVehiclePathTransform>& VehicleStarts,
+		const FTrRoadHeightField& HeightField,
+		const uint32 SourceHash = 0
+	);
+
+	/**
+	 * @brief Loads a baked traffic data file.
+	 *
+	 * The file is memory mapped when the platform supports it, otherwise it is read with a single bulk read.
+	 * @return False if the file does not exist, is corrupted or was written with another version of the format.
+	 */
+	bool Load(const FString& Filename);
+
+	FTrRoadNetwork& GetNetwork() { return Network; }
+
+	// Hash of the data the loaded file was baked from.
+	uint32 GetSourceHash() const { return SourceHash; }
+
+	const TArray<FTrIntersection>& GetIntersections() const { return Intersections; }
+
+	const TArray<FTrVehiclePathTransform>& GetVehicleStarts() const { return VehicleStarts; }
+
+	// Empty if the file was baked without grounding.
+	FTrRoadHeightField& GetHeightField() { return HeightField; }
+
+private:
+
+	// Parses the contents of a file that has been loaded or mapped into memory.
+	bool LoadFromMemory(const uint8* Data, const int64 Size);
+
+private:
+
+	FTrRoadNetwork Network;
+	TArray<FTrIntersection> Intersections;
+	TArray<FTrVehiclePathTransform> VehicleStarts;
+	FTrRoadHeightField HeightField;
+	uint32 SourceHash = 0;
+};
@@ -0,0 +1,478 @@
+﻿// Copyright Anupam Sahu. All Rights Reserved.
+
+#include "TrContractionHierarchy.h"
+#include "Algo/Count.h"
+#include "Algo/Reverse.h"
+#include "TrRoadNetwork.h"
+
+constexpr int32 MAX_WITNESS_SETTLED_NODES = 500; // Witness searches give up after this many vertices, possibly adding unnecessary shortcuts.
+
+namespace TrContractionHierarchy
+{
+	struct FArc
+	{
+		uint32 Node;
+		float Weight;
+		int32 Middle;
+	};
+
+	struct FQueueEntry
+	{
+		float Distance;
+		uint32 Node;
+
+		bool operator<(const FQueueEntry& Other) const { return Distance < Other.Distance; }
+	};
+
+	struct FLabel
+	{
+		float Distance;
+		uint32 Parent;
+	};
+
+	// Adds an arc, or lowers the weight of an existing arc to the same vertex.
+	void AddArc(TArray<FArc>& Arcs, const uint32 Node, const float Weight, const int32 Middle)
+	{
+		for(FArc& Arc : Arcs)
+		{
+			if(Arc.Node == Node)
+			{
+				if(Weight < Arc.Weight)
+				{
+					Arc.Weight = Weight;
+					Arc.Middle = Middle;
+				}
+				return;
+			}
+		}
+		Arcs.Push({Node, Weight, Middle});
+	}
+
+	// Contracts the vertices of the edge graph, and keeps every arc and shortcut that has been created.
+	class FContractor
+	{
+	public:
+
+		explicit FContractor(const FTrRoadNetwork& Network)
+		{
+			const int32 NumEdges = Network.GetNumEdges();
+			OutArcs.SetNum(NumEdges);
+			InArcs.SetNum(NumEdges);
+			for(int32 Edge = 0; Edge < NumEdges; ++Edge)
+			{
+				for(const uint32 Turn : Network.GetTurns(Edge))
+				{
+					if(Turn != static_cast<uint32>(Edge))
+					{
+						AddArc(OutArcs[Edge], Turn, Network.GetEdgeLength(Turn), INDEX_NONE);
+						AddArc(InArcs[Turn], Edge, Network.GetEdgeLength(Turn), INDEX_NONE);
+					}
+				}
+			}
+
+			bIsContracted.Init(false, NumEdges);
+			NumContractedNeighbors.Init(0, NumEdges);
+			Distances.Init(TNumericLimits<float>::Max(), NumEdges);
+		}
+
+		// Contracts all vertices, lazily updating their priority. Returns the rank of each vertex.
+		void ContractAll(TArray<uint32>& OutRanks)
+		{
+			const int32 NumNodes = OutArcs.Num();
+			OutRanks.Init(0, NumNodes);
+
+			TArray<FQueueEntry> Queue;
+			Queue.Reserve(NumNodes);
+			for(int32 Node = 0; Node < NumNodes; ++Node)
+			{
+				Queue.HeapPush({ComputePriority(Node), static_cast<uint32>(Node)});
+			}
+
+			uint32 NextRank = 0;
+			while(Queue.Num() > 0)
+			{
+				FQueueEntry Entry;
+				Queue.HeapPop(Entry, false);
+
+				// Priorities change as neighbors are contracted, re-queue the vertex if it is no longer the least important.
+				const float Priority = ComputePriority(Entry.Node);
+				if(Queue.Num() > 0 && Priority > Queue.HeapTop().Distance)
+				{
+					Queue.HeapPush({Priority, Entry.Node});
+					continue;
+				}
+
+				Contract(Entry.Node, false);
+				bIsContracted[Entry.Node] = true;
+				OutRanks[Entry.Node] = NextRank++;
+				for(const TArray<FArc>* Arcs : {&OutArcs[Entry.Node], &InArcs[Entry.Node]})
+				{
+					for(const FArc& Arc : *Arcs)
+					{
+						++NumContractedNeighbors[Arc.Node];
+					}
+				}
+			}
+		}
+
+		TArray<TArray<FArc>> OutArcs;
+
+	private:
+
+		// Edge difference, plus the number of contracted neighbors to spread contraction uniformly over the graph.
+		float ComputePriority(const uint32 Node)
+		{
+			int32 NumArcs = 0;
+			for(const TArray<FArc>* Arcs : {&OutArcs[Node], &InArcs[Node]})
+			{
+				NumArcs += Algo::CountIf(*Arcs, [this](const FArc& Arc) { return !bIsContracted[Arc.Node]; });
+			}
+			return Contract(Node, true) - NumArcs + NumContractedNeighbors[Node];
+		}
+
+		// Adds the shortcuts required to remove a vertex, and returns their number. Shortcuts are only counted when simulating.
+		int32 Contract(const uint32 Node, const bool bSimulate)
+		{
+			int32 NumShortcuts = 0;
+			for(const FArc& In : InArcs[Node])
+			{
+				if(bIsContracted[In.Node])
+				{
+					continue;
+				}
+
+				float MaxOutWeight = 0.0f;
+				for(const FArc& Out : OutArcs[Node])
+				{
+					if(!bIsContracted[Out.Node] && Out.Node != In.Node)
+					{
+						MaxOutWeight = FMath::Max(MaxOutWeight, Out.Weight);
+					}
+				}
+				RunWitnessSearch(In.Node, Node, In.Weight + MaxOutWeight);
+
+				for(const FArc& Out : OutArcs[Node])
+				{
+					const float ShortcutWeight = In.Weight + Out.Weight;
+					if(bIsContracted[Out.Node] || Out.Node == In.Node || Distances[Out.Node] <= ShortcutWeight)
+					{
+						continue;
+					}
+
+					++NumShortcuts;
+					if(!bSimulate)
+					{
+						AddArc(OutArcs[In.Node], Out.Node, ShortcutWeight, Node);
+						AddArc(InArcs[Out.Node], In.Node, ShortcutWeight, Node);
+					}
+				}
+			}
+			return NumShortcuts;
+		}
+
+		// Bounded Dijkstra search from Source that avoids Excluded and contracted vertices.
+		void RunWitnessSearch(const uint32 Source, const uint32 Excluded, const float MaxDistance)
+		{
+			for(const uint32 Node : TouchedNodes)
+			{
+				Distances[Node] = TNumericLimits<float>::Max();
+			}
+			TouchedNodes.Reset();
+			Queue.Reset();
+
+			Distances[Source] = 0.0f;
+			TouchedNodes.Push(Source);
+			Queue.HeapPush({0.0f, Source});
+
+			int32 NumSettledNodes = 0;
+			while(Queue.Num() > 0 && NumSettledNodes < MAX_WITNESS_SETTLED_NODES)
+			{
+				FQueueEntry Entry;
+				Queue.HeapPop(Entry, false);
+				if(Entry.Distance > MaxDistance)
+				{
+					break;
+				}
+				if(Entry.Distance > Distances[Entry.Node])
+				{
+					continue;
+				}
+				++NumSettledNodes;
+
+				for(const FArc& Arc : OutArcs[Entry.Node])
+				{
+					const float Distance = Entry.Distance + Arc.Weight;
+					if(Arc.Node == Excluded || bIsContracted[Arc.Node] || Distance >= Distances[Arc.Node])
+					{
+						continue;
+					}
+
+					if(Distances[Arc.Node] == TNumericLimits<float>::Max())
+					{
+						TouchedNodes.Push(Arc.Node);
+					}
+					Distances[Arc.Node] = Distance;
+					Queue.HeapPush({Distance, Arc.Node});
+				}
+			}
+		}
+
+	private:
+
+		TArray<TArray<FArc>> InArcs;
+		TArray<bool> bIsContracted;
+		TArray<int32> NumContractedNeighbors;
+
+		// Witness search state, reset lazily.
+		TArray<float> Distances;
+		TArray<uint32> TouchedNodes;
+		TArray<FQueueEntry> Queue;
+	};
+}
+
+void FTrContractionHierarchy::Build(const FTrRoadNetwork& Network)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(FTrContractionHierarchy::Build)
+	using namespace TrContractionHierarchy;
+
+	Reset();
+	NumNetworkNodes = Network.GetNumNodes();
+	NumNetworkEdges = Network.GetNumEdges();
+	NumNetworkTurns = Network.GetNumTurns();
+	NetworkChecksum = Network.GetChecksum();
+
+	IncomingOffsets.Init(0, NumNetworkNodes + 1);
+	for(int32 Edge = 0; Edge < NumNetworkEdges; ++Edge)
+	{
+		++IncomingOffsets[Network.GetEdgeEndNode(Edge) + 1];
+	}
+	for(int32 Node = 0; Node < NumNetworkNodes; ++Node)
+	{
+		IncomingOffsets[Node + 1] += IncomingOffsets[Node];
+	}
+	IncomingEdges.SetNumUninitialized(NumNetworkEdges);
+	TArray<uint32> Cursors(IncomingOffsets.GetData(), NumNetworkNodes);
+	for(int32 Edge = 0; Edge < NumNetworkEdges; ++Edge)
+	{
+		IncomingEdges[Cursors[Network.GetEdgeEndNode(Edge)]++] = Edge;
+	}
+
+	FContractor Contractor(Network);
+	Contractor.ContractAll(Ranks);
+
+	// Every arc, including shortcuts, is stored once: on its source if it leads upwards, on its target otherwise.
+	UpwardOffsets.Init(0, NumNetworkEdges + 1);
+	DownwardOffsets.Init(0, NumNetworkEdges + 1);
+	for(int32 Source = 0; Source < NumNetworkEdges; ++Source)
+	{
+		for(const FArc& Arc : Contractor.OutArcs[Source])
+		{
+			if(Ranks[Arc.Node] > Ranks[Source])
+			{
+				++UpwardOffsets[Source + 1];
+			}
+			else
+			{
+				++DownwardOffsets[Arc.Node + 1];
+			}
+			NumShortcuts += Arc.Middle != INDEX_NONE ? 1 : 0;
+		}
+	}
+	for(int32 Edge = 0; Edge < NumNetworkEdges; ++Edge)
+	{
+		UpwardOffsets[Edge + 1] += UpwardOffsets[Edge];
+		DownwardOffsets[Edge + 1] += DownwardOffsets[Edge];
+	}
+
+	const int32 NumUpwardArcs = UpwardOffsets.Last();
+	const int32 NumDownwardArcs = DownwardOffsets.Last();
+	UpwardTargets.SetNumUninitialized(NumUpwardArcs);
+	UpwardWeights.SetNumUninitialized(NumUpwardArcs);
+	UpwardMiddles.SetNumUninitialized(NumUpwardArcs);
+	DownwardSources.SetNumUninitialized(NumDownwardArcs);
+	DownwardWeights.SetNumUninitialized(NumDownwardArcs);
+	DownwardMiddles.SetNumUninitialized(NumDownwardArcs);
+
+	TArray<uint32> UpwardCursors(UpwardOffsets.GetData(), NumNetworkEdges);
+	TArray<uint32> DownwardCursors(DownwardOffsets.GetData(), NumNetworkEdges);
+	for(int32 Source = 0; Source < NumNetworkEdges; ++Source)
+	{
+		for(const FArc& Arc : Contractor.OutArcs[Source])
+		{
+			if(Ranks[Arc.Node] > Ranks[Source])
+			{
+				const uint32 Index = UpwardCursors[Source]++;
+				UpwardTargets[Index] = Arc.Node;
+				UpwardWeights[Index] = Arc.Weight;
+				UpwardMiddles[Index] = Arc.Middle;
+			}
+			else
+			{
+				const uint32 Index = DownwardCursors[Arc.Node]++;
+				DownwardSources[Index] = Source;
+				DownwardWeights[Index] = Arc.Weight;
+				DownwardMiddles[Index] = Arc.Middle;
+			}
+		}
+	}
+}
+
+void FTrContractionHierarchy::Reset()
+{
+	NumNetworkNodes = NumNetworkEdges = NumNetworkTurns = NumShortcuts = 0;
+	NetworkChecksum = 0;
+	IncomingOffsets.Empty();
+	IncomingEdges.Empty();
+	Ranks.Empty();
+	UpwardOffsets.Empty();
+	UpwardTargets.Empty();
+	UpwardWeights.Empty();
+	UpwardMiddles.Empty();
+	DownwardOffsets.Empty();
+	DownwardSources.Empty();
+	DownwardWeights.Empty();
+	DownwardMiddles.Empty();
+}
+
+bool FTrContractionHierarchy::IsValidFor(const FTrRoadNetwork& Network) const
+{
+	return !IsEmpty()
+		&& NumNetworkNodes == Network.GetNumNodes()
+		&& NumNetworkEdges == Network.GetNumEdges()
+		&& NumNetworkTurns == Network.GetNumTurns()
+		&& NetworkChecksum == Network.GetChecksum();
+}
+
+bool FTrContractionHierarchy::FindRoute(const uint32 OriginEdge, const uint32 DestinationNode, TArray<uint32>& OutRoute) const
+{
+	using namespace TrContractionHierarchy;
+
+	// Upward search from the origin. Search spaces are small, so it is run to completion.
+	TMap<uint32, FLabel> ForwardLabels;
+	TArray<FQueueEntry> Queue;
+	ForwardLabels.Add(OriginEdge, {0.0f, OriginEdge});
+	Queue.HeapPush({0.0f, OriginEdge});
+	while(Queue.Num() > 0)
+	{
+		FQueueEntry Entry;
+		Queue.HeapPop(Entry, false);
+		if(Entry.Distance > ForwardLabels[Entry.Node].Distance)
+		{
+			continue;
+		}
+
+		for(uint32 Arc = UpwardOffsets[Entry.Node]; Arc < UpwardOffsets[Entry.Node + 1]; ++Arc)
+		{
+			const float Distance = Entry.Distance + UpwardWeights[Arc];
+			const FLabel* Label = ForwardLabels.Find(UpwardTargets[Arc]);
+			if(!Label || Distance < Label->Distance)
+			{
+				ForwardLabels.Add(UpwardTargets[Arc], {Distance, Entry.Node});
+				Queue.HeapPush({Distance, UpwardTargets[Arc]});
+			}
+		}
+	}
+
+	// Backward search from every edge that ends at the destination, stopped once it can not improve the best meeting vertex.
+	TMap<uint32, FLabel> BackwardLabels;
+	Queue.Reset();
+	for(uint32 Index = IncomingOffsets[DestinationNode]; Index < IncomingOffsets[DestinationNode + 1]; ++Index)
+	{
+		BackwardLabels.Add(IncomingEdges[Index], {0.0f, IncomingEdges[Index]});
+		Queue.HeapPush({0.0f, IncomingEdges[Index]});
+	}
+
+	float BestDistance = TNumericLimits<float>::Max();
+	int32 MeetingEdge = INDEX_NONE;
+	while(Queue.Num() > 0)
+	{
+		FQueueEntry Entry;
+		Queue.HeapPop(Entry, false);
+		if(Entry.Distance >= BestDistance)
+		{
+			break;
+		}
+		if(Entry.Distance > BackwardLabels[Entry.Node].Distance)
+		{
+			continue;
+		}
+
+		if(const FLabel* ForwardLabel = ForwardLabels.Find(Entry.Node); ForwardLabel && ForwardLabel->Distance + Entry.Distance < BestDistance)
+		{
+			BestDistance = ForwardLabel->Distance + Entry.Distance;
+			MeetingEdge = Entry.Node;
+		}
+
+		for(uint32 Arc = DownwardOffsets[Entry.Node]; Arc < DownwardOffsets[Entry.Node + 1]; ++Arc)
+		{
+			const float Distance = Entry.Distance + DownwardWeights[Arc];
+			const FLabel* Label = BackwardLabels.Find(DownwardSources[Arc]);
+			if(!Label || Distance < Label->Distance)
+			{
+				BackwardLabels.Add(DownwardSources[Arc], {Distance, Entry.Node});
+				Queue.HeapPush({Distance, DownwardSources[Arc]});
+			}
+		}
+	}
+
+	if(MeetingEdge == INDEX_NONE)
+	{
+		return false;
+	}
+
+	// Vertices of the route in the hierarchy, from the origin to the meeting vertex and from there to the destination.
+	TArray<uint32> Vertices;
+	for(uint32 Edge = MeetingEdge; Edge != OriginEdge; Edge = ForwardLabels[Edge].Parent)
+	{
+		Vertices.Push(Edge);
+	}
+	Vertices.Push(OriginEdge);
+	Algo::Reverse(Vertices);
+	for(uint32 Edge = MeetingEdge; BackwardLabels[Edge].Parent != Edge;)
+	{
+		Edge = BackwardLabels[Edge].Parent;
+		Vertices.Push(Edge);
+	}
+
+	OutRoute.Reset();
+	for(int32 Index = 0; Index < Vertices.Num() - 1; ++Index)
+	{
+		UnpackArc(Vertices[Index], Vertices[Index + 1], OutRoute);
+	}
+	return true;
+}
+
+void FTrContractionHierarchy::UnpackArc(const uint32 Source, const uint32 Target, TArray<uint32>& OutRoute) const
+{
+	int32 Middle = INDEX_NONE;
+	if(Ranks[Target] > Ranks[Source])
+	{
+		for(uint32 Arc = UpwardOffsets[Source]; Arc < UpwardOffsets[Source + 1]; ++Arc)
+		{
+			if(UpwardTargets[Arc] == Target)
+			{
+				Middle = UpwardMiddles[Arc];
+				break;
+			}
+		}
+	}
+	else
+	{
+		for(uint32 Arc = DownwardOffsets[Target]; Arc < DownwardOffsets[Target + 1]; ++Arc)
+		{
+			if(DownwardSources[Arc] == Source)
+			{
+				Middle = DownwardMiddles[Arc];
+				break;
+			}
+		}
+	}
+
+	if(Middle == INDEX_NONE)
+	{
+		OutRoute.Push(Target);
+		return;
+	}
+	UnpackArc(Source, Middle, OutRoute);
+	UnpackArc(Middle, Target, OutRoute);
+}
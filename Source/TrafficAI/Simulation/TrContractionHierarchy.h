@@ -0,0 +1,123 @@
+﻿// Copyright Anupam Sahu. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "TrContractionHierarchy.generated.h"
+
+class FTrRoadNetwork;
+
+/**
+ * @struct FTrContractionHierarchy
+ *
+ * A contraction hierarchy built over the edges of a road network, that answers shortest route queries in microseconds.
+ *
+ * The hierarchy is built on the edge graph of the network: every edge is a vertex, and every allowed turn is an arc
+ * weighted by the length of the edge it leads to, so routes respect turn tables and intersection expansion.
+ * Vertices are contracted one by one, in order of importance. When a vertex is removed, shortcuts are added between its neighbors
+ * if no witness path exists, so that distances between remaining vertices are preserved.
+ *
+ * A query runs two Dijkstra searches that only follow arcs towards more important vertices:
+ * forward from the origin edge, and backward from the edges that end at the destination node. The route goes through the vertex
+ * where the sum of both distances is the smallest. Shortcuts are then unpacked into the edges they replace.
+ *
+ * All data is stored in flat arrays, so the hierarchy can be built in the editor and serialized with the level.
+ */
+USTRUCT()
+struct TRAFFICAI_API FTrContractionHierarchy
+{
+	GENERATED_BODY()
+
+public:
+
+	// Builds the hierarchy for a road network. This is an expensive operation, meant to be performed offline.
+	void Build(const FTrRoadNetwork& Network);
+
+	void Reset();
+
+	bool IsEmpty() const { return Ranks.Num() == 0; }
+
+	// Returns true if the hierarchy was built for a network with the same nodes, edges, lengths and turns.
+	bool IsValidFor(const FTrRoadNetwork& Network) const;
+
+	/**
+	 * @brief Finds the shortest route from the end of OriginEdge to DestinationNode. Thread safe.
+	 *
+	 * @param OutRoute Edges that follow the origin edge, up to the edge that ends at the destination node.
+	 * @return False if the destination can not be reached.
+	 */
+	bool FindRoute(const uint32 OriginEdge, const uint32 DestinationNode, TArray<uint32>& OutRoute) const;
+
+	int32 GetNumShortcuts() const { return NumShortcuts; }
+
+private:
+
+	// Appends the edges represented by the arc from Source to Target, excluding Source.
+	void UnpackArc(const uint32 Source, const uint32 Target, TArray<uint32>& OutRoute) const;
+
+private:
+
+#pragma region Network
+
+	UPROPERTY()
+	int32 NumNetworkNodes = 0;
+
+	UPROPERTY()
+	int32 NumNetworkEdges = 0;
+
+	UPROPERTY()
+	int32 NumNetworkTurns = 0;
+
+	// Checksum of the network, see FTrRoadNetwork::GetChecksum.
+	UPROPERTY()
+	uint32 NetworkChecksum = 0;
+
+	// Edges that end at each node of the network, in CSR form.
+	UPROPERTY()
+	TArray<uint32> IncomingOffsets;
+
+	UPROPERTY()
+	TArray<uint32> IncomingEdges;
+
+#pragma endregion
+
+	// Contraction order of each edge.
+	UPROPERTY()
+	TArray<uint32> Ranks;
+
+#pragma region Arcs
+
+	/**
+	 * Arcs from each edge to edges of higher rank, in CSR form.
+	 * Middle is the contracted edge that a shortcut goes through, or INDEX_NONE for a turn of the network.
+	 */
+	UPROPERTY()
+	TArray<uint32> UpwardOffsets;
+
+	UPROPERTY()
+	TArray<uint32> UpwardTargets;
+
+	UPROPERTY()
+	TArray<float> UpwardWeights;
+
+	UPROPERTY()
+	TArray<int32> UpwardMiddles;
+
+	// Arcs to each edge from edges of higher rank, in CSR form.
+	UPROPERTY()
+	TArray<uint32> DownwardOffsets;
+
+	UPROPERTY()
+	TArray<uint32> DownwardSources;
+
+	UPROPERTY()
+	TArray<float> DownwardWeights;
+
+	UPROPERTY()
+	TArray<int32> DownwardMiddles;
+
+#pragma endregion
+
+	UPROPERTY()
+	int32 NumShortcuts = 0;
+};
@@ -0,0 +1,122 @@
+﻿// Copyright Anupam Sahu. All Rights Reserved.
+
+#include "TrRoadHeightField.h"
+#include "TrRoadNetwork.h"
+#include "Engine/World.h"
+
+// Horizontal unit vector pointing to the right of an edge.
+static FVector GetEdgeRight(const FVector& Direction)
+{
+	const FVector Right = FVector(-Direction.Y, Direction.X, 0.0f).GetSafeNormal();
+	return Right.IsZero() ? FVector::RightVector : Right;
+}
+
+void FTrRoadHeightField::Build(const FTrRoadNetwork& Network, const UWorld* World, const FTrGroundingConfiguration& Configuration)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(FTrRoadHeightField::Build)
+
+	Reset();
+	if(!World || Network.IsEmpty())
+	{
+		return;
+	}
+
+	SampleSpacing = FMath::Max(1.0f, Configuration.SampleSpacing);
+	Width = FMath::Max(1.0f, Configuration.Width);
+	NumColumns = FMath::Max(2, Configuration.NumLateralSamples);
+	NetworkChecksum = Network.GetChecksum();
+
+	const int32 NumEdges = Network.GetNumEdges();
+	EdgeOffsets.SetNumUninitialized(NumEdges + 1);
+	for(int32 Edge = 0; Edge < NumEdges; ++Edge)
+	{
+		EdgeOffsets[Edge] = Heights.Num();
+		const int32 NumRows = FMath::Max(2, FMath::CeilToInt32(Network.GetEdgeLength(Edge) / SampleSpacing) + 1);
+		Heights.AddUninitialized(NumRows * NumColumns);
+	}
+	EdgeOffsets[NumEdges] = Heights.Num();
+	Normals.SetNumUninitialized(Heights.Num());
+
+	const FVector TraceExtent = FVector::UpVector * Configuration.TraceHeight;
+	const FCollisionQueryParams QueryParams(SCENE_QUERY_STAT(TrRoadHeightField), false);
+	FHitResult Hit;
+	for(int32 Edge = 0; Edge < NumEdges; ++Edge)
+	{
+		const FVector& Start = Network.GetNodeLocation(Network.GetEdgeStartNode(Edge));
+		const FVector& End = Network.GetNodeLocation(Network.GetEdgeEndNode(Edge));
+		const FVector Right = GetEdgeRight(Network.GetEdgeDirection(Edge));
+		const int32 NumRows = (EdgeOffsets[Edge + 1] - EdgeOffsets[Edge]) / NumColumns;
+		for(int32 Row = 0; Row < NumRows; ++Row)
+		{
+			const FVector RowCenter = FMath::Lerp(Start, End, static_cast<float>(Row) / (NumRows - 1));
+			for(int32 Column = 0; Column < NumColumns; ++Column)
+			{
+				const FVector Location = RowCenter + Right * (Width * (static_cast<float>(Column) / (NumColumns - 1) - 0.5f));
+				const uint32 Sample = EdgeOffsets[Edge] + Row * NumColumns + Column;
+				if(World->LineTraceSingleByChannel(Hit, Location + TraceExtent, Location - TraceExtent, Configuration.TraceChannel, QueryParams))
+				{
+					Heights[Sample] = Hit.ImpactPoint.Z;
+					Normals[Sample] = FVector3f(Hit.ImpactNormal);
+				}
+				else
+				{
+					Heights[Sample] = Location.Z;
+					Normals[Sample] = FVector3f::UpVector;
+				}
+			}
+		}
+	}
+}
+
+void FTrRoadHeightField::Reset()
+{
+	SampleSpacing = 0.0f;
+	Width = 0.0f;
+	NumColumns = 0;
+	NetworkChecksum = 0;
+	EdgeOffsets.Reset();
+	Heights.Reset();
+	Normals.Reset();
+}
+
+bool FTrRoadHeightField::IsValidFor(const FTrRoadNetwork& Network) const
+{
+	return NumColumns >= 2 && EdgeOffsets.Num() == Network.GetNumEdges() + 1 && Heights.Num() == Normals.Num() && static_cast<int32>(EdgeOffsets.Last()) == Heights.Num()
+		&& NetworkChecksum == Network.GetChecksum();
+}
+
+uint32 FTrRoadHeightField::FindCell(const FTrRoadNetwork& Network, const uint32 Edge, const FVector& Location, float& OutColumnAlpha, float& OutRowAlpha) const
+{
+	const uint32 First = EdgeOffsets[Edge];
+	const int32 NumRows = (EdgeOffsets[Edge + 1] - First) / NumColumns;
+	const FVector& Direction = Network.GetEdgeDirection(Edge);
+	const FVector Local = Location - Network.GetNodeLocation(Network.GetEdgeStartNode(Edge));
+	const float Length = Network.GetEdgeLength(Edge);
+
+	// Coordinates of the location in the grid of the edge, in samples.
+	const float Row = Length > 0.0f ? FMath::Clamp(Local.Dot(Direction) / Length * (NumRows - 1), 0.0f, NumRows - 1.0f) : 0.0f;
+	const float Column = FMath::Clamp((Local.Dot(GetEdgeRight(Direction)) / Width + 0.5f) * (NumColumns - 1), 0.0f, NumColumns - 1.0f);
+	const int32 Row0 = FMath::Min(FMath::FloorToInt32(Row), NumRows - 2);
+	const int32 Column0 = FMath::Min(FMath::FloorToInt32(Column), NumColumns - 2);
+	OutRowAlpha = Row - Row0;
+	OutColumnAlpha = Column - Column0;
+
+	return First + Row0 * NumColumns + Column0;
+}
+
+void FTrRoadHeightField::Sample(const FTrRoadNetwork& Network, const uint32 Edge, const FVector& Location, float& OutHeight, FVector& OutNormal) const
+{
+	float ColumnAlpha, RowAlpha;
+	const uint32 Sample00 = FindCell(Network, Edge, Location, ColumnAlpha, RowAlpha);
+	const uint32 Sample10 = Sample00 + NumColumns;
+	OutHeight = FMath::BiLerp(Heights[Sample00], Heights[Sample00 + 1], Heights[Sample10], Heights[Sample10 + 1], ColumnAlpha, RowAlpha);
+	OutNormal = FVector(FMath::BiLerp(Normals[Sample00], Normals[Sample00 + 1], Normals[Sample10], Normals[Sample10 + 1], ColumnAlpha, RowAlpha)).GetSafeNormal(UE_SMALL_NUMBER, FVector::UpVector);
+}
+
+float FTrRoadHeightField::SampleHeight(const FTrRoadNetwork& Network, const uint32 Edge, const FVector& Location) const
+{
+	float ColumnAlpha, RowAlpha;
+	const uint32 Sample00 = FindCell(Network, Edge, Location, ColumnAlpha, RowAlpha);
+	const uint32 Sample10 = Sample00 + NumColumns;
+	return FMath::BiLerp(Heights[Sample00], Heights[Sample00 + 1], Heights[Sample10], Heights[Sample10 + 1], ColumnAlpha, RowAlpha);
+}
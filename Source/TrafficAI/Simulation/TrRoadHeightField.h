@@ -0,0 +1,63 @@
+﻿// Copyright Anupam Sahu. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "TrSimulationData.h"
+
+class FTrRoadNetwork;
+
+/**
+ * @class FTrRoadHeightField
+ *
+ * Heights and normals of the road surface, sampled on a strip along every edge of a road network.
+ *
+ * The strip of an edge is a grid of rows spaced by SampleSpacing along the center line, and of NumColumns samples across Width,
+ * so that it covers the lanes of both directions. Samples of all edges are stored in flat arrays, indexed by the offset of each edge.
+ * The field is built once with line traces, in the editor or at startup, then vehicles are grounded with bilinear lookups only.
+ */
+class TRAFFICAI_API FTrRoadHeightField
+{
+	friend class FTrBakedTrafficData;
+
+public:
+
+	/**
+	 * @brief Samples the road surface along every edge of a network, with line traces against the world.
+	 * Samples that do not hit anything are interpolated between the end nodes of their edge, with an upward normal.
+	 */
+	void Build(const FTrRoadNetwork& Network, const UWorld* World, const FTrGroundingConfiguration& Configuration);
+
+	void Reset();
+
+	bool IsEmpty() const { return EdgeOffsets.Num() == 0; }
+
+	// Returns true if the field has been built for the same network, see FTrRoadNetwork::GetChecksum.
+	bool IsValidFor(const FTrRoadNetwork& Network) const;
+
+	int32 GetNumSamples() const { return Heights.Num(); }
+
+	/**
+	 * @brief Returns the height and normal of the road surface under a location, by bilinear interpolation of the samples of an edge.
+	 * Locations outside of the strip of the edge are clamped to its border. Thread safe.
+	 */
+	void Sample(const FTrRoadNetwork& Network, const uint32 Edge, const FVector& Location, float& OutHeight, FVector& OutNormal) const;
+
+	// Returns the height of the road surface under a location, without its normal. Thread safe.
+	float SampleHeight(const FTrRoadNetwork& Network, const uint32 Edge, const FVector& Location) const;
+
+private:
+
+	// Finds the first of the four samples around a location, and its interpolation weights across and along the edge.
+	uint32 FindCell(const FTrRoadNetwork& Network, const uint32 Edge, const FVector& Location, float& OutColumnAlpha, float& OutRowAlpha) const;
+
+	float SampleSpacing = 0.0f;
+	float Width = 0.0f;
+	int32 NumColumns = 0;
+	uint32 NetworkChecksum = 0;
+
+	// Offset of the first sample of each edge, followed by the total number of samples. Samples are stored row by row.
+	TArray<uint32> EdgeOffsets;
+	TArray<float> Heights;
+	TArray<FVector3f> Normals;
+};
@@ -0,0 +1,249 @@
+﻿// Copyright Anupam Sahu. All Rights Reserved.
+
+#include "TrRoadNetwork.h"
+#include "RpSpatialGraphComponent.h"
+#include "TrafficAI/Utility/TrSpatialGraphComponent.h"
+
+void FTrRoadNetwork::Build(const URpSpatialGraphComponent* GraphComponent, const float NewLaneOffset)
+{
+	check(GraphComponent);
+	const TArray<FRpSpatialGraphNode>& Nodes = GraphComponent->GetNodes();
+
+	TArray<FVector> Locations;
+	TArray<uint32> AdjacencyOffsets;
+	TArray<uint32> Adjacency;
+	Locations.Reserve(Nodes.Num());
+	AdjacencyOffsets.Reserve(Nodes.Num() + 1);
+
+	for(const FRpSpatialGraphNode& Node : Nodes)
+	{
+		Locations.Push(Node.GetLocation());
+		AdjacencyOffsets.Push(Adjacency.Num());
+		Adjacency.Append(Node.GetConnections());
+	}
+	AdjacencyOffsets.Push(Adjacency.Num());
+
+	Build(Locations, AdjacencyOffsets, Adjacency, NewLaneOffset);
+
+	const UTrSpatialGraphComponent* TrafficGraph = Cast<UTrSpatialGraphComponent>(GraphComponent);
+	if(!TrafficGraph)
+	{
+		return;
+	}
+
+	TArray<uint8> LaneCounts;
+	LaneCounts.Init(FMath::Max<uint8>(1, TrafficGraph->GetDefaultLaneCount()), GetNumEdges());
+	for(const FTrRoadLanes& Road : TrafficGraph->GetRoads())
+	{
+		for(int32 Index = 0; Index < Road.Nodes.Num() - 1; ++Index)
+		{
+			const uint32 NodeA = Road.Nodes[Index];
+			const uint32 NodeB = Road.Nodes[Index + 1];
+			if(!NodeLocations.IsValidIndex(NodeA) || !NodeLocations.IsValidIndex(NodeB))
+			{
+				continue;
+			}
+
+			for(const int32 Edge : {FindEdge(NodeA, NodeB), FindEdge(NodeB, NodeA)})
+			{
+				if(Edge != INDEX_NONE)
+				{
+					LaneCounts[Edge] = FMath::Max<uint8>(1, Road.NumLanes);
+				}
+			}
+		}
+	}
+	SetLaneCounts(LaneCounts);
+}
+
+void FTrRoadNetwork::Build(const TArray<FVector>& InNodeLocations, const TArray<uint32>& InAdjacencyOffsets, const TArray<uint32>& InAdjacency, const float NewLaneOffset)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(FTrRoadNetwork::Build)
+
+	check(InAdjacencyOffsets.Num() == InNodeLocations.Num() + 1);
+
+	Reset();
+	NodeLocations = InNodeLocations;
+	NodeEdgeOffsets = InAdjacencyOffsets;
+	EdgeEndNodes = InAdjacency;
+
+	const int32 NumNodes = NodeLocations.Num();
+	const int32 NumEdges = EdgeEndNodes.Num();
+	EdgeStartNodes.SetNumUninitialized(NumEdges);
+	EdgeLengths.SetNumUninitialized(NumEdges);
+	EdgeDirections.SetNumUninitialized(NumEdges);
+
+	for(int32 Node = 0; Node < NumNodes; ++Node)
+	{
+		for(uint32 Edge = NodeEdgeOffsets[Node]; Edge < NodeEdgeOffsets[Node + 1]; ++Edge)
+		{
+			const FVector& Start = NodeLocations[Node];
+			const FVector& End = NodeLocations[EdgeEndNodes[Edge]];
+
+			EdgeStartNodes[Edge] = Node;
+			EdgeLengths[Edge] = FVector::Distance(Start, End);
+			EdgeDirections[Edge] = (End - Start).GetSafeNormal();
+		}
+	}
+
+	BuildLanes(NewLaneOffset);
+	BuildTurnTables();
+
+	TArray<uint8> LaneCounts;
+	LaneCounts.Init(1, NumEdges);
+	SetLaneCounts(LaneCounts);
+}
+
+void FTrRoadNetwork::SetLaneOffset(const float NewLaneOffset)
+{
+	if(NewLaneOffset != LaneOffset)
+	{
+		BuildLanes(NewLaneOffset);
+	}
+}
+
+void FTrRoadNetwork::BuildLanes(const float NewLaneOffset)
+{
+	LaneOffset = NewLaneOffset;
+
+	const int32 NumEdges = EdgeEndNodes.Num();
+	LaneStarts.SetNumUninitialized(NumEdges);
+	LaneEnds.SetNumUninitialized(NumEdges);
+	LaneOutwards.SetNumUninitialized(NumEdges);
+	for(int32 Edge = 0; Edge < NumEdges; ++Edge)
+	{
+		LaneOutwards[Edge] = EdgeDirections[Edge].RotateAngleAxis(-90.0f, FVector::UpVector);
+		const FVector Offset = LaneOutwards[Edge] * LaneOffset;
+		LaneStarts[Edge] = NodeLocations[EdgeStartNodes[Edge]] + Offset;
+		LaneEnds[Edge] = NodeLocations[EdgeEndNodes[Edge]] + Offset;
+	}
+}
+
+void FTrRoadNetwork::SetLaneCounts(const TArray<uint8>& NewLaneCounts)
+{
+	check(NewLaneCounts.Num() == GetNumEdges());
+
+	MaxLaneCount = 1;
+	EdgeLaneOffsets.SetNumUninitialized(NewLaneCounts.Num() + 1);
+	uint32 NumLanes = 0;
+	for(int32 Edge = 0; Edge < NewLaneCounts.Num(); ++Edge)
+	{
+		EdgeLaneOffsets[Edge] = NumLanes;
+		NumLanes += FMath::Max<uint8>(1, NewLaneCounts[Edge]);
+		MaxLaneCount = FMath::Max<int32>(MaxLaneCount, NewLaneCounts[Edge]);
+	}
+	EdgeLaneOffsets[NewLaneCounts.Num()] = NumLanes;
+}
+
+int32 FTrRoadNetwork::FindNearestLane(const uint32 Edge, const FVector& Location) const
+{
+	const float Offset = (Location - LaneStarts[Edge]).Dot(LaneOutwards[Edge]);
+	return LaneWidth > 0.0f ? FMath::Clamp(FMath::RoundToInt32(Offset / LaneWidth), 0, GetLaneCount(Edge) - 1) : 0;
+}
+
+void FTrRoadNetwork::Reset()
+{
+	LaneOffset = 0.0f;
+	NodeLocations.Empty();
+	NodeEdgeOffsets.Empty();
+	EdgeStartNodes.Empty();
+	EdgeEndNodes.Empty();
+	EdgeLengths.Empty();
+	EdgeDirections.Empty();
+	LaneStarts.Empty();
+	LaneEnds.Empty();
+	LaneOutwards.Empty();
+	EdgeLaneOffsets.Empty();
+	MaxLaneCount = 1;
+	TurnOffsets.Empty();
+	TurnEdges.Empty();
+}
+
+int32 FTrRoadNetwork::FindEdge(const uint32 Start, const uint32 End) const
+{
+	for(uint32 Edge = NodeEdgeOffsets[Start]; Edge < NodeEdgeOffsets[Start + 1]; ++Edge)
+	{
+		if(EdgeEndNodes[Edge] == End)
+		{
+			return Edge;
+		}
+	}
+
+	return INDEX_NONE;
+}
+
+FTrPath FTrRoadNetwork::MakePath(const uint32 Edge) const
+{
+	FTrPath Path;
+	Path.StartNodeIndex = EdgeStartNodes[Edge];
+	Path.EndNodeIndex = EdgeEndNodes[Edge];
+	Path.Start = NodeLocations[Path.StartNodeIndex];
+	Path.End = NodeLocations[Path.EndNodeIndex];
+	return Path;
+}
+
+uint32 FTrRoadNetwork::GetChecksum() const
+{
+	uint32 Checksum = FCrc::MemCrc32(NodeLocations.GetData(), NodeLocations.Num() * NodeLocations.GetTypeSize());
+	Checksum = FCrc::MemCrc32(EdgeStartNodes.GetData(), EdgeStartNodes.Num() * EdgeStartNodes.GetTypeSize(), Checksum);
+	Checksum = FCrc::MemCrc32(EdgeEndNodes.GetData(), EdgeEndNodes.Num() * EdgeEndNodes.GetTypeSize(), Checksum);
+	Checksum = FCrc::MemCrc32(EdgeLengths.GetData(), EdgeLengths.Num() * EdgeLengths.GetTypeSize(), Checksum);
+	Checksum = FCrc::MemCrc32(TurnOffsets.GetData(), TurnOffsets.Num() * TurnOffsets.GetTypeSize(), Checksum);
+	return FCrc::MemCrc32(TurnEdges.GetData(), TurnEdges.Num() * TurnEdges.GetTypeSize(), Checksum);
+}
+
+void FTrRoadNetwork::BuildTurnTables()
+{
+	const int32 NumEdges = EdgeEndNodes.Num();
+	TurnOffsets.Reset(NumEdges + 1);
+	TurnEdges.Reset(NumEdges);
+
+	for(int32 InEdge = 0; InEdge < NumEdges; ++InEdge)
+	{
+		TurnOffsets.Push(TurnEdges.Num());
+
+		const uint32 PreviousNode = EdgeStartNodes[InEdge];
+		const uint32 Node = EdgeEndNodes[InEdge];
+		const uint32 FirstEdge = NodeEdgeOffsets[Node];
+		const uint32 NumConnections = NodeEdgeOffsets[Node + 1] - FirstEdge;
+		if(NumConnections == 0)
+		{
+			continue;
+		}
+
+		// Approach nodes of imported intersections share their location with the approach of the opposite direction.
+		const auto LeadsBack = [this, PreviousNode](const uint32 OutEdge)
+		{
+			const uint32 NextNode = EdgeEndNodes[OutEdge];
+			return NextNode == PreviousNode || NodeLocations[NextNode].Equals(NodeLocations[PreviousNode]);
+		};
+
+		if(NumConnections == 2 && (LeadsBack(FirstEdge) || LeadsBack(FirstEdge + 1)))
+		{
+			TurnEdges.Push(LeadsBack(FirstEdge) ? FirstEdge + 1 : FirstEdge);
+			continue;
+		}
+
+		const uint32 FirstTurn = TurnEdges.Num();
+		for(uint32 OutEdge = FirstEdge; OutEdge < FirstEdge + NumConnections; ++OutEdge)
+		{
+			// Equivalent to an angle smaller than 90 degrees between both directions.
+			if(!LeadsBack(OutEdge) && EdgeDirections[InEdge].Dot(EdgeDirections[OutEdge]) > 0.0f)
+			{
+				TurnEdges.Push(OutEdge);
+			}
+		}
+
+		if(static_cast<uint32>(TurnEdges.Num()) == FirstTurn)
+		{
+			// Vehicles only turn back at dead ends.
+			uint32 OutEdge = FirstEdge;
+			while(OutEdge < FirstEdge + NumConnections && LeadsBack(OutEdge))
+			{
+				++OutEdge;
+			}
+			TurnEdges.Push(OutEdge < FirstEdge + NumConnections ? OutEdge : FirstEdge);
+		}
+	}
+	TurnOffsets.Push(TurnEdges.Num());
+}
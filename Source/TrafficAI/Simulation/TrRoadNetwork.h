@@ -0,0 +1,191 @@
+﻿// Copyright Anupam Sahu. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "TrTypes.h"
+
+class URpSpatialGraphComponent;
+
+/**
+ * @class FTrRoadNetwork
+ *
+ * An immutable, baked representation of the road graph in Compressed Sparse Row (CSR) form.
+ *
+ * Every connection of the spatial graph becomes a directed edge.
+ * Edges are sorted by their start node, so the outgoing edges of a node occupy a contiguous range of edge ids.
+ * Per-edge data (end points, lengths, unit directions and lane-offset segments) is stored in flat arrays indexed by edge id.
+ *
+ * An edge carries one or more lanes in its direction. Lane 0 is the innermost lane, LaneOffset away from the center line,
+ * and every following lane is LaneWidth further outwards. Lanes of all edges have contiguous ids, so that per-lane data
+ * can be stored in flat arrays too.
+ *
+ * For every edge, the network also stores the list of edges that a vehicle may turn into when it reaches the end of that edge.
+ * These turn tables replicate the rules previously evaluated at runtime by the simulation:
+ * - On a node with two connections, one of which leads back, a vehicle continues on the other one.
+ * - Otherwise, a vehicle may take any edge that points forward (less than 90 degrees from the incoming direction) and does not lead back.
+ * - If no edge points forward, the vehicle takes the first connection of the node that does not lead back, or turns back at a dead end.
+ * An edge leads back if it ends on the node the vehicle comes from, or on a node at the same location.
+ *
+ * Once built, all graph queries made by the simulation are plain index arithmetic.
+ */
+class TRAFFICAI_API FTrRoadNetwork
+{
+	friend class FTrBakedTrafficData;
+
+public:
+
+	/**
+	 * @brief Builds the network from the nodes of a spatial graph component.
+	 *
+	 * @param GraphComponent Spatial graph that defines the road network. Lane counts are read from it if it is a UTrSpatialGraphComponent.
+	 * @param NewLaneOffset Lateral offset of the lane followed by vehicles, relative to the center line of an edge.
+	 */
+	void Build(const URpSpatialGraphComponent* GraphComponent, const float NewLaneOffset);
+
+	/**
+	 * @brief Builds the network from an adjacency list in CSR form.
+	 *
+	 * @param InNodeLocations Location of each node.
+	 * @param InAdjacencyOffsets Offset of the first connection of each node in InAdjacency, followed by the total number of connections.
+	 * @param InAdjacency Indices of connected nodes.
+	 * @param NewLaneOffset Lateral offset of the lane followed by vehicles, relative to the center line of an edge.
+	 */
+	void Build(const TArray<FVector>& InNodeLocations, const TArray<uint32>& InAdjacencyOffsets, const TArray<uint32>& InAdjacency, const float NewLaneOffset);
+
+	// Releases all data held by the network.
+	void Reset();
+
+	/**
+	 * @brief Recomputes the lane-offset segments of all edges.
+	 * Does nothing if the network was already built with the same offset.
+	 */
+	void SetLaneOffset(const float NewLaneOffset);
+
+	float GetLaneOffset() const { return LaneOffset; }
+
+	// Sets the distance between the center lines of two neighbouring lanes.
+	void SetLaneWidth(const float NewLaneWidth) { LaneWidth = NewLaneWidth; }
+
+	float GetLaneWidth() const { return LaneWidth; }
+
+	/**
+	 * @brief Sets the number of lanes of every edge.
+	 * @param NewLaneCounts Number of lanes of each edge, at least one.
+	 */
+	void SetLaneCounts(const TArray<uint8>& NewLaneCounts);
+
+	bool IsEmpty() const { return NodeLocations.Num() == 0; }
+
+	int32 GetNumNodes() const { return NodeLocations.Num(); }
+
+	int32 GetNumEdges() const { return EdgeEndNodes.Num(); }
+
+	int32 GetNumTurns() const { return TurnEdges.Num(); }
+
+	// Returns the total number of lanes of all edges.
+	int32 GetNumLanes() const { return EdgeLaneOffsets.Num() > 0 ? EdgeLaneOffsets.Last() : 0; }
+
+	// Returns the largest number of lanes of an edge.
+	int32 GetMaxLaneCount() const { return MaxLaneCount; }
+
+	const FVector& GetNodeLocation(const uint32 Node) const { return NodeLocations[Node]; }
+
+	// Returns the id of the first edge that leaves Node. Outgoing edges of a node have contiguous ids.
+	uint32 GetFirstEdge(const uint32 Node) const { return NodeEdgeOffsets[Node]; }
+
+	// Returns the number of edges that leave Node.
+	uint32 GetNumOutgoingEdges(const uint32 Node) const { return NodeEdgeOffsets[Node + 1] - NodeEdgeOffsets[Node]; }
+
+	// Returns the ids of edges that a vehicle travelling on InEdge may turn into, at the end of InEdge.
+	TArrayView<const uint32> GetTurns(const uint32 InEdge) const
+	{
+		return TArrayView<const uint32>(TurnEdges.GetData() + TurnOffsets[InEdge], TurnOffsets[InEdge + 1] - TurnOffsets[InEdge]);
+	}
+
+	uint32 GetEdgeStartNode(const uint32 Edge) const { return EdgeStartNodes[Edge]; }
+
+	uint32 GetEdgeEndNode(const uint32 Edge) const { return EdgeEndNodes[Edge]; }
+
+	float GetEdgeLength(const uint32 Edge) const { return EdgeLengths[Edge]; }
+
+	// Returns the unit vector pointing from the start node to the end node of an edge.
+	const FVector& GetEdgeDirection(const uint32 Edge) const { return EdgeDirections[Edge]; }
+
+	// Returns the start of the lane followed by vehicles on an edge, offset from the center line.
+	const FVector& GetLaneStart(const uint32 Edge) const { return LaneStarts[Edge]; }
+
+	// Returns the end of the lane followed by vehicles on an edge, offset from the center line.
+	const FVector& GetLaneEnd(const uint32 Edge) const { return LaneEnds[Edge]; }
+
+	int32 GetLaneCount(const uint32 Edge) const { return EdgeLaneOffsets[Edge + 1] - EdgeLaneOffsets[Edge]; }
+
+	// Returns the id of the first lane of an edge. The lanes of an edge have contiguous ids.
+	uint32 GetFirstLane(const uint32 Edge) const { return EdgeLaneOffsets[Edge]; }
+
+	// Returns the start of a lane of an edge.
+	FVector GetLaneStart(const uint32 Edge, const int32 Lane) const { return LaneStarts[Edge] + LaneOutwards[Edge] * (Lane * LaneWidth); }
+
+	// Returns the end of a lane of an edge.
+	FVector GetLaneEnd(const uint32 Edge, const int32 Lane) const { return LaneEnds[Edge] + LaneOutwards[Edge] * (Lane * LaneWidth); }
+
+	// Returns the lane of an edge whose center line is the closest to Location.
+	int32 FindNearestLane(const uint32 Edge, const FVector& Location) const;
+
+	// Returns the id of the edge that connects Start to End, or INDEX_NONE if there is no such edge.
+	int32 FindEdge(const uint32 Start, const uint32 End) const;
+
+	// Returns the center line of an edge as a path.
+	FTrPath MakePath(const uint32 Edge) const;
+
+	/**
+	 * @brief Returns a checksum of the nodes, edges, edge lengths and turn tables, to detect data built for another network.
+	 * Lane offsets and lane counts are not included. Linear in the size of the network.
+	 */
+	uint32 GetChecksum() const;
+
+private:
+
+	// Builds the lane-offset segment of every edge. Requires edge data to be available.
+	void BuildLanes(const float NewLaneOffset);
+
+	// Builds the turn table of every edge. Requires edge data to be available.
+	void BuildTurnTables();
+
+private:
+
+	// Lateral offset of LaneStarts and LaneEnds from the center line of each edge.
+	float LaneOffset = 0.0f;
+	float LaneWidth = 350.0f;
+	int32 MaxLaneCount = 1;
+
+	TArray<FVector> NodeLocations;
+
+	// Id of the first outgoing edge of each node, followed by the total number of edges.
+	TArray<uint32> NodeEdgeOffsets;
+
+#pragma region Edges
+
+	TArray<uint32> EdgeStartNodes;
+	TArray<uint32> EdgeEndNodes;
+	TArray<float> EdgeLengths;
+	TArray<FVector> EdgeDirections;
+	TArray<FVector> LaneStarts;
+	TArray<FVector> LaneEnds;
+
+	// Unit vector pointing away from the center line, on the side of the lanes of each edge.
+	TArray<FVector> LaneOutwards;
+
+	// Id of the first lane of each edge, followed by the total number of lanes.
+	TArray<uint32> EdgeLaneOffsets;
+
+#pragma endregion
+
+#pragma region Turns
+
+	// Offset of the first turn of each edge in TurnEdges, followed by the total number of turns.
+	TArray<uint32> TurnOffsets;
+	TArray<uint32> TurnEdges;
+
+#pragma endregion
+};
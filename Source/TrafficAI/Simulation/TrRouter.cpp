@@ -0,0 +1,218 @@
+﻿// Copyright Anupam Sahu. All Rights Reserved.
+
+#include "TrRouter.h"
+#include "Algo/Reverse.h"
+#include "Async/ParallelFor.h"
+#include "TrContractionHierarchy.h"
+#include "TrRoadNetwork.h"
+
+namespace TrRouter
+{
+	// An edge waiting to be expanded by A*.
+	struct FOpenEdge
+	{
+		// Cost of the route up to the end of the edge, plus the estimated remaining cost.
+		float EstimatedCost;
+		float Cost;
+		uint32 Edge;
+
+		bool operator<(const FOpenEdge& Other) const { return EstimatedCost < Other.EstimatedCost; }
+	};
+
+	struct FVisitedEdge
+	{
+		float Cost;
+		uint32 PreviousEdge;
+	};
+}
+
+FTrRouter::FTrRouter() = default;
+
+FTrRouter::~FTrRouter()
+{
+	Reset();
+}
+
+void FTrRouter::Initialize(const FTrRoadNetwork* InNetwork, const FTrRoutingConfiguration& InConfiguration, const FTrContractionHierarchy* InHierarchy)
+{
+	check(InNetwork);
+	Reset();
+	Network = InNetwork;
+	Hierarchy = InHierarchy;
+	Configuration = InConfiguration;
+	Cache.Empty(Configuration.CacheSize);
+}
+
+void FTrRouter::Reset()
+{
+	if(BatchTask.IsValid())
+	{
+		BatchTask.Wait();
+		BatchTask = UE::Tasks::FTask();
+	}
+
+	Cache.Empty();
+	PendingRequests.Reset();
+	CachedRequests.Reset();
+	CachedRoutes.Reset();
+	BatchRequests.Reset();
+	BatchRoutes.Reset();
+	BatchSearchTimes.Reset();
+
+	NumRequests = NumCacheHits = NumCompleted = NumSearches = NumFailures = 0;
+	TotalLatency = MaxLatency = TotalSearchTime = 0.0;
+}
+
+void FTrRouter::RequestRoute(const uint32 RequesterId, const uint32 OriginEdge, const uint32 DestinationNode)
+{
+	++NumRequests;
+	const FRequest Request{RequesterId, OriginEdge, DestinationNode, FPlatformTime::Seconds()};
+	if(const FTrRoutePtr* CachedRoute = Cache.FindAndTouch({OriginEdge, DestinationNode}))
+	{
+		++NumCacheHits;
+		CachedRequests.Push(Request);
+		CachedRoutes.Push(*CachedRoute);
+		return;
+	}
+	PendingRequests.Push(Request);
+}
+
+void FTrRouter::Tick(TArray<FTrRouteResult>& OutResults)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(FTrRouter::Tick)
+
+	for(int Index = 0; Index < CachedRequests.Num(); ++Index)
+	{
+		CompleteRequest(CachedRequests[Index], CachedRoutes[Index], OutResults);
+	}
+	CachedRequests.Reset();
+	CachedRoutes.Reset();
+
+	if(BatchTask.IsValid())
+	{
+		if(!BatchTask.IsCompleted())
+		{
+			return;
+		}
+
+		for(int Index = 0; Index < BatchRequests.Num(); ++Index)
+		{
+			const FRequest& Request = BatchRequests[Index];
+			if(Configuration.CacheSize > 0)
+			{
+				Cache.Add({Request.OriginEdge, Request.DestinationNode}, BatchRoutes[Index]);
+			}
+			TotalSearchTime += BatchSearchTimes[Index];
+			CompleteRequest(Request, BatchRoutes[Index], OutResults);
+		}
+		NumSearches += BatchRequests.Num();
+
+		BatchRequests.Reset();
+		BatchTask = UE::Tasks::FTask();
+	}
+
+	if(PendingRequests.Num() == 0)
+	{
+		return;
+	}
+
+	const int32 NumBatchRequests = FMath::Min(PendingRequests.Num(), Configuration.BatchSize);
+	BatchRequests.Append(PendingRequests.GetData(), NumBatchRequests);
+	PendingRequests.RemoveAt(0, NumBatchRequests, false);
+	BatchRoutes.SetNum(NumBatchRequests);
+	BatchSearchTimes.SetNum(NumBatchRequests);
+
+	// The network, the requests and the routes of the batch are not touched by the game thread until the task has completed.
+	BatchTask = UE::Tasks::Launch(UE_SOURCE_LOCATION, [this, NumBatchRequests, MaxExpandedEdges = Configuration.MaxExpandedEdges]()
+	{
+		TRACE_CPUPROFILER_EVENT_SCOPE(FTrRouter::SearchBatch)
+		ParallelFor(NumBatchRequests, [this, MaxExpandedEdges](const int32 Index)
+		{
+			const double StartTime = FPlatformTime::Seconds();
+			const FRequest& Request = BatchRequests[Index];
+			if(!Hierarchy)
+			{
+				BatchRoutes[Index] = FindRoute(*Network, Request.OriginEdge, Request.DestinationNode, MaxExpandedEdges);
+			}
+			else if(TArray<uint32> Route; Hierarchy->FindRoute(Request.OriginEdge, Request.DestinationNode, Route))
+			{
+				BatchRoutes[Index] = MakeShared<const TArray<uint32>, ESPMode::ThreadSafe>(MoveTemp(Route));
+			}
+			else
+			{
+				BatchRoutes[Index] = nullptr;
+			}
+			BatchSearchTimes[Index] = FPlatformTime::Seconds() - StartTime;
+		});
+	});
+}
+
+void FTrRouter::CompleteRequest(const FRequest& Request, const FTrRoutePtr& Route, TArray<FTrRouteResult>& OutResults)
+{
+	const double Latency = FPlatformTime::Seconds() - Request.RequestTime;
+	TotalLatency += Latency;
+	MaxLatency = FMath::Max(MaxLatency, Latency);
+	++NumCompleted;
+	NumFailures += Route.IsValid() ? 0 : 1;
+
+	OutResults.Push({Request.RequesterId, Request.OriginEdge, Request.DestinationNode, Route});
+}
+
+FTrRoutePtr FTrRouter::FindRoute(const FTrRoadNetwork& Network, const uint32 OriginEdge, const uint32 DestinationNode, const int32 MaxExpandedEdges)
+{
+	using namespace TrRouter;
+
+	if(Network.GetEdgeEndNode(OriginEdge) == DestinationNode)
+	{
+		return MakeShared<const TArray<uint32>, ESPMode::ThreadSafe>();
+	}
+
+	const FVector& Destination = Network.GetNodeLocation(DestinationNode);
+	auto EstimateCost = [&Network, &Destination](const uint32 Edge)
+	{
+		return static_cast<float>(FVector::Distance(Network.GetNodeLocation(Network.GetEdgeEndNode(Edge)), Destination));
+	};
+
+	TMap<uint32, FVisitedEdge> VisitedEdges;
+	TArray<FOpenEdge> OpenEdges;
+	VisitedEdges.Add(OriginEdge, {0.0f, OriginEdge});
+	OpenEdges.HeapPush({EstimateCost(OriginEdge), 0.0f, OriginEdge});
+
+	int32 NumExpandedEdges = 0;
+	while(OpenEdges.Num() > 0 && NumExpandedEdges < MaxExpandedEdges)
+	{
+		FOpenEdge Current;
+		OpenEdges.HeapPop(Current, false);
+
+		// Edges are pushed again when a cheaper route is found, older entries are skipped.
+		if(Current.Cost > VisitedEdges[Current.Edge].Cost)
+		{
+			continue;
+		}
+		++NumExpandedEdges;
+
+		if(Network.GetEdgeEndNode(Current.Edge) == DestinationNode)
+		{
+			TArray<uint32> Route;
+			for(uint32 Edge = Current.Edge; Edge != OriginEdge; Edge = VisitedEdges[Edge].PreviousEdge)
+			{
+				Route.Push(Edge);
+			}
+			Algo::Reverse(Route);
+			return MakeShared<const TArray<uint32>, ESPMode::ThreadSafe>(MoveTemp(Route));
+		}
+
+		for(const uint32 Turn : Network.GetTurns(Current.Edge))
+		{
+			const float Cost = Current.Cost + Network.GetEdgeLength(Turn);
+			const FVisitedEdge* VisitedEdge = VisitedEdges.Find(Turn);
+			if(!VisitedEdge || Cost < VisitedEdge->Cost)
+			{
+				VisitedEdges.Add(Turn, {Cost, Current.Edge});
+				OpenEdges.HeapPush({Cost + EstimateCost(Turn), Cost, Turn});
+			}
+		}
+	}
+
+	return nullptr;
+}
@@ -0,0 +1,157 @@
+﻿// Copyright Anupam Sahu. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/LruCache.h"
+#include "Tasks/Task.h"
+#include "TrSimulationData.h"
+
+class FTrRoadNetwork;
+struct FTrContractionHierarchy;
+
+// A route is the sequence of edges that follow the origin edge, up to the edge that ends at the destination node.
+using FTrRoutePtr = TSharedPtr<const TArray<uint32>, ESPMode::ThreadSafe>;
+
+// A route computed for a vehicle.
+struct FTrRouteResult
+{
+	// Identifier passed with the request, the simulation uses the slot of the vehicle.
+	uint32 RequesterId;
+	uint32 OriginEdge;
+	uint32 DestinationNode;
+
+	// Null if the destination could not be reached.
+	FTrRoutePtr Route;
+};
+
+// Progress of a vehicle along its route.
+struct FTrVehicleRoute
+{
+	FTrRoutePtr Edges;
+	int32 Cursor = 0;
+	uint32 DestinationNode = 0;
+	bool bIsPending = false;
+
+	bool HasNextEdge() const { return Edges.IsValid() && Cursor < Edges->Num(); }
+};
+
+/**
+ * @class FTrRouter
+ *
+ * Computes routes between an edge of the road network and a destination node.
+ *
+ * Requests are queued on the game thread and dispatched in batches to worker threads, where each route is searched with A*
+ * over the edges of the network, following their turn tables, so routes only contain turns that vehicles are allowed to take.
+ * Completed routes are collected on the game thread at the next tick, so route planning never stalls the simulation.
+ *
+ * When a contraction hierarchy is available for the network, it is used instead of A*.
+ * An LRU cache keyed by (origin edge, destination node) returns repeated queries without a search.
+ * Routes are immutable and shared between the cache and all vehicles following them.
+ */
+class TRAFFICAI_API FTrRouter
+{
+public:
+
+	FTrRouter();
+
+	~FTrRouter();
+
+	/**
+	 * @brief Initializes the router. Any request in flight is discarded.
+	 *
+	 * @param InNetwork Road network to plan routes on. It must outlive the router, and must not change while it is in use.
+	 * @param InConfiguration Routing settings.
+	 * @param InHierarchy Optional contraction hierarchy built for InNetwork, with the same lifetime requirements.
+	 */
+	void Initialize(const FTrRoadNetwork* InNetwork, const FTrRoutingConfiguration& InConfiguration, const FTrContractionHierarchy* InHierarchy = nullptr);
+
+	// Waits for the batch in flight, and clears all requests, cached routes and stats.
+	void Reset();
+
+	// Queues a route request. Cached routes are returned at the next call to Tick.
+	void RequestRoute(const uint32 RequesterId, const uint32 OriginEdge, const uint32 DestinationNode);
+
+	/**
+	 * @brief Collects completed routes, and dispatches the next batch of requests to worker threads.
+	 * Must be called on the game thread.
+	 */
+	void Tick(TArray<FTrRouteResult>& OutResults);
+
+	/**
+	 * @brief Searches the shortest route from the end of OriginEdge to DestinationNode, with A*.
+	 * Edge lengths are used as costs, and the straight line distance to the destination as heuristic. Thread safe.
+	 *
+	 * @return The route, or null if the destination is not reachable within MaxExpandedEdges.
+	 */
+	static FTrRoutePtr FindRoute(const FTrRoadNetwork& Network, const uint32 OriginEdge, const uint32 DestinationNode, const int32 MaxExpandedEdges);
+
+#pragma region Metrics
+
+	// Ratio of requests that were answered by the cache.
+	float GetCacheHitRate() const { return NumRequests > 0 ? static_cast<float>(NumCacheHits) / NumRequests : 0.0f; }
+
+	// Average time between a request and its result, in milliseconds.
+	double GetAverageLatency() const { return NumCompleted > 0 ? TotalLatency / NumCompleted * 1000.0 : 0.0; }
+
+	// Longest time between a request and its result, in milliseconds.
+	double GetMaxLatency() const { return MaxLatency * 1000.0; }
+
+	// Average time spent searching a route on a worker thread, in milliseconds.
+	double GetAverageSearchTime() const { return NumSearches > 0 ? TotalSearchTime / NumSearches * 1000.0 : 0.0; }
+
+	uint64 GetNumRequests() const { return NumRequests; }
+
+	uint64 GetNumFailures() const { return NumFailures; }
+
+	int32 GetNumPendingRequests() const { return PendingRequests.Num() + BatchRequests.Num(); }
+
+#pragma endregion
+
+private:
+
+	struct FRequest
+	{
+		uint32 RequesterId;
+		uint32 OriginEdge;
+		uint32 DestinationNode;
+		double RequestTime;
+	};
+
+	// Records the latency of a request that has been answered.
+	void CompleteRequest(const FRequest& Request, const FTrRoutePtr& Route, TArray<FTrRouteResult>& OutResults);
+
+private:
+
+	const FTrRoadNetwork* Network = nullptr;
+	const FTrContractionHierarchy* Hierarchy = nullptr;
+	FTrRoutingConfiguration Configuration;
+
+	TLruCache<TPair<uint32, uint32>, FTrRoutePtr> Cache;
+
+	// Requests waiting for the next batch.
+	TArray<FRequest> PendingRequests;
+
+	// Requests answered by the cache, returned at the next tick.
+	TArray<FRequest> CachedRequests;
+	TArray<FTrRoutePtr> CachedRoutes;
+
+	// Requests of the batch in flight, and their routes written by worker threads.
+	TArray<FRequest> BatchRequests;
+	TArray<FTrRoutePtr> BatchRoutes;
+	TArray<double> BatchSearchTimes;
+	UE::Tasks::FTask BatchTask;
+
+#pragma region Metrics
+
+	uint64 NumRequests = 0;
+	uint64 NumCacheHits = 0;
+	uint64 NumCompleted = 0;
+	uint64 NumSearches = 0;
+	uint64 NumFailures = 0;
+	double TotalLatency = 0.0;
+	double MaxLatency = 0.0;
+	double TotalSearchTime = 0.0;
+
+#pragma endregion
+};
@@ -0,0 +1,214 @@
+﻿// Copyright Anupam Sahu. All Rights Reserved.
+
+#include "TrSegmentTree.h"
+#include "TrRoadNetwork.h"
+
+constexpr int32 MAX_LEAF_SEGMENTS = 4; // Leaves are not split below this number of segments.
+constexpr int32 MAX_TREE_DEPTH = 64; // Size of the traversal stack. Median splits keep the depth logarithmic.
+
+void FTrSegmentTree::Build(const FTrRoadNetwork& Network)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(FTrSegmentTree::Build)
+
+	Reset();
+	const int32 NumEdges = Network.GetNumEdges();
+	if(NumEdges == 0)
+	{
+		return;
+	}
+
+	TArray<uint32> Edges;
+	TArray<FVector> Centers;
+	Edges.SetNumUninitialized(NumEdges);
+	Centers.SetNumUninitialized(NumEdges);
+	for(int32 Edge = 0; Edge < NumEdges; ++Edge)
+	{
+		Edges[Edge] = Edge;
+		Centers[Edge] = (Network.GetLaneStart(Edge) + Network.GetLaneEnd(Edge)) * 0.5f;
+	}
+
+	Nodes.Reserve(2 * NumEdges / MAX_LEAF_SEGMENTS + 1);
+	BuildNode(Edges, Centers, 0, NumEdges, Network);
+
+	SegmentEdges = MoveTemp(Edges);
+	SegmentStarts.SetNumUninitialized(NumEdges);
+	SegmentEnds.SetNumUninitialized(NumEdges);
+	for(int32 Segment = 0; Segment < NumEdges; ++Segment)
+	{
+		SegmentStarts[Segment] = Network.GetLaneStart(SegmentEdges[Segment]);
+		SegmentEnds[Segment] = Network.GetLaneEnd(SegmentEdges[Segment]);
+	}
+}
+
+void FTrSegmentTree::Reset()
+{
+	Nodes.Reset();
+	SegmentEdges.Reset();
+	SegmentStarts.Reset();
+	SegmentEnds.Reset();
+}
+
+int32 FTrSegmentTree::BuildNode(TArray<uint32>& Edges, TArray<FVector>& Centers, const int32 First, const int32 Num, const FTrRoadNetwork& Network)
+{
+	FBox Bounds(ForceInit);
+	FBox CenterBounds(ForceInit);
+	for(int32 Index = First; Index < First + Num; ++Index)
+	{
+		Bounds += Network.GetLaneStart(Edges[Index]);
+		Bounds += Network.GetLaneEnd(Edges[Index]);
+		CenterBounds += Centers[Index];
+	}
+
+	const int32 NodeIndex = Nodes.Add({Bounds, First, Num});
+	if(Num <= MAX_LEAF_SEGMENTS)
+	{
+		return NodeIndex;
+	}
+
+	// Partition around the median center on the longest axis, segments and centers are swapped together.
+	const FVector Extent = CenterBounds.GetExtent();
+	const int32 Axis = Extent.X >= Extent.Y && Extent.X >= Extent.Z ? 0 : (Extent.Y >= Extent.Z ? 1 : 2);
+	const int32 Middle = First + Num / 2;
+	int32 Begin = First;
+	int32 End = First + Num - 1;
+	while(Begin < End)
+	{
+		const double Pivot = Centers[(Begin + End) / 2][Axis];
+		int32 Left = Begin;
+		int32 Right = End;
+		while(Left <= Right)
+		{
+			while(Centers[Left][Axis] < Pivot)
+			{
+				++Left;
+			}
+			while(Centers[Right][Axis] > Pivot)
+			{
+				--Right;
+			}
+			if(Left <= Right)
+			{
+				Swap(Centers[Left], Centers[Right]);
+				Swap(Edges[Left], Edges[Right]);
+				++Left;
+				--Right;
+			}
+		}
+
+		if(Middle <= Right)
+		{
+			End = Right;
+		}
+		else if(Middle >= Left)
+		{
+			Begin = Left;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	BuildNode(Edges, Centers, First, Middle - First, Network);
+	const int32 SecondChild = BuildNode(Edges, Centers, Middle, First + Num - Middle, Network);
+	Nodes[NodeIndex].First = SecondChild;
+	Nodes[NodeIndex].NumSegments = 0;
+	return NodeIndex;
+}
+
+FVector FTrSegmentTree::ProjectOnSegment(const FVector& Point, const int32 Segment) const
+{
+	return FMath::ClosestPointOnSegment(Point, SegmentStarts[Segment], SegmentEnds[Segment]);
+}
+
+FTrSegmentTree::FHit FTrSegmentTree::FindNearest(const FVector& Point, TFunctionRef<bool(uint32)> Filter, const float MaxDistance) const
+{
+	FHit Hit;
+	Hit.DistanceSquared = MaxDistance < TNumericLimits<float>::Max() ? FMath::Square(MaxDistance) : MaxDistance;
+	if(IsEmpty())
+	{
+		return Hit;
+	}
+
+	int32 Stack[MAX_TREE_DEPTH];
+	int32 StackSize = 0;
+	Stack[StackSize++] = 0;
+	while(StackSize > 0)
+	{
+		const int32 NodeIndex = Stack[--StackSize];
+		const FNode& Node = Nodes[NodeIndex];
+		if(Node.Bounds.ComputeSquaredDistanceToPoint(Point) >= Hit.DistanceSquared)
+		{
+			continue;
+		}
+
+		if(Node.NumSegments > 0)
+		{
+			for(int32 Segment = Node.First; Segment < Node.First + Node.NumSegments; ++Segment)
+			{
+				const FVector Projection = ProjectOnSegment(Point, Segment);
+				const float DistanceSquared = FVector::DistSquared(Point, Projection);
+				if(DistanceSquared < Hit.DistanceSquared && Filter(SegmentEdges[Segment]))
+				{
+					Hit.Edge = SegmentEdges[Segment];
+					Hit.Projection = Projection;
+					Hit.DistanceSquared = DistanceSquared;
+				}
+			}
+			continue;
+		}
+
+		// Visit the closest child first, so that the other one is more likely to be culled.
+		const int32 FirstChild = NodeIndex + 1;
+		const int32 SecondChild = Node.First;
+		const bool bIsFirstCloser = Nodes[FirstChild].Bounds.ComputeSquaredDistanceToPoint(Point) <= Nodes[SecondChild].Bounds.ComputeSquaredDistanceToPoint(Point);
+		if(StackSize + 2 <= MAX_TREE_DEPTH)
+		{
+			Stack[StackSize++] = bIsFirstCloser ? SecondChild : FirstChild;
+			Stack[StackSize++] = bIsFirstCloser ? FirstChild : SecondChild;
+		}
+	}
+
+	Hit.DistanceSquared = Hit.Edge != INDEX_NONE ? Hit.DistanceSquared : TNumericLimits<float>::Max();
+	return Hit;
+}
+
+void FTrSegmentTree::FindInRadius(const FVector& Point, const float Radius, TArray<uint32>& OutEdges) const
+{
+	if(IsEmpty())
+	{
+		return;
+	}
+
+	const float RadiusSquared = FMath::Square(Radius);
+	int32 Stack[MAX_TREE_DEPTH];
+	int32 StackSize = 0;
+	Stack[StackSize++] = 0;
+	while(StackSize > 0)
+	{
+		const int32 NodeIndex = Stack[--StackSize];
+		const FNode& Node = Nodes[NodeIndex];
+		if(Node.Bounds.ComputeSquaredDistanceToPoint(Point) > RadiusSquared)
+		{
+			continue;
+		}
+
+		if(Node.NumSegments > 0)
+		{
+			for(int32 Segment = Node.First; Segment < Node.First + Node.NumSegments; ++Segment)
+			{
+				if(FVector::DistSquared(Point, ProjectOnSegment(Point, Segment)) <= RadiusSquared)
+				{
+					OutEdges.Push(SegmentEdges[Segment]);
+				}
+			}
+			continue;
+		}
+
+		if(StackSize + 2 <= MAX_TREE_DEPTH)
+		{
+			Stack[StackSize++] = NodeIndex + 1;
+			Stack[StackSize++] = Node.First;
+		}
+	}
+}
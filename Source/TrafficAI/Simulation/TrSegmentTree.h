@@ -0,0 +1,80 @@
+﻿// Copyright Anupam Sahu. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class FTrRoadNetwork;
+
+/**
+ * @class FTrSegmentTree
+ *
+ * A bounding volume hierarchy over the lane segments of a road network, that answers nearest segment queries in logarithmic time.
+ *
+ * Nodes are stored in a flat array in depth first order, so the first child of an inner node directly follows it.
+ * Segments are reordered so that every leaf references a contiguous range of segments.
+ * The tree is built by splitting segments at the median of the longest axis of their centers.
+ */
+class TRAFFICAI_API FTrSegmentTree
+{
+public:
+
+	// Result of a nearest segment query.
+	struct FHit
+	{
+		int32 Edge = INDEX_NONE;
+		FVector Projection = FVector::ZeroVector;
+		float DistanceSquared = TNumericLimits<float>::Max();
+	};
+
+	// Builds the tree from the lane segment of every edge of the network.
+	void Build(const FTrRoadNetwork& Network);
+
+	void Reset();
+
+	bool IsEmpty() const { return Nodes.Num() == 0; }
+
+	/**
+	 * @brief Finds the segment closest to a point.
+	 *
+	 * @param Point Query location.
+	 * @param Filter Returns false for edges that must be ignored.
+	 * @param MaxDistance Segments further than this distance are ignored.
+	 * @return The closest segment, with an Edge of INDEX_NONE if no segment matches.
+	 */
+	FHit FindNearest(const FVector& Point, TFunctionRef<bool(uint32)> Filter, const float MaxDistance = TNumericLimits<float>::Max()) const;
+
+	// Finds the segment closest to a point.
+	FHit FindNearest(const FVector& Point) const { return FindNearest(Point, [](uint32) { return true; }); }
+
+	// Appends the edges whose segments are within Radius of a point.
+	void FindInRadius(const FVector& Point, const float Radius, TArray<uint32>& OutEdges) const;
+
+private:
+
+	// Recursively builds the subtree of the segments in [First, First + Num).
+	int32 BuildNode(TArray<uint32>& Edges, TArray<FVector>& Centers, const int32 First, const int32 Num, const FTrRoadNetwork& Network);
+
+	// Returns the closest point to Point on a segment.
+	FVector ProjectOnSegment(const FVector& Point, const int32 Segment) const;
+
+private:
+
+	struct FNode
+	{
+		FBox Bounds;
+
+		// Second child of an inner node, or first segment of a leaf.
+		int32 First;
+
+		// Number of segments of a leaf, zero for inner nodes.
+		int32 NumSegments;
+	};
+
+	TArray<FNode> Nodes;
+
+	// Segments in tree order.
+	TArray<uint32> SegmentEdges;
+	TArray<FVector> SegmentStarts;
+	TArray<FVector> SegmentEnds;
+};
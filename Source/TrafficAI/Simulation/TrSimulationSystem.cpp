@@ -3,10 +3,28 @@
 #include "TrSimulationSystem.h"
 #include "TrSimulationData.h"
 #include "RpSpatialGraphComponent.h"
+#include "Algo/Sort.h"
+#include "Async/ParallelFor.h"
+#include "GameFramework/PlayerController.h"
+#include "WorldPartition/WorldPartition.h"
 
 #define DEBUG_LIFETIME -1
 constexpr float AMBER_DURATION = 5.0f; // This duration is used for the timer that switches the signal state from green to amber.
 constexpr float DETECTION_RANGE_SCALE = 2.0f; // Values smaller than 2 would result in failure to detect other vehicles properly.
+constexpr float REATTACH_DISTANCE = 2000.0f; // Lanes heading in the direction of a reattached vehicle are preferred within this distance.
+constexpr float LANE_CHANGE_END_DISTANCE = 1000.0f; // Vehicles do not change lane this close to the end of their edge, where lanes are remapped.
+
+// Acceleration given by the Intelligent Driver Model, clamped to the limits of the archetype.
+static float ComputeIDMAcceleration(const FTrArchetypeConstants& Constants, const float Speed, const float RelativeSpeed, const float Gap, const float MinimumGap)
+{
+	const float FreeRoadTerm = Constants.MaximumAcceleration * (1 - FMath::Pow(Speed * Constants.InverseDesiredSpeed, Constants.AccelerationExponent));
+
+	const float DecelerationTerm = Speed * RelativeSpeed * Constants.InverseBrakingTerm;
+	const float GapTerm = (MinimumGap + Constants.DesiredTimeHeadWay * Speed + DecelerationTerm) / Gap;
+	const float InteractionTerm = -Constants.MaximumAcceleration * FMath::Square(GapTerm);
+
+	return FMath::Clamp(FreeRoadTerm + InteractionTerm, -Constants.MaximumDeceleration, Constants.MaximumAcceleration);
+}
 
 static bool GAIDebug = false;
 static FAutoConsoleCommand CComToggleAIDebug
@@ -44,64 +62,701 @@ static FAutoConsoleCommand CComToggleGridDebug
 	ECVF_Default
 );
 
+static FAutoConsoleCommandWithWorld CComPrintSignalStats
+(
+	TEXT("Traffic.SignalStats"),
+	TEXT("Prints the throughput (vehicles served per minute) and current queue length of every intersection."),
+	FConsoleCommandWithWorldDelegate::CreateLambda([](const UWorld* World)
+	{
+		const UTrSimulationSystem* SimulationSystem = World ? World->GetSubsystem<UTrSimulationSystem>() : nullptr;
+		if(!SimulationSystem)
+		{
+			return;
+		}
+		
+		const FTrIntersectionManager& IntersectionManager = SimulationSystem->GetIntersectionManager();
+		for(int Index = 0; Index < IntersectionManager.GetNumIntersections(); ++Index)
+		{
+			UE_LOG(LogTrafficAI, Display, TEXT("Intersection %d : %.2f vehicles/min, %u served, %u queued"),
+				Index, IntersectionManager.GetThroughput(Index), IntersectionManager.GetNumServedVehicles(Index), IntersectionManager.GetQueueLength(Index));
+		}
+	}),
+	ECVF_Default
+);
+
+static FAutoConsoleCommandWithWorld CComPrintRouteStats
+(
+	TEXT("Traffic.RouteStats"),
+	TEXT("Prints the route cache hit rate, and the latency of route requests."),
+	FConsoleCommandWithWorldDelegate::CreateLambda([](const UWorld* World)
+	{
+		const UTrSimulationSystem* SimulationSystem = World ? World->GetSubsystem<UTrSimulationSystem>() : nullptr;
+		if(!SimulationSystem)
+		{
+			return;
+		}
+
+		const FTrRouter& Router = SimulationSystem->GetRouter();
+		UE_LOG(LogTrafficAI, Display, TEXT("Routes : %llu requested, %d pending, %llu failed, cache hit rate %.1f%%"),
+			Router.GetNumRequests(), Router.GetNumPendingRequests(), Router.GetNumFailures(), Router.GetCacheHitRate() * 100.0f);
+		UE_LOG(LogTrafficAI, Display, TEXT("Route latency : average %.2f ms, max %.2f ms, average search %.3f ms"),
+			Router.GetAverageLatency(), Router.GetMaxLatency(), Router.GetAverageSearchTime());
+	}),
+	ECVF_Default
+);
+
+static FAutoConsoleCommandWithWorldAndArgs CComRouteBenchmark
+(
+	TEXT("Traffic.RouteBenchmark"),
+	TEXT("Compares uncached A* searches with contraction hierarchy queries, on random routes of the current network. Usage : Traffic.RouteBenchmark [NumQueries]"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, const UWorld* World)
+	{
+		const UTrSimulationSystem* SimulationSystem = World ? World->GetSubsystem<UTrSimulationSystem>() : nullptr;
+		if(!SimulationSystem || SimulationSystem->GetNetwork().IsEmpty())
+		{
+			return;
+		}
+
+		const FTrRoadNetwork& Network = SimulationSystem->GetNetwork();
+		const FTrContractionHierarchy& Hierarchy = SimulationSystem->GetContractionHierarchy();
+		const int32 NumQueries = Args.Num() > 0 ? FMath::Max(1, FCString::Atoi(*Args[0])) : 1000;
+
+		// A fixed seed makes results comparable between runs.
+		FRandomStream RandomStream(NumQueries);
+		TArray<TPair<uint32, uint32>> Queries;
+		for(int32 Index = 0; Index < NumQueries; ++Index)
+		{
+			const uint32 OriginEdge = RandomStream.RandRange(0, Network.GetNumEdges() - 1);
+			const uint32 DestinationNode = Network.GetEdgeEndNode(RandomStream.RandRange(0, Network.GetNumEdges() - 1));
+			Queries.Push({OriginEdge, DestinationNode});
+		}
+
+		auto GetRouteLength = [&Network](const TArray<uint32>& Route)
+		{
+			double Length = 0.0;
+			for(const uint32 Edge : Route)
+			{
+				Length += Network.GetEdgeLength(Edge);
+			}
+			return Length;
+		};
+
+		TArray<double> SearchLengths;
+		double StartTime = FPlatformTime::Seconds();
+		for(const TPair<uint32, uint32>& Query : Queries)
+		{
+			const FTrRoutePtr Route = FTrRouter::FindRoute(Network, Query.Key, Query.Value, MAX_int32);
+			SearchLengths.Push(Route.IsValid() ? GetRouteLength(*Route) : -1.0);
+		}
+		const double SearchTime = (FPlatformTime::Seconds() - StartTime) / NumQueries;
+		UE_LOG(LogTrafficAI, Display, TEXT("A* : %.2f us per query, %d edges"), SearchTime * 1e6, Network.GetNumEdges());
+
+		if(!Hierarchy.IsValidFor(Network))
+		{
+			UE_LOG(LogTrafficAI, Display, TEXT("No contraction hierarchy is available for this network."));
+			return;
+		}
+
+		int32 NumMismatches = 0;
+		TArray<uint32> Route;
+		StartTime = FPlatformTime::Seconds();
+		for(int32 Index = 0; Index < NumQueries; ++Index)
+		{
+			const double Length = Hierarchy.FindRoute(Queries[Index].Key, Queries[Index].Value, Route) ? GetRouteLength(Route) : -1.0;
+			NumMismatches += FMath::IsNearlyEqual(Length, SearchLengths[Index], FMath::Max(1.0, Length * 1e-4)) ? 0 : 1;
+		}
+		const double HierarchyTime = (FPlatformTime::Seconds() - StartTime) / NumQueries;
+		UE_LOG(LogTrafficAI, Display, TEXT("Contraction hierarchy : %.2f us per query, %.1fx faster, %d shortcuts, %d routes differ from A*"),
+			HierarchyTime * 1e6, SearchTime / FMath::Max(HierarchyTime, 1e-9), Hierarchy.GetNumShortcuts(), NumMismatches);
+	}),
+	ECVF_Default
+);
+
+static FAutoConsoleCommandWithWorld CComPrintRegionStats
+(
+	TEXT("Traffic.RegionStats"),
+	TEXT("Prints the number of loaded traffic regions, and the number of simulated and dormant vehicles."),
+	FConsoleCommandWithWorldDelegate::CreateLambda([](const UWorld* World)
+	{
+		const UTrSimulationSystem* SimulationSystem = World ? World->GetSubsystem<UTrSimulationSystem>() : nullptr;
+		if(!SimulationSystem)
+		{
+			return;
+		}
+
+		const FTrRegionGrid& Regions = SimulationSystem->GetRegions();
+		int32 NumLoadedRegions = 0;
+		int32 NumDormantVehicles = 0;
+		for(int32 Region = 0; Region < Regions.GetNumRegions(); ++Region)
+		{
+			NumLoadedRegions += Regions.IsLoaded(Region) ? 1 : 0;
+			NumDormantVehicles += Regions.GetRegion(Region).DormantVehicles.Num();
+		}
+		UE_LOG(LogTrafficAI, Display, TEXT("Regions : %d of %d loaded, %d vehicles simulated, %d dormant"),
+			NumLoadedRegions, Regions.GetNumRegions(), SimulationSystem->GetNumVehicles(), NumDormantVehicles);
+	}),
+	ECVF_Default
+);
+
+static FAutoConsoleCommandWithWorld CComPrintGroundingStats
+(
+	TEXT("Traffic.GroundingStats"),
+	TEXT("Prints the size of the road height field, and the average time spent grounding 10 000 vehicles."),
+	FConsoleCommandWithWorldDelegate::CreateLambda([](const UWorld* World)
+	{
+		const UTrSimulationSystem* SimulationSystem = World ? World->GetSubsystem<UTrSimulationSystem>() : nullptr;
+		if(!SimulationSystem)
+		{
+			return;
+		}
+
+		const FTrRoadHeightField& HeightField = SimulationSystem->GetHeightField();
+		UE_LOG(LogTrafficAI, Display, TEXT("Grounding : %d samples (%.2f MB), %.3f ms per 10k vehicles"),
+			HeightField.GetNumSamples(), HeightField.GetNumSamples() * (sizeof(float) + sizeof(FVector3f)) / (1024.0 * 1024.0), SimulationSystem->GetGroundingCost());
+	}),
+	ECVF_Default
+);
+
 void UTrSimulationSystem::Initialize
 (
 	const UTrSimulationConfiguration* SimData,
 	const UTrSpatialGraphComponent* GraphComponent,
-	const TArray<FTransform>& InitialTransforms,
-	const TArray<FTrVehiclePathTransform>& TrafficVehicleStarts
+	const int32 NewCapacity
 )
 {
-	NumEntities = InitialTransforms.Num();
+	check(SimData)
+	check(GraphComponent)
+
+	FTrRoadNetwork NewNetwork;
+	NewNetwork.Build(GraphComponent, SimData->PathFollowingConfig.PathFollowOffset);
+	Initialize(SimData, MoveTemp(NewNetwork), GraphComponent->GetIntersections(), NewCapacity);
+}
 
+void UTrSimulationSystem::Initialize
+(
+	const UTrSimulationConfiguration* SimData,
+	FTrRoadNetwork&& NewNetwork,
+	const TArray<FTrIntersection>& Intersections,
+	const int32 NewCapacity
+)
+{
 	check(SimData)
 	VehicleConfig = SimData->VehicleConfig;
-	PathFollowingConfig = SimData->PathFollowingConfig;
 
-	PathTransforms = TrafficVehicleStarts;
-	check(PathTransforms.Num() > 0);
+	ArchetypeNames.Reset();
+	Archetypes.Reset();
+	ArchetypeNames.Add(NAME_None);
+	Archetypes.Emplace(VehicleConfig);
+	for(const FTrVehicleArchetype& Archetype : SimData->Archetypes)
+	{
+		ArchetypeNames.Add(Archetype.Name);
+		Archetypes.Emplace(Archetype.Dynamics);
+	}
+	ChunkStarts.Init(0, Archetypes.Num());
+	ChunkCounts.Init(0, Archetypes.Num());
+	PathFollowingConfig = SimData->PathFollowingConfig;
+	LaneChangeConfig = SimData->LaneChangeConfig;
 
-	Nodes = GraphComponent->GetNodes();
+	// Baked networks may have been built with a different lane offset.
+	Network = MoveTemp(NewNetwork);
+	Network.SetLaneOffset(PathFollowingConfig.PathFollowOffset);
+	Network.SetLaneWidth(PathFollowingConfig.LaneWidth);
 	
-	check(Nodes.Num() > 0);
-	for (int Index = 0; Index < NumEntities; ++Index)
+	check(!Network.IsEmpty());
+	SegmentTree.Build(Network);
+
+	// All regions start loaded, so that vehicles can be spawned anywhere before the first streaming update.
+	RegionConfig = SimData->RegionConfig;
+	BoundaryQueue.Reset();
+	RegionStreamingTimer = 0.0f;
+	if(RegionConfig.bEnableRegions)
 	{
-		Positions.Push(InitialTransforms[Index].GetLocation());
-		Velocities.Push(FVector::Zero());
-		Headings.Push(InitialTransforms[Index].GetRotation().GetForwardVector());
-		LeadingVehicleIndices.Push(-1);
-		PathFollowingStates.Push(false);
-		
-		FVector NearestProjectionPoint;
-		FindNearestPath(Index, NearestProjectionPoint);
-		Goals.Push(NearestProjectionPoint);
-		
+		Regions.Build(Network, RegionConfig.CellSize);
+	}
+	else
+	{
+		Regions.Reset();
+	}
+
+	GroundingConfig = SimData->GroundingConfig;
+	TotalGroundingTime = 0.0;
+	NumGroundedVehicles = 0;
+	if(!GroundingConfig.bEnableGrounding)
+	{
+		HeightField.Reset();
+	}
+	else if(!HeightField.IsValidFor(Network))
+	{
+		UE_LOG(LogTrafficAI, Warning, TEXT("The road height field does not match the road network and is ignored, rebake the traffic data."));
+		HeightField.Reset();
+	}
+
+	// Storage is allocated once, so that vehicles can be added and removed every frame without reallocation.
+	NumEntities = 0;
+	NumGridEntities = 0;
+	Capacity = FMath::Max(0, NewCapacity);
+	Positions.Empty(Capacity);
+	Velocities.Empty(Capacity);
+	Headings.Empty(Capacity);
+	Goals.Empty(Capacity);
+	PathTransforms.Empty(Capacity);
+	PathEdges.Empty(Capacity);
+	Routes.Empty(Capacity);
+	LeadingVehicleIndices.Empty(Capacity);
+	PathFollowingStates.Empty(Capacity);
+	DetachedVehicles.Empty(Capacity);
+	VehicleSlots.Empty(Capacity);
+	SlotIndices.Empty(Capacity);
+	SlotGenerations.Empty(Capacity);
+	FreeSlots.Empty(Capacity);
+	VehicleRegions.Empty(Capacity);
+	GroundNormals.Empty(Capacity);
+	SimulationTiers.Empty(Capacity);
+	VehicleLanes.Empty(Capacity);
+	LaneChangeTimers.Empty(Capacity);
+	Accelerations.Empty(Capacity);
 #if !UE_BUILD_SHIPPING
-		DebugColors.Push(FColor::MakeRandomColor());
+	DebugColors.Empty(Capacity);
 #endif
+
+	IntersectionConfig = SimData->IntersectionConfig;
+	IntersectionManager.Initialize(Intersections, Network.GetNumNodes(), IntersectionConfig);
+
+	RoutingConfig = SimData->RoutingConfig;
+	if(RoutingConfig.bEnableRouting)
+	{
+		if(!ContractionHierarchy.IsEmpty() && !ContractionHierarchy.IsValidFor(Network))
+		{
+			UE_LOG(LogTrafficAI, Warning, TEXT("The contraction hierarchy does not match the road network and is ignored, rebuild it."));
+			ContractionHierarchy.Reset();
+		}
+		Router.Initialize(&Network, RoutingConfig, ContractionHierarchy.IsEmpty() ? nullptr : &ContractionHierarchy);
 	}
 
-	IntersectionManager.Initialize(GraphComponent->GetIntersections());
-
-	const float SignalSwitchTime = SimData->PathFollowingConfig.SignalSwitchInterval;
-	GetWorld()->GetTimerManager().SetTimer
-	(
-		IntersectionTimerHandle,
-		FTimerDelegate::CreateRaw(&IntersectionManager, &FTrIntersectionManager::SwitchToGreen),
-		SignalSwitchTime,
-		true
-	);
-
-	GetWorld()->GetTimerManager().SetTimer
-	(
-		AmberTimerHandle,
-		FTimerDelegate::CreateRaw(&IntersectionManager, &FTrIntersectionManager::SwitchToAmber),
-		FMath::Max(1, SignalSwitchTime - AMBER_DURATION),
-		true
-	);
+	// Actuated signals are driven by the simulation tick, using the queues measured by approach detectors.
+	if(IntersectionConfig.ControlMode == ETrSignalControlMode::FixedTime)
+	{
+		const float SignalSwitchTime = SimData->PathFollowingConfig.SignalSwitchInterval;
+		GetWorld()->GetTimerManager().SetTimer
+		(
+			IntersectionTimerHandle,
+			FTimerDelegate::CreateRaw(&IntersectionManager, &FTrIntersectionManager::SwitchToGreen),
+			SignalSwitchTime,
+			true
+		);
+
+		GetWorld()->GetTimerManager().SetTimer
+		(
+			AmberTimerHandle,
+			FTimerDelegate::CreateRaw(&IntersectionManager, &FTrIntersectionManager::SwitchToAmber),
+			FMath::Max(1, SignalSwitchTime - AMBER_DURATION),
+			true
+		);
+	}
 	
 	ImplicitGrid.Initialize(FFloatRange(-SimData->GridConfiguration.Range, SimData->GridConfiguration.Range), SimData->GridConfiguration.Resolution);
-	GEngine->AddOnScreenDebugMessage(-1, 5.0f, FColor::White, FString::Printf(TEXT("Simulating %d vehicles"), NumEntities));
+	HashCellSize = SimData->GridConfiguration.HashCellSize;
+	VehicleHash.Reset();
+	bIsVehicleHashDirty = false;
+}
+
+FTrArchetypeConstants::FTrArchetypeConstants(const FTrVehicleDynamics& Dynamics)
+	: InverseDesiredSpeed(1.0f / Dynamics.DesiredSpeed)
+	, MinimumGap(Dynamics.MinimumGap)
+	, DesiredTimeHeadWay(Dynamics.DesiredTimeHeadWay)
+	, MaximumAcceleration(Dynamics.MaximumAcceleration)
+	, MaximumDeceleration(Dynamics.ComfortableBrakingDeceleration * 2.0f)
+	, AccelerationExponent(Dynamics.AccelerationExponent)
+	, InverseBrakingTerm(1.0f / (2.0f * FMath::Sqrt(Dynamics.MaximumAcceleration * Dynamics.ComfortableBrakingDeceleration)))
+	, Dimensions(Dynamics.Dimensions)
+	, HalfWheelBaseLength(Dynamics.WheelBaseLength * 0.5f)
+	, SteeringSpeed(Dynamics.SteeringSpeed)
+	, MaxSteeringAngle(Dynamics.MaxSteeringAngle)
+	, CollisionSensorRange(Dynamics.CollisionSensorRange)
+	, CollisionBound(Dynamics.Dimensions.Y * DETECTION_RANGE_SCALE)
+{
+}
+
+FTrVehicleHandle UTrSimulationSystem::AddVehicle(const FTransform& Transform, const FTrPath& Path, const FName Archetype, const FVector& Velocity)
+{
+	if(NumEntities >= Capacity || Network.IsEmpty())
+	{
+		return FTrVehicleHandle();
+	}
+
+	const int32 StartEdge = FindStartEdge(Transform.GetLocation(), Path);
+	if(StartEdge == INDEX_NONE)
+	{
+		return FTrVehicleHandle();
+	}
+
+	uint32 Slot;
+	if(FreeSlots.Num() > 0)
+	{
+		Slot = FreeSlots.Pop(false);
+	}
+	else
+	{
+		Slot = SlotIndices.Add(INDEX_NONE);
+		SlotGenerations.Add(0);
+	}
+
+	const int LastIndex = NumEntities++;
+	SlotIndices[Slot] = LastIndex;
+	bIsVehicleHashDirty = true;
+	VehicleSlots.Push(Slot);
+
+	PathTransforms.Push({Transform, Network.MakePath(StartEdge)});
+	PathEdges.Push(StartEdge);
+	VehicleLanes.Push(Network.FindNearestLane(StartEdge, Transform.GetLocation()));
+	LaneChangeTimers.Push(0.0f);
+	SimulationTiers.Push(ETrSimulationTier::Reduced);
+	const int32 Region = Regions.IsEmpty() ? INDEX_NONE : Regions.GetEdgeRegion(StartEdge);
+	VehicleRegions.Push(Region);
+	if(Region != INDEX_NONE && !Regions.IsLoaded(Region))
+	{
+		BoundaryQueue.Push(Slot);
+	}
+	Positions.Push(Transform.GetLocation());
+	Velocities.Push(Velocity);
+	Headings.Push(Transform.GetRotation().GetForwardVector());
+	GroundNormals.Push(Transform.GetRotation().GetUpVector());
+	LeadingVehicleIndices.Push(-1);
+	PathFollowingStates.Push(false);
+	Routes.AddDefaulted();
+
+	FVector NearestProjectionPoint;
+	FindNearestPath(LastIndex, NearestProjectionPoint);
+	Goals.Push(NearestProjectionPoint);
+
+#if !UE_BUILD_SHIPPING
+	DebugColors.Push(FColor::MakeRandomColor());
+#endif
+
+	// Chunks that follow the one of the archetype are shifted by one, by moving their first vehicle after their last one.
+	const int32 ArchetypeIndex = FMath::Max(0, ArchetypeNames.Find(Archetype));
+	int32 Index = LastIndex;
+	for(int32 Chunk = Archetypes.Num() - 1; Chunk > ArchetypeIndex; --Chunk)
+	{
+		if(ChunkCounts[Chunk] > 0)
+		{
+			SwapVehicles(ChunkStarts[Chunk], Index);
+			Index = ChunkStarts[Chunk];
+		}
+		++ChunkStarts[Chunk];
+	}
+	++ChunkCounts[ArchetypeIndex];
+
+	if(RoutingConfig.bEnableRouting)
+	{
+		StartTrip(Index);
+	}
+	return {static_cast<int32>(Slot), SlotGenerations[Slot]};
+}
+
+bool UTrSimulationSystem::RemoveVehicle(const FTrVehicleHandle Handle)
+{
+	const int32 Index = GetVehicleIndex(Handle);
+	if(Index == INDEX_NONE)
+	{
+		return false;
+	}
+
+	// The vehicle is moved to the end of its chunk, then each following chunk is shifted back by moving its last vehicle before its first one.
+	const int32 ArchetypeIndex = GetVehicleArchetype(Index);
+	int32 Hole = Index;
+	for(int32 Chunk = ArchetypeIndex; Chunk < Archetypes.Num(); ++Chunk)
+	{
+		if(ChunkCounts[Chunk] > 0)
+		{
+			const int32 ChunkLast = ChunkStarts[Chunk] + ChunkCounts[Chunk] - 1;
+			if(Hole != ChunkLast)
+			{
+				SwapVehicles(Hole, ChunkLast);
+			}
+			Hole = ChunkLast;
+		}
+
+		if(Chunk == ArchetypeIndex)
+		{
+			--ChunkCounts[Chunk];
+		}
+		else
+		{
+			--ChunkStarts[Chunk];
+		}
+	}
+
+	const int32 LastIndex = NumEntities - 1;
+	check(Hole == LastIndex);
+	OnVehicleRemoved.Broadcast(LastIndex);
+
+	// Pending routes of the vehicle are discarded when they complete, since its slot no longer maps to a vehicle.
+	const uint32 Slot = VehicleSlots.Pop(false);
+	SlotIndices[Slot] = INDEX_NONE;
+	++SlotGenerations[Slot];
+	FreeSlots.Push(Slot);
+
+	DetachedVehicles.Remove(LastIndex);
+	bIsVehicleHashDirty = true;
+	Positions.Pop(false);
+	Velocities.Pop(false);
+	Headings.Pop(false);
+	Goals.Pop(false);
+	PathTransforms.Pop(false);
+	PathEdges.Pop(false);
+	Routes.Pop(false);
+	LeadingVehicleIndices.Pop(false);
+	PathFollowingStates.Pop(false);
+	VehicleRegions.Pop(false);
+	GroundNormals.Pop(false);
+	VehicleLanes.Pop(false);
+	LaneChangeTimers.Pop(false);
+	SimulationTiers.Pop(false);
+#if !UE_BUILD_SHIPPING
+	DebugColors.Pop(false);
+#endif
+	--NumEntities;
+	return true;
+}
+
+void UTrSimulationSystem::TeleportVehicle(const uint32 Index, const FTransform& Transform, const FTrPath& Path)
+{
+	const int32 Edge = FindStartEdge(Transform.GetLocation(), Path);
+	if(Edge == INDEX_NONE)
+	{
+		return;
+	}
+
+	Positions[Index] = Transform.GetLocation();
+	Headings[Index] = Transform.GetRotation().GetForwardVector();
+	Velocities[Index] = Headings[Index] * Velocities[Index].Length();
+	bIsVehicleHashDirty = true;
+	PathFollowingStates[Index] = false;
+	LeadingVehicleIndices[Index] = -1;
+	PathEdges[Index] = Edge;
+	VehicleLanes[Index] = Network.FindNearestLane(Edge, Transform.GetLocation());
+	PathTransforms[Index] = {Transform, Network.MakePath(Edge)};
+	HandOverVehicle(Index);
+
+	FVector NearestProjectionPoint;
+	FindNearestPath(Index, NearestProjectionPoint);
+	Goals[Index] = NearestProjectionPoint;
+
+	if(RoutingConfig.bEnableRouting)
+	{
+		StartTrip(Index);
+	}
+}
+
+bool UTrSimulationSystem::IsLaneOccupied(const FVector& Location, const FVector& Direction, const float Distance)
+{
+	const float DistanceSquared = FMath::Square(Distance);
+	FRpSearchResults Results;
+	ImplicitGrid.LineSearch(Location - Direction * Distance, Location + Direction * Distance, Results);
+	uint8 Count = Results.Num();
+	for(auto Itr = Results.Array.begin(); Count > 0; --Count, ++Itr)
+	{
+		// The grid is only updated at the start of a tick, so positions are read again.
+		if(static_cast<int>(*Itr) < NumEntities && FVector::DistSquared(Positions[*Itr], Location) < DistanceSquared)
+		{
+			return true;
+		}
+	}
+
+	for(int Index = NumGridEntities; Index < NumEntities; ++Index)
+	{
+		if(FVector::DistSquared(Positions[Index], Location) < DistanceSquared)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void UTrSimulationSystem::FindVehiclesInRadius(const FVector& Location, const float Radius, TArray<int32>& OutVehicles)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTrSimulationSystem::FindVehiclesInRadius)
+
+	// Adding or removing a vehicle swaps others, so the hash is built again rather than patched. Builds are linear.
+	if(bIsVehicleHashDirty)
+	{
+		VehicleHash.Build(Positions, NumEntities, HashCellSize);
+		bIsVehicleHashDirty = false;
+	}
+
+	// Vehicles may have moved since the hash was built, so candidates are tested with their current positions.
+	const float RadiusSquared = FMath::Square(Radius);
+	const int32 FirstCandidate = OutVehicles.Num();
+	VehicleHash.FindCandidates(Location, Radius, OutVehicles);
+	int32 NumFound = FirstCandidate;
+	for(int32 Candidate = FirstCandidate; Candidate < OutVehicles.Num(); ++Candidate)
+	{
+		const int32 Index = OutVehicles[Candidate];
+		if(FVector::DistSquared(Positions[Index], Location) <= RadiusSquared)
+		{
+			OutVehicles[NumFound++] = Index;
+		}
+	}
+	OutVehicles.SetNum(NumFound, false);
+}
+
+void UTrSimulationSystem::HandOverVehicle(const uint32 Index)
+{
+	if(!Regions.IsEmpty() && Regions.GetEdgeRegion(PathEdges[Index]) != VehicleRegions[Index])
+	{
+		BoundaryQueue.Push(VehicleSlots[Index]);
+	}
+}
+
+void UTrSimulationSystem::UpdateRegions(const float DeltaSeconds)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTrSimulationSystem::UpdateRegions)
+
+	// Queued vehicles are referred to by slot, since making a vehicle dormant moves another one.
+	for(const uint32 Slot : BoundaryQueue)
+	{
+		const int32 Index = SlotIndices[Slot];
+		if(Index == INDEX_NONE)
+		{
+			continue;
+		}
+
+		VehicleRegions[Index] = Regions.GetEdgeRegion(PathEdges[Index]);
+		if(!Regions.IsLoaded(VehicleRegions[Index]) && !DetachedVehicles.Contains(Index))
+		{
+			MakeVehicleDormant(Index);
+		}
+	}
+	BoundaryQueue.Reset();
+
+	RegionStreamingTimer -= DeltaSeconds;
+	if(RegionStreamingTimer > 0.0f)
+	{
+		return;
+	}
+	RegionStreamingTimer = RegionConfig.StreamingInterval;
+
+	TArray<FVector> Sources = StreamingSources;
+	if(Sources.IsEmpty())
+	{
+		for(FConstPlayerControllerIterator Iterator = GetWorld()->GetPlayerControllerIterator(); Iterator; ++Iterator)
+		{
+			if(const APlayerController* PlayerController = Iterator->Get())
+			{
+				FVector ViewLocation;
+				FRotator ViewRotation;
+				PlayerController->GetPlayerViewPoint(ViewLocation, ViewRotation);
+				Sources.Push(ViewLocation);
+			}
+		}
+	}
+
+	// Regions also stream with the cells of World Partition, around the same sources as the level.
+	const UWorldPartition* WorldPartition = GetWorld()->GetWorldPartition();
+	if(WorldPartition && WorldPartition->IsStreamingEnabled())
+	{
+		for(const FWorldPartitionStreamingSource& Source : WorldPartition->GetStreamingSources())
+		{
+			Sources.Push(Source.Location);
+		}
+	}
+
+	// Nothing is unloaded until there is a player, a focus or a streaming source.
+	if(Sources.IsEmpty())
+	{
+		return;
+	}
+
+	TArray<int32> LoadedRegions;
+	TArray<int32> UnloadedRegions;
+	Regions.UpdateStreaming(Sources, FMath::Max(RegionConfig.LoadingRange, MinStreamingRange), LoadedRegions, UnloadedRegions);
+	if(UnloadedRegions.Num() > 0)
+	{
+		// Vehicles are visited from the last one, so that removals only move vehicles that have already been visited.
+		for(int Index = NumEntities - 1; Index >= 0; --Index)
+		{
+			if(!Regions.IsLoaded(VehicleRegions[Index]) && !DetachedVehicles.Contains(Index))
+			{
+				MakeVehicleDormant(Index);
+			}
+		}
+	}
+
+	for(const int32 Region : LoadedRegions)
+	{
+		OnRegionLoaded.Broadcast(Region);
+	}
+}
+
+void UTrSimulationSystem::MakeVehicleDormant(const uint32 Index)
+{
+	FTrDormantVehicle& DormantVehicle = Regions.GetRegion(VehicleRegions[Index]).DormantVehicles.AddDefaulted_GetRef();
+	DormantVehicle.Transform = FTransform(Headings[Index].ToOrientationQuat(), Positions[Index]);
+	DormantVehicle.Path = PathTransforms[Index].Path;
+	DormantVehicle.Velocity = Velocities[Index];
+	DormantVehicle.Archetype = ArchetypeNames[GetVehicleArchetype(Index)];
+	OnVehicleDormant.Broadcast(Index, DormantVehicle);
+	RemoveVehicle(GetVehicleHandle(Index));
+}
+
+int32 UTrSimulationSystem::FindStartEdge(const FVector& Location, const FTrPath& Path) const
+{
+	const int32 NumNodes = Network.GetNumNodes();
+	const int32 Edge = static_cast<int32>(Path.StartNodeIndex) < NumNodes && static_cast<int32>(Path.EndNodeIndex) < NumNodes
+		? Network.FindEdge(Path.StartNodeIndex, Path.EndNodeIndex)
+		: INDEX_NONE;
+	return Edge != INDEX_NONE ? Edge : SegmentTree.FindNearest(Location).Edge;
+}
+
+int32 UTrSimulationSystem::GetVehicleArchetype(const uint32 Index) const
+{
+	for(int32 Chunk = 0; Chunk < Archetypes.Num(); ++Chunk)
+	{
+		if(static_cast<int32>(Index) < ChunkStarts[Chunk] + ChunkCounts[Chunk])
+		{
+			return Chunk;
+		}
+	}
+	return INDEX_NONE;
+}
+
+void UTrSimulationSystem::SwapVehicles(const uint32 IndexA, const uint32 IndexB)
+{
+	Positions.Swap(IndexA, IndexB);
+	Velocities.Swap(IndexA, IndexB);
+	Headings.Swap(IndexA, IndexB);
+	Goals.Swap(IndexA, IndexB);
+	PathTransforms.Swap(IndexA, IndexB);
+	PathEdges.Swap(IndexA, IndexB);
+	Routes.Swap(IndexA, IndexB);
+	PathFollowingStates.Swap(IndexA, IndexB);
+	VehicleRegions.Swap(IndexA, IndexB);
+	GroundNormals.Swap(IndexA, IndexB);
+	VehicleLanes.Swap(IndexA, IndexB);
+	LaneChangeTimers.Swap(IndexA, IndexB);
+	SimulationTiers.Swap(IndexA, IndexB);
+#if !UE_BUILD_SHIPPING
+	DebugColors.Swap(IndexA, IndexB);
+#endif
+
+	// Leading vehicles are found again at the next tick.
+	LeadingVehicleIndices[IndexA] = -1;
+	LeadingVehicleIndices[IndexB] = -1;
+
+	const bool bIsADetached = DetachedVehicles.Contains(IndexA);
+	const bool bIsBDetached = DetachedVehicles.Contains(IndexB);
+	if(bIsADetached != bIsBDetached)
+	{
+		DetachedVehicles.Remove(bIsADetached ? IndexA : IndexB);
+		DetachedVehicles.Add(bIsADetached ? IndexB : IndexA);
+	}
+
+	VehicleSlots.Swap(IndexA, IndexB);
+	SlotIndices[VehicleSlots[IndexA]] = IndexA;
+	SlotIndices[VehicleSlots[IndexB]] = IndexB;
+
+	OnVehiclesSwapped.Broadcast(IndexA, IndexB);
 }
 
 void UTrSimulationSystem::DetachVehicle(const uint32 Index)
@@ -110,10 +765,51 @@ void UTrSimulationSystem::DetachVehicle(const uint32 Index)
 	DetachedVehicles.Add(Index);
 }
 
+bool UTrSimulationSystem::ReattachVehicle(const uint32 Index, const FTransform& Transform, const FVector& Velocity)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTrSimulationSystem::ReattachVehicle)
+
+	const FVector Location = Transform.GetLocation();
+	const FVector Heading = Transform.GetRotation().GetForwardVector();
+	FTrSegmentTree::FHit Hit = SegmentTree.FindNearest(Location, [this, &Heading](const uint32 Edge)
+	{
+		return Network.GetEdgeDirection(Edge).Dot(Heading) > 0.0f;
+	}, REATTACH_DISTANCE);
+
+	if(Hit.Edge == INDEX_NONE)
+	{
+		Hit = SegmentTree.FindNearest(Location);
+		if(Hit.Edge == INDEX_NONE)
+		{
+			return false;
+		}
+	}
+
+	Positions[Index] = Location;
+	Headings[Index] = Heading;
+	Velocities[Index] = Heading * Velocity.Dot(Heading);
+	Goals[Index] = Hit.Projection;
+	PathFollowingStates[Index] = false;
+	LeadingVehicleIndices[Index] = -1;
+	PathEdges[Index] = Hit.Edge;
+	VehicleLanes[Index] = Network.FindNearestLane(Hit.Edge, Location);
+	PathTransforms[Index].Path = Network.MakePath(Hit.Edge);
+	DetachedVehicles.Remove(Index);
+	HandOverVehicle(Index);
+
+	if(RoutingConfig.bEnableRouting)
+	{
+		StartTrip(Index);
+	}
+	return true;
+}
+
 void UTrSimulationSystem::OverrideTransform(const uint32 Index, const FTransform& Transform)
 {
 	Positions[Index] = Transform.GetLocation();
 	Headings[Index] = Transform.GetRotation().GetForwardVector();
+	GroundNormals[Index] = Transform.GetRotation().GetUpVector();
+	bIsVehicleHashDirty = true;
 }
 
 void UTrSimulationSystem::GetVehicleTransforms(TArray<FTransform>& OutTransforms, const FVector& PositionOffset)
@@ -123,16 +819,18 @@ void UTrSimulationSystem::GetVehicleTransforms(TArray<FTransform>& OutTransforms
 		OutTransforms.Init(FTransform::Identity, NumEntities);
 	}
 	
-	for(int Index = 0; Index < NumEntities; ++Index)
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTrSimulationSystem::GetVehicleTransforms)
+
+	const bool bIsGrounded = !HeightField.IsEmpty();
+	ParallelFor(NumEntities, [this, &OutTransforms, &PositionOffset, bIsGrounded](const int32 Index)
 	{
-		FTransform Transform
+		// The heading is projected on the road, which gives the pitch, and the normal gives the roll.
+		OutTransforms[Index] = FTransform
 		{
-			Headings[Index].ToOrientationQuat(),
+			bIsGrounded ? FRotationMatrix::MakeFromZX(GroundNormals[Index], Headings[Index]).ToQuat() : Headings[Index].ToOrientationQuat(),
 			Positions[Index] + PositionOffset
 		};
-
-		OutTransforms[Index] = Transform;
-	}
+	}, GetParallelForFlags(NumEntities));
 }
 
 void UTrSimulationSystem::TickSimulation(const float DeltaSeconds)
@@ -145,39 +843,56 @@ void UTrSimulationSystem::TickSimulation(const float DeltaSeconds)
 	DrawDebug();
 #endif
 	ImplicitGrid.Update(Positions);
+	NumGridEntities = NumEntities;
+	UpdateRoutes();
 	SetGoals();
 	HandleGoals();
+	UpdateDetectors();
+	IntersectionManager.Tick(DeltaSeconds);
 	UpdateCollisionData();
+	if(LaneChangeConfig.bEnableLaneChanges && Network.GetMaxLaneCount() > 1)
+	{
+		UpdateLaneOccupancy();
+		UpdateLaneChanges();
+	}
 	UpdateKinematics();
 	UpdateOrientations();
+
+	if(!HeightField.IsEmpty())
+	{
+		UpdateGrounding();
+	}
+
+	if(!Regions.IsEmpty())
+	{
+		UpdateRegions(DeltaSeconds);
+	}
+
+	VehicleHash.Build(Positions, NumEntities, HashCellSize);
+	bIsVehicleHashDirty = false;
 }
 
 void UTrSimulationSystem::SetGoals()
 {
 	TRACE_CPUPROFILER_EVENT_SCOPE(UTrSimulationSystem::SetGoals)
 
-	TArray<FVector> ProjectionPoints;
-	ProjectionPoints.Reserve(PathTransforms.Num());
-
-	for (int Index = 0; Index < NumEntities; ++Index)
+	ParallelFor(NumEntities, [this](const int32 Index)
 	{
 		const FVector Future = Positions[Index] + Velocities[Index].GetSafeNormal() * PathFollowingConfig.LookAheadDistance;
 
-		const FVector PathDirection = (PathTransforms[Index].Path.End - PathTransforms[Index].Path.Start).GetSafeNormal();
-		const FVector PathLeft = PathDirection.RotateAngleAxis(-90.0f, FVector::UpVector);
-		const FVector PathOffset = PathLeft * PathFollowingConfig.PathFollowOffset;
+		// Lane segments are offset from the center line when the network is built.
+		const uint32 Edge = PathEdges[Index];
+		const FVector LaneStart = Network.GetLaneStart(Edge, VehicleLanes[Index]);
+		const FVector& LaneDirection = Network.GetEdgeDirection(Edge);
+		const float LaneLength = Network.GetEdgeLength(Edge);
 
-		FTrPath OffsetPath = PathTransforms[Index].Path;
-		OffsetPath.Start += PathOffset;
-		OffsetPath.End += PathOffset;
-
-		const FVector FutureOnPath = ProjectPointOnPathClamped(Future, OffsetPath);
-		const FVector PositionOnPath = ProjectPointOnPathClamped(Positions[Index], OffsetPath);
+		const FVector FutureOnPath = ProjectPointOnSegmentClamped(Future, LaneStart, LaneDirection, LaneLength);
+		const FVector PositionOnPath = ProjectPointOnSegmentClamped(Positions[Index], LaneStart, LaneDirection, LaneLength);
 
 		const float Distance = FVector::Distance(Positions[Index], PositionOnPath);
 		if (Distance < PathFollowingConfig.PathFollowThreshold)
 		{
-			Goals[Index] = OffsetPath.End;
+			Goals[Index] = Network.GetLaneEnd(Edge, VehicleLanes[Index]);
 			PathFollowingStates[Index] = true;
 		}
 		else
@@ -185,7 +900,7 @@ void UTrSimulationSystem::SetGoals()
 			Goals[Index] = FutureOnPath;
 			PathFollowingStates[Index] = false;
 		}
-	}
+	}, GetParallelForFlags(NumEntities));
 }
 
 void UTrSimulationSystem::HandleGoals()
@@ -200,88 +915,136 @@ void UTrSimulationSystem::HandleGoals()
 	}
 }
 
-void UTrSimulationSystem::UpdateKinematics()
+void UTrSimulationSystem::UpdateDetectors()
 {
-	TRACE_CPUPROFILER_EVENT_SCOPE(UTrSimulationSystem::UpdateKinematics)
-	
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTrSimulationSystem::UpdateDetectors)
+
+	IntersectionManager.ResetDetectors();
+	const float DetectorRangeSquared = FMath::Square(IntersectionConfig.DetectorRange);
 	for (int Index = 0; Index < NumEntities; ++Index)
 	{
-		if(DetachedVehicles.Contains(Index))
+		const FTrPath& CurrentPath = PathTransforms[Index].Path;
+		if(!DetachedVehicles.Contains(Index) && FVector::DistSquared(Positions[Index], CurrentPath.End) <= DetectorRangeSquared)
 		{
-			continue;
+			IntersectionManager.DetectVehicle(CurrentPath.EndNodeIndex);
 		}
-		
-		int LeadingVehicleIndex = LeadingVehicleIndices[Index];
+	}
+}
 
-		FVector& CurrentPosition = Positions[Index];
-		const float CurrentSpeed = Velocities[Index].Size();
-		float RelativeSpeed = CurrentSpeed;
-		float CurrentGap = FVector::Distance(Goals[Index], CurrentPosition);
-		float MinimumGap = 0.0f;
+void UTrSimulationSystem::UpdateKinematics()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTrSimulationSystem::UpdateKinematics)
 
-		if(LeadingVehicleIndex != -1)
+	// Accelerations depend on the leading vehicle, so they are all computed before any velocity is changed.
+	Accelerations.SetNumUninitialized(NumEntities, false);
+	const bool bHasLaneLeaders = LaneChangeConfig.bEnableLaneChanges && Network.GetMaxLaneCount() > 1;
+	for(int32 Chunk = 0; Chunk < Archetypes.Num(); ++Chunk)
+	{
+		const FTrArchetypeConstants& Constants = Archetypes[Chunk];
+		const int32 ChunkStart = ChunkStarts[Chunk];
+		ParallelFor(ChunkCounts[Chunk], [this, &Constants, ChunkStart, bHasLaneLeaders](const int32 ChunkIndex)
 		{
-			const float DistanceToOther = FVector::Distance(CurrentPosition, Positions[LeadingVehicleIndex]);
-			if(DistanceToOther < CurrentGap)
+			const int32 Index = ChunkStart + ChunkIndex;
+			if(DetachedVehicles.Contains(Index))
 			{
-				MinimumGap = VehicleConfig.MinimumGap;
-				CurrentGap = DistanceToOther;
-				RelativeSpeed = ScalarProjection(Velocities[Index] - Velocities[LeadingVehicleIndex], Headings[Index]);
+				return;
 			}
-		}
-		
-		const float FreeRoadTerm = VehicleConfig.MaximumAcceleration * (1 - FMath::Pow(CurrentSpeed / VehicleConfig.DesiredSpeed, VehicleConfig.AccelerationExponent));
+			
+			int LeadingVehicleIndex = LeadingVehicleIndices[Index];
 
-		const float DecelerationTerm = (CurrentSpeed * RelativeSpeed) / (2 * FMath::Sqrt(VehicleConfig.MaximumAcceleration * VehicleConfig.ComfortableBrakingDeceleration));
-		const float GapTerm = (MinimumGap + VehicleConfig.DesiredTimeHeadWay * CurrentSpeed + DecelerationTerm) / CurrentGap;
-		const float InteractionTerm = -VehicleConfig.MaximumAcceleration * FMath::Square(GapTerm);
+			const FVector& CurrentPosition = Positions[Index];
+			if(bHasLaneLeaders && Network.GetLaneCount(PathEdges[Index]) > 1)
+			{
+				// On multi-lane edges, vehicles follow the leader lane changes were evaluated against, and ignore vehicles of the other lanes.
+				// The vehicle found ahead is kept if it is on another edge, or driven by physics.
+				if(LeadingVehicleIndex != -1 && PathEdges[LeadingVehicleIndex] == PathEdges[Index]
+					&& VehicleLanes[LeadingVehicleIndex] != VehicleLanes[Index] && !DetachedVehicles.Contains(LeadingVehicleIndex))
+				{
+					LeadingVehicleIndex = -1;
+				}
 
-		float Acceleration = FreeRoadTerm + InteractionTerm;
-		Acceleration = FMath::Clamp(Acceleration, -VehicleConfig.ComfortableBrakingDeceleration * 2.0f, VehicleConfig.MaximumAcceleration);
-		
-		FVector& CurrentHeading = Headings[Index];
-		FVector& CurrentVelocity = Velocities[Index];
+				const int32 LaneLeader = LaneNeighbors[Index].Leader;
+				if(LaneLeader != INDEX_NONE && (LeadingVehicleIndex == -1
+					|| FVector::DistSquared(CurrentPosition, Positions[LaneLeader]) < FVector::DistSquared(CurrentPosition, Positions[LeadingVehicleIndex])))
+				{
+					LeadingVehicleIndex = LaneLeader;
+				}
+			}
 
-		CurrentVelocity += CurrentHeading * Acceleration * TickRate; // v = u + a * t
-		CurrentPosition += CurrentVelocity * TickRate; // x1 = x0 + v * t
+			const float CurrentSpeed = Velocities[Index].Size();
+			float RelativeSpeed = CurrentSpeed;
+			float CurrentGap = FVector::Distance(Goals[Index], CurrentPosition);
+			float MinimumGap = 0.0f;
+
+			if(LeadingVehicleIndex != -1)
+			{
+				const float DistanceToOther = FVector::Distance(CurrentPosition, Positions[LeadingVehicleIndex]);
+				if(DistanceToOther < CurrentGap)
+				{
+					MinimumGap = Constants.MinimumGap;
+					CurrentGap = DistanceToOther;
+					RelativeSpeed = ScalarProjection(Velocities[Index] - Velocities[LeadingVehicleIndex], Headings[Index]);
+				}
+			}
+
+			Accelerations[Index] = ComputeIDMAcceleration(Constants, CurrentSpeed, RelativeSpeed, CurrentGap, MinimumGap);
+		}, GetParallelForFlags(ChunkCounts[Chunk]));
 	}
+
+	ParallelFor(NumEntities, [this](const int32 Index)
+	{
+		if(DetachedVehicles.Contains(Index))
+		{
+			return;
+		}
+
+		FVector& CurrentVelocity = Velocities[Index];
+		CurrentVelocity += Headings[Index] * Accelerations[Index] * TickRate; // v = u + a * t
+		Positions[Index] += CurrentVelocity * TickRate; // x1 = x0 + v * t
+	}, GetParallelForFlags(NumEntities));
 }
 
 void UTrSimulationSystem::UpdateOrientations()
 {
 	TRACE_CPUPROFILER_EVENT_SCOPE(UTrSimulationSystem::UpdateOrientations)
 	
-	for (int Index = 0; Index < NumEntities; ++Index)
+	for(int32 Chunk = 0; Chunk < Archetypes.Num(); ++Chunk)
 	{
-		if(DetachedVehicles.Contains(Index))
+		const FTrArchetypeConstants& Constants = Archetypes[Chunk];
+		const int32 ChunkStart = ChunkStarts[Chunk];
+		ParallelFor(ChunkCounts[Chunk], [this, &Constants, ChunkStart](const int32 ChunkIndex)
 		{
-			continue;
-		}
-		
-		FVector& CurrentHeading = Headings[Index];
-		FVector& CurrentPosition = Positions[Index];
-		FVector& CurrentVelocity = Velocities[Index];
+			const int32 Index = ChunkStart + ChunkIndex;
+			if(DetachedVehicles.Contains(Index))
+			{
+				return;
+			}
+			
+			FVector& CurrentHeading = Headings[Index];
+			FVector& CurrentPosition = Positions[Index];
+			FVector& CurrentVelocity = Velocities[Index];
 
-		const FVector GoalDirection = (Goals[Index] - Positions[Index]).GetSafeNormal();
+			const FVector GoalDirection = (Goals[Index] - Positions[Index]).GetSafeNormal();
 
-		FVector RearWheelPosition = CurrentPosition - CurrentHeading * VehicleConfig.WheelBaseLength * 0.5f;
-		FVector FrontWheelPosition = CurrentPosition + CurrentHeading * VehicleConfig.WheelBaseLength * 0.5f;
+			FVector RearWheelPosition = CurrentPosition - CurrentHeading * Constants.HalfWheelBaseLength;
+			FVector FrontWheelPosition = CurrentPosition + CurrentHeading * Constants.HalfWheelBaseLength;
 
-		const FVector TargetHeading = (GoalDirection - CurrentHeading * 0.9f).GetSafeNormal();
-		const float TargetSteerAngle = FMath::Atan2
-		(
-			CurrentHeading.X * TargetHeading.Y - CurrentHeading.Y * TargetHeading.X,
-			CurrentHeading.X * TargetHeading.X + CurrentHeading.Y * TargetHeading.Y
-		);
+			const FVector TargetHeading = (GoalDirection - CurrentHeading * 0.9f).GetSafeNormal();
+			const float TargetSteerAngle = FMath::Atan2
+			(
+				CurrentHeading.X * TargetHeading.Y - CurrentHeading.Y * TargetHeading.X,
+				CurrentHeading.X * TargetHeading.X + CurrentHeading.Y * TargetHeading.Y
+			);
 
-		float SteerAngle = FMath::Clamp(TargetSteerAngle * VehicleConfig.SteeringSpeed, -VehicleConfig.MaxSteeringAngle, VehicleConfig.MaxSteeringAngle);
+			float SteerAngle = FMath::Clamp(TargetSteerAngle * Constants.SteeringSpeed, -Constants.MaxSteeringAngle, Constants.MaxSteeringAngle);
 
-		RearWheelPosition += CurrentVelocity.Length() * CurrentHeading * TickRate;
-		FrontWheelPosition += CurrentVelocity.Length() * CurrentHeading.RotateAngleAxis(FMath::RadiansToDegrees(SteerAngle), FVector::UpVector) * TickRate;
+			RearWheelPosition += CurrentVelocity.Length() * CurrentHeading * TickRate;
+			FrontWheelPosition += CurrentVelocity.Length() * CurrentHeading.RotateAngleAxis(FMath::RadiansToDegrees(SteerAngle), FVector::UpVector) * TickRate;
 
-		CurrentHeading = (FrontWheelPosition - RearWheelPosition).GetSafeNormal();
-		CurrentPosition = (FrontWheelPosition + RearWheelPosition) * 0.5f;
-		CurrentVelocity = CurrentHeading * CurrentVelocity.Length();
+			CurrentHeading = (FrontWheelPosition - RearWheelPosition).GetSafeNormal();
+			CurrentPosition = (FrontWheelPosition + RearWheelPosition) * 0.5f;
+			CurrentVelocity = CurrentHeading * CurrentVelocity.Length();
+		}, GetParallelForFlags(ChunkCounts[Chunk]));
 	}
 }
 
@@ -289,48 +1052,99 @@ void UTrSimulationSystem::UpdatePath(const uint32 Index)
 {
 	TRACE_CPUPROFILER_EVENT_SCOPE(UTrSimulationSystem::UpdatePath)
 	
-	FTrPath& CurrentPath = PathTransforms[Index].Path;
-	const TArray<uint32>& Connections = Nodes[CurrentPath.EndNodeIndex].GetConnections();
+	const uint32 CurrentEdge = PathEdges[Index];
+	const TArrayView<const uint32> Turns = Network.GetTurns(CurrentEdge);
+	if(Turns.Num() == 0)
+	{
+		return;
+	}
 
-	uint32 NewStartNodeIndex = CurrentPath.EndNodeIndex;
-	uint32 NewEndNodeIndex = Connections[0];
+	// Traffic signals only regulate nodes where vehicles can choose between several turns.
+	const uint32 NewStartNodeIndex = Network.GetEdgeEndNode(CurrentEdge);
+	if(Turns.Num() > 1 && IntersectionManager.IsNodeBlocked(NewStartNodeIndex))
+	{
+		return;
+	}
 
-	if(Connections.Num() == 2)
+	FTrVehicleRoute& Route = Routes[Index];
+	uint32 NewEdge;
+	if(Route.HasNextEdge() && Turns.Contains((*Route.Edges)[Route.Cursor]))
 	{
-		NewEndNodeIndex = Connections[0] == CurrentPath.StartNodeIndex ? Connections[1] : Connections[0];	
+		NewEdge = (*Route.Edges)[Route.Cursor++];
 	}
 	else
 	{
-		const FVector CurrentPathDirection = CurrentPath.Direction();
+		NewEdge = Turns.Num() == 1 ? Turns[0] : Turns[FMath::RandRange(0, Turns.Num() - 1)];
+		Route.Edges.Reset();
+	}
+	
+	// Vehicles keep their lane when possible, and move to the outermost lane of edges with fewer lanes.
+	PathEdges[Index] = NewEdge;
+	VehicleLanes[Index] = FMath::Min<int32>(VehicleLanes[Index], Network.GetLaneCount(NewEdge) - 1);
+	PathTransforms[Index].Path = Network.MakePath(NewEdge);
+	HandOverVehicle(Index);
 
-		TArray<uint32> EligibleConnections;
-		for(uint32 Connection : Connections)
-		{
-			const FVector TargetPathDirection = (Nodes[Connection].GetLocation() - Nodes[NewStartNodeIndex].GetLocation()).GetSafeNormal();
-			const float Angle = FMath::Acos(CurrentPathDirection.Dot(TargetPathDirection));
+	IntersectionManager.OnVehicleServed(NewStartNodeIndex);
 
-			if(Angle < PI / 2)
-			{
-				EligibleConnections.Push(Connection);
-			}
+	if(RoutingConfig.bEnableRouting && !Route.bIsPending && !Route.HasNextEdge())
+	{
+		StartTrip(Index);
+	}
+}
+
+void UTrSimulationSystem::StartTrip(const uint32 Index)
+{
+	FTrVehicleRoute& Route = Routes[Index];
+	Route.DestinationNode = Network.GetEdgeEndNode(FMath::RandRange(0, Network.GetNumEdges() - 1));
+	Route.Edges.Reset();
+	Route.Cursor = 0;
+	Route.bIsPending = true;
+	Router.RequestRoute(VehicleSlots[Index], PathEdges[Index], Route.DestinationNode);
+}
+
+void UTrSimulationSystem::UpdateRoutes()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTrSimulationSystem::UpdateRoutes)
+
+	if(!RoutingConfig.bEnableRouting)
+	{
+		return;
+	}
+
+	TArray<FTrRouteResult> Results;
+	Router.Tick(Results);
+	for(const FTrRouteResult& Result : Results)
+	{
+		// Routes are requested by slot, since vehicles may have been swapped or removed while they were computed.
+		const int32 Index = SlotIndices.IsValidIndex(Result.RequesterId) ? SlotIndices[Result.RequesterId] : INDEX_NONE;
+		if(Index == INDEX_NONE)
+		{
+			continue;
 		}
 
-		const uint32 NumEligibleConnections = EligibleConnections.Num();
-		if(NumEligibleConnections > 0)
+		FTrVehicleRoute& Route = Routes[Index];
+		if(!Route.bIsPending || Result.DestinationNode != Route.DestinationNode)
 		{
-			if(NumEligibleConnections > 1 && IntersectionManager.IsNodeBlocked(NewStartNodeIndex))
-			{
-				return;
-			}
+			continue;
+		}
 
-			NewEndNodeIndex = EligibleConnections[FMath::RandRange(0, EligibleConnections.Num() - 1)];
+		// The vehicle may have moved on to another edge while its route was computed.
+		if(Result.OriginEdge != PathEdges[Index])
+		{
+			Router.RequestRoute(Result.RequesterId, PathEdges[Index], Route.DestinationNode);
+			continue;
 		}
+
+		// Vehicles that can not reach their destination keep turning at random, and start another trip at the next node.
+		Route.Edges = Result.Route;
+		Route.Cursor = 0;
+		Route.bIsPending = false;
 	}
-	
-	CurrentPath.Start = Nodes[NewStartNodeIndex].GetLocation();
-	CurrentPath.End = Nodes[NewEndNodeIndex].GetLocation();
-	CurrentPath.StartNodeIndex = NewStartNodeIndex;
-	CurrentPath.EndNodeIndex = NewEndNodeIndex;
+}
+
+FVector UTrSimulationSystem::ProjectPointOnSegmentClamped(const FVector& Point, const FVector& Start, const FVector& Direction, const float Length)
+{
+	return Start + Direction * FMath::Clamp((Point - Start).Dot(Direction), 0.0f, Length);
 }
 
 FVector UTrSimulationSystem::ProjectPointOnPathClamped(const FVector& Point, const FTrPath& Path)
@@ -350,24 +1164,203 @@ FVector UTrSimulationSystem::ProjectPointOnPathClamped(const FVector& Point, con
 
 int UTrSimulationSystem::FindNearestPath(int EntityIndex, FVector& NearestProjection) const
 {
-	NearestProjection = Positions[EntityIndex];
-	int NearestPathIndex = 0;
-	float SmallestDistance = TNumericLimits<float>::Max();
+	const FVector Future = Positions[EntityIndex] + Velocities[EntityIndex].GetSafeNormal() * PathFollowingConfig.LookAheadDistance;
+	const FTrSegmentTree::FHit Hit = SegmentTree.FindNearest(Future);
+	NearestProjection = Hit.Edge != INDEX_NONE ? Hit.Projection : Positions[EntityIndex];
+	return Hit.Edge;
+}
+
+void UTrSimulationSystem::UpdateLaneOccupancy()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTrSimulationSystem::UpdateLaneOccupancy)
 
-	for (int PathIndex = 0; PathIndex < PathTransforms.Num(); ++PathIndex)
+	LaneDistances.SetNumUninitialized(NumEntities, false);
+	LaneNeighbors.Init(FTrLaneNeighbors(), NumEntities);
+	LaneEntries.Reset(NumEntities);
+	for(int32 Index = 0; Index < NumEntities; ++Index)
 	{
-		const FVector Future = Positions[EntityIndex] + Velocities[EntityIndex].GetSafeNormal() * PathFollowingConfig.LookAheadDistance;
-		const FVector ProjectionPoint = ProjectPointOnPathClamped(Future, PathTransforms[PathIndex].Path);
-		const float Distance = FVector::Distance(ProjectionPoint, Positions[EntityIndex]);
+		// Detached vehicles are driven by physics, and do not belong to a lane.
+		if(DetachedVehicles.Contains(Index))
+		{
+			continue;
+		}
 
-		if (Distance < SmallestDistance)
+		const uint32 Edge = PathEdges[Index];
+		LaneDistances[Index] = (Positions[Index] - Network.GetLaneStart(Edge, 0)).Dot(Network.GetEdgeDirection(Edge));
+		LaneEntries.Push({Network.GetFirstLane(Edge) + VehicleLanes[Index], LaneDistances[Index], Index});
+	}
+
+	Algo::Sort(LaneEntries, [](const FLaneEntry& A, const FLaneEntry& B)
+	{
+		return A.Lane != B.Lane ? A.Lane < B.Lane : A.Distance < B.Distance;
+	});
+
+	// Links every vehicle of a lane to the closest vehicles ahead and behind it on another lane, both being sorted by distance.
+	auto LinkLanes = [this](const int32 First, const int32 End, const int32 OtherFirst, const int32 OtherEnd, const int32 Side)
+	{
+		int32 Cursor = OtherFirst;
+		for(int32 Entry = First; Entry < End; ++Entry)
 		{
-			NearestProjection = ProjectionPoint;
-			SmallestDistance = Distance;
-			NearestPathIndex = PathIndex;
+			while(Cursor < OtherEnd && LaneEntries[Cursor].Distance < LaneEntries[Entry].Distance)
+			{
+				++Cursor;
+			}
+
+			FTrLaneNeighbors& Neighbors = LaneNeighbors[LaneEntries[Entry].Vehicle];
+			Neighbors.AdjacentLeaders[Side] = Cursor < OtherEnd ? LaneEntries[Cursor].Vehicle : INDEX_NONE;
+			Neighbors.AdjacentFollowers[Side] = Cursor > OtherFirst ? LaneEntries[Cursor - 1].Vehicle : INDEX_NONE;
+		}
+	};
+
+	int32 PreviousFirst = 0;
+	int32 PreviousEnd = 0;
+	for(int32 First = 0; First < LaneEntries.Num();)
+	{
+		const uint32 Lane = LaneEntries[First].Lane;
+		int32 End = First + 1;
+		while(End < LaneEntries.Num() && LaneEntries[End].Lane == Lane)
+		{
+			++End;
+		}
+
+		for(int32 Entry = First; Entry < End - 1; ++Entry)
+		{
+			LaneNeighbors[LaneEntries[Entry].Vehicle].Leader = LaneEntries[Entry + 1].Vehicle;
+			LaneNeighbors[LaneEntries[Entry + 1].Vehicle].Follower = LaneEntries[Entry].Vehicle;
+		}
+
+		// Lanes of an edge have contiguous ids, so the previous lane is the inner neighbour of this one if both are on the same edge.
+		if(PreviousEnd > PreviousFirst && LaneEntries[PreviousFirst].Lane + 1 == Lane && PathEdges[LaneEntries[PreviousFirst].Vehicle] == PathEdges[LaneEntries[First].Vehicle])
+		{
+			LinkLanes(PreviousFirst, PreviousEnd, First, End, 1);
+			LinkLanes(First, End, PreviousFirst, PreviousEnd, 0);
 		}
+
+		PreviousFirst = First;
+		PreviousEnd = End;
+		First = End;
 	}
-	return NearestPathIndex;
+}
+
+void UTrSimulationSystem::UpdateLaneChanges()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTrSimulationSystem::UpdateLaneChanges)
+
+	ParallelFor(NumEntities, [this](const int32 Index)
+	{
+		LaneChangeTimers[Index] = FMath::Max(0.0f, LaneChangeTimers[Index] - TickRate);
+		if(LaneChangeTimers[Index] > 0.0f || SimulationTiers[Index] != ETrSimulationTier::Full || DetachedVehicles.Contains(Index))
+		{
+			return;
+		}
+
+		const uint32 Edge = PathEdges[Index];
+		const int32 LaneCount = Network.GetLaneCount(Edge);
+		if(LaneCount < 2 || LaneDistances[Index] > Network.GetEdgeLength(Edge) - LANE_CHANGE_END_DISTANCE)
+		{
+			return;
+		}
+
+		FTrLaneNeighbors& Neighbors = LaneNeighbors[Index];
+		const float Length = Archetypes[GetVehicleArchetype(Index)].Dimensions.X * 2.0f;
+		const float CurrentAcceleration = ComputeLaneAcceleration(Index, Neighbors.Leader);
+
+		// The old follower closes up on the current leader once the vehicle has left.
+		const float OldFollowerGain = Neighbors.Follower != INDEX_NONE
+			? ComputeLaneAcceleration(Neighbors.Follower, Neighbors.Leader) - ComputeLaneAcceleration(Neighbors.Follower, Index)
+			: 0.0f;
+
+		int32 BestLane = INDEX_NONE;
+		int32 BestLeader = INDEX_NONE;
+		float BestIncentive = LaneChangeConfig.SwitchingThreshold;
+		for(int32 Side = 0; Side < 2; ++Side)
+		{
+			const int32 TargetLane = VehicleLanes[Index] + (Side == 0 ? -1 : 1);
+			if(TargetLane < 0 || TargetLane >= LaneCount)
+			{
+				continue;
+			}
+
+			// The gap on the target lane must be long enough for the vehicle.
+			const int32 NewLeader = Neighbors.AdjacentLeaders[Side];
+			const int32 NewFollower = Neighbors.AdjacentFollowers[Side];
+			if((NewLeader != INDEX_NONE && LaneDistances[NewLeader] - LaneDistances[Index] < Length) ||
+				(NewFollower != INDEX_NONE && LaneDistances[Index] - LaneDistances[NewFollower] < Length))
+			{
+				continue;
+			}
+
+			float NewFollowerGain = 0.0f;
+			if(NewFollower != INDEX_NONE)
+			{
+				const float NewFollowerAcceleration = ComputeLaneAcceleration(NewFollower, Index);
+				if(NewFollowerAcceleration < -LaneChangeConfig.SafeDeceleration)
+				{
+					continue;
+				}
+				NewFollowerGain = NewFollowerAcceleration - ComputeLaneAcceleration(NewFollower, NewLeader);
+			}
+
+			const float Bias = Side == 1 ? LaneChangeConfig.KeepOuterBias : -LaneChangeConfig.KeepOuterBias;
+			const float Incentive = ComputeLaneAcceleration(Index, NewLeader) - CurrentAcceleration + LaneChangeConfig.Politeness * (NewFollowerGain + OldFollowerGain) + Bias;
+			if(Incentive > BestIncentive)
+			{
+				BestIncentive = Incentive;
+				BestLane = TargetLane;
+				BestLeader = NewLeader;
+			}
+		}
+
+		// Only the neighbors of this vehicle are written, so that the kinematics follow the leader of the new lane.
+		if(BestLane != INDEX_NONE)
+		{
+			Neighbors.Leader = BestLeader;
+			VehicleLanes[Index] = BestLane;
+			LaneChangeTimers[Index] = LaneChangeConfig.Cooldown;
+		}
+	}, GetParallelForFlags(NumEntities));
+}
+
+float UTrSimulationSystem::ComputeLaneAcceleration(const int32 Follower, const int32 Leader) const
+{
+	const FTrArchetypeConstants& Constants = Archetypes[GetVehicleArchetype(Follower)];
+	const float Speed = Velocities[Follower].Size();
+	if(Leader == INDEX_NONE)
+	{
+		return ComputeIDMAcceleration(Constants, Speed, 0.0f, TNumericLimits<float>::Max(), 0.0f);
+	}
+
+	const float Gap = FMath::Max(LaneDistances[Leader] - LaneDistances[Follower], UE_KINDA_SMALL_NUMBER);
+	return ComputeIDMAcceleration(Constants, Speed, Speed - Velocities[Leader].Size(), Gap, Constants.MinimumGap);
+}
+
+void UTrSimulationSystem::UpdateGrounding()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(UTrSimulationSystem::UpdateGrounding)
+
+	const double StartTime = FPlatformTime::Seconds();
+	ParallelFor(NumEntities, [this](const int32 Index)
+	{
+		// Detached vehicles are placed by physics.
+		if(DetachedVehicles.Contains(Index))
+		{
+			return;
+		}
+
+		// Vehicles of the reduced tier are not seen up close, so only their height is kept on the road. Their normal is sampled again when they return to the full tier.
+		if(SimulationTiers[Index] != ETrSimulationTier::Full)
+		{
+			Positions[Index].Z = HeightField.SampleHeight(Network, PathEdges[Index], Positions[Index]);
+			return;
+		}
+
+		float Height;
+		HeightField.Sample(Network, PathEdges[Index], Positions[Index], Height, GroundNormals[Index]);
+		Positions[Index].Z = Height;
+	}, GetParallelForFlags(NumEntities));
+
+	TotalGroundingTime += FPlatformTime::Seconds() - StartTime;
+	NumGroundedVehicles += NumEntities - DetachedVehicles.Num();
 }
 
 void UTrSimulationSystem::UpdateCollisionData()
@@ -375,40 +1368,43 @@ void UTrSimulationSystem::UpdateCollisionData()
 	TRACE_CPUPROFILER_EVENT_SCOPE(UTrSimulationSystem::UpdateCollisionData)
 	
 	FRpSearchResults Results;
-	const float Bound = VehicleConfig.Dimensions.Y * DETECTION_RANGE_SCALE; 
-
 	const UWorld* World = GetWorld();
 	
-	for(int Index = 0; Index < NumEntities; ++Index)
-	{
-		Results.Reset();
-		const FVector& CurrentPosition = Positions[Index];
-		const FVector EndPosition = CurrentPosition + Headings[Index] * VehicleConfig.CollisionSensorRange;
-		ImplicitGrid.LineSearch(CurrentPosition, EndPosition, Results);
-
-		LeadingVehicleIndices[Index] = -1;
-		float ClosestDistance = TNumericLimits<float>().Max();
-		FTransform CurrentTransform(Headings[Index].ToOrientationRotator(), CurrentPosition);
-		uint8 Count = Results.Num();
-		for(auto Itr = Results.Array.begin(); Count > 0; --Count, ++Itr)
-		{
-			const FVector& OtherPosition = Positions[*Itr];
-			const FVector OtherLocalVector = CurrentTransform.InverseTransformPosition(OtherPosition);
-			if(OtherLocalVector.Y >= -Bound && OtherLocalVector.Y <= Bound)
+	for(int32 Chunk = 0; Chunk < Archetypes.Num(); ++Chunk)
+	{
+		const FTrArchetypeConstants& Constants = Archetypes[Chunk];
+		const float Bound = Constants.CollisionBound;
+		for(int Index = ChunkStarts[Chunk]; Index < ChunkStarts[Chunk] + ChunkCounts[Chunk]; ++Index)
+		{
+			Results.Reset();
+			const FVector& CurrentPosition = Positions[Index];
+			const FVector EndPosition = CurrentPosition + Headings[Index] * Constants.CollisionSensorRange;
+			ImplicitGrid.LineSearch(CurrentPosition, EndPosition, Results);
+
+			LeadingVehicleIndices[Index] = -1;
+			float ClosestDistance = TNumericLimits<float>().Max();
+			FTransform CurrentTransform(Headings[Index].ToOrientationRotator(), CurrentPosition);
+			uint8 Count = Results.Num();
+			for(auto Itr = Results.Array.begin(); Count > 0; --Count, ++Itr)
 			{
-				const float Distance = OtherLocalVector.X;
-				if(Distance > 0.0f && Distance < ClosestDistance)
+				const FVector& OtherPosition = Positions[*Itr];
+				const FVector OtherLocalVector = CurrentTransform.InverseTransformPosition(OtherPosition);
+				if(OtherLocalVector.Y >= -Bound && OtherLocalVector.Y <= Bound)
 				{
-					ClosestDistance = Distance;
-					LeadingVehicleIndices[Index] = *Itr;
+					const float Distance = OtherLocalVector.X;
+					if(Distance > 0.0f && Distance < ClosestDistance)
+					{
+						ClosestDistance = Distance;
+						LeadingVehicleIndices[Index] = *Itr;
+					}
 				}
 			}
-		}
 
-		if(GCollisionDebug && LeadingVehicleIndices[Index] != -1)
-		{
-			const FVector& OtherPosition = Positions[LeadingVehicleIndices[Index]];
-			DrawDebugLine(World, CurrentPosition, OtherPosition, FColor::Red, false, DEBUG_LIFETIME);
+			if(GCollisionDebug && LeadingVehicleIndices[Index] != -1)
+			{
+				const FVector& OtherPosition = Positions[LeadingVehicleIndices[Index]];
+				DrawDebugLine(World, CurrentPosition, OtherPosition, FColor::Red, false, DEBUG_LIFETIME);
+			}
 		}
 	}
 }
@@ -428,9 +1424,10 @@ void UTrSimulationSystem::DrawDebug()
 	{
 		for (int Index = 0; Index < NumEntities; ++Index)
 		{
+			const FVector& Dimensions = Archetypes[GetVehicleArchetype(Index)].Dimensions;
 			DrawGraph(World);
-			DrawDebugBox(World, Positions[Index], VehicleConfig.Dimensions, Headings[Index].ToOrientationQuat(), DebugColors[Index], false, DEBUG_LIFETIME);
-			DrawDebugDirectionalArrow(World, Positions[Index], Positions[Index] + Headings[Index] * VehicleConfig.Dimensions.X * 1.5f, 1000.0f, FColor::Red, false, DEBUG_LIFETIME);
+			DrawDebugBox(World, Positions[Index], Dimensions, Headings[Index].ToOrientationQuat(), DebugColors[Index], false, DEBUG_LIFETIME);
+			DrawDebugDirectionalArrow(World, Positions[Index], Positions[Index] + Headings[Index] * Dimensions.X * 1.5f, 1000.0f, FColor::Red, false, DEBUG_LIFETIME);
 			DrawDebugPoint(World, Goals[Index], 2.0f, DebugColors[Index], false, DEBUG_LIFETIME);
 			DrawDebugLine(World, Positions[Index], Goals[Index], DebugColors[Index], false, DEBUG_LIFETIME);
 		}
@@ -439,13 +1436,11 @@ void UTrSimulationSystem::DrawDebug()
 
 void UTrSimulationSystem::DrawGraph(const UWorld* World)
 {
-	for (const FRpSpatialGraphNode& Node : Nodes)
+	for (int32 Edge = 0; Edge < Network.GetNumEdges(); ++Edge)
 	{
-		const TArray<uint32>& Connections = Node.GetConnections();
-		for (const uint32 ConnectedNodeIndex : Connections)
-		{
-			DrawDebugLine(World, Node.GetLocation(), Nodes[ConnectedNodeIndex].GetLocation(), FColor::White, false, DEBUG_LIFETIME);
-		}
+		const FVector& Start = Network.GetNodeLocation(Network.GetEdgeStartNode(Edge));
+		const FVector& End = Network.GetNodeLocation(Network.GetEdgeEndNode(Edge));
+		DrawDebugLine(World, Start, End, FColor::White, false, DEBUG_LIFETIME);
 	}
 }
 #endif
@@ -458,5 +1453,6 @@ void UTrSimulationSystem::BeginDestroy()
 		TimerManager.ClearTimer(IntersectionTimerHandle);
 		TimerManager.ClearTimer(AmberTimerHandle);
 	}
+	Router.Reset();
 	Super::BeginDestroy();
 }
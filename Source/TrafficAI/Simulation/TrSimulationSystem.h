@@ -4,7 +4,14 @@
 
 #include "CoreMinimal.h"
 #include "FTrIntersectionManager.h"
+#include "TrContractionHierarchy.h"
+#include "TrRoadHeightField.h"
+#include "TrRoadNetwork.h"
+#include "TrRouter.h"
+#include "TrSegmentTree.h"
 #include "TrSimulationData.h"
+#include "TrTrafficRegions.h"
+#include "TrVehicleHash.h"
 #include "TrTypes.h"
 #include "Ripple/Public/RpSpatialGraphComponent.h"
 #include "SpatialAcceleration/RpImplicitGrid.h"
@@ -13,6 +20,71 @@
 
 class UTrSimulationConfiguration;
 
+/**
+ * Constants of a vehicle archetype, hoisted out of the simulation kernels.
+ * Terms that only depend on the dynamics of the archetype are computed once, instead of once per vehicle and per tick.
+ */
+struct FTrArchetypeConstants
+{
+	FTrArchetypeConstants(const FTrVehicleDynamics& Dynamics);
+
+#pragma region IDM
+	float InverseDesiredSpeed;
+	float MinimumGap;
+	float DesiredTimeHeadWay;
+	float MaximumAcceleration;
+	float MaximumDeceleration;
+	float AccelerationExponent;
+
+	// 1 / (2 * sqrt(a * b)), where a is the maximum acceleration and b the comfortable braking deceleration.
+	float InverseBrakingTerm;
+#pragma endregion
+
+#pragma region Vehicle
+	FVector Dimensions;
+	float HalfWheelBaseLength;
+	float SteeringSpeed;
+	float MaxSteeringAngle;
+	float CollisionSensorRange;
+
+	// Lateral distance within which a vehicle ahead is considered to be on the same lane.
+	float CollisionBound;
+#pragma endregion
+};
+
+// Vehicles around a vehicle, on its lane and on the neighbouring lanes of its edge, or INDEX_NONE where there is none.
+struct FTrLaneNeighbors
+{
+	int32 Leader = INDEX_NONE;
+	int32 Follower = INDEX_NONE;
+
+	// Indexed by side, 0 for the inner lane and 1 for the outer lane.
+	int32 AdjacentLeaders[2] = {INDEX_NONE, INDEX_NONE};
+	int32 AdjacentFollowers[2] = {INDEX_NONE, INDEX_NONE};
+};
+
+// Level of detail at which a vehicle is simulated.
+enum class ETrSimulationTier : uint8
+{
+	// Vehicles relevant to a focus of the representation are fully simulated.
+	Full,
+
+	// Other vehicles follow their lane and their leader, but do not change lanes, and follow the height of the road without its slope.
+	Reduced
+};
+
+// Broadcast when two vehicles exchange their dense indices. Data indexed by vehicle must be swapped accordingly.
+DECLARE_MULTICAST_DELEGATE_TwoParams(FTrOnVehiclesSwapped, const uint32, const uint32);
+
+// Broadcast before the vehicle at the given dense index, always the last one, is removed.
+DECLARE_MULTICAST_DELEGATE_OneParam(FTrOnVehicleRemoved, const uint32);
+
+// Broadcast when the vehicle at the given dense index becomes dormant, before it is removed. Listeners may store their own data in the record.
+DECLARE_MULTICAST_DELEGATE_TwoParams(FTrOnVehicleDormant, const uint32, FTrDormantVehicle&);
+
+// Broadcast when a region is loaded. Its dormant vehicles are expected to be added back to the simulation.
+DECLARE_MULTICAST_DELEGATE_OneParam(FTrOnRegionLoaded, const int32);
+
 /**
  * @class UTrSimulationSystem
  *
@@ -23,6 +95,24 @@ class UTrSimulationConfiguration;
  * the movement of vehicles on a spatial graph.
  * It tracks the positions, velocities, headings, goals, and the current paths of the vehicles.
  *
+ * Vehicle data is stored in dense arrays, preallocated up to the capacity given at initialization.
+ * Vehicles are added at the end, and removed by swapping them with the last vehicle, so both are constant time operations.
+ * Since indices change on removal, vehicles are referred to by handles outside of a frame (see FTrVehicleHandle).
+ *
+ * Vehicles of the same archetype are stored in a contiguous chunk of the dense arrays, so that kernels run over each chunk
+ * with the constants of its archetype. Adding or removing a vehicle moves at most one vehicle per chunk.
+ *
+ * When regions are enabled, only vehicles of the regions loaded around the players are simulated (see FTrRegionGrid).
+ * Vehicles entering an unloaded region are handed over through a boundary queue at the end of the tick, and become dormant.
+ * Phases that only write the data of each vehicle are run in parallel.
+ *
+ * Vehicles follow one lane of their edge. On edges with several lanes, vehicles are sorted by lane and by distance along it
+ * every tick, so that the leaders and followers of a vehicle on its own and on the neighbouring lanes are known without
+ * querying the grid, and vehicles change lanes with MOBIL.
+ *
+ * When a road height field is available, vehicles are placed on the road surface with bilinear lookups after they move,
+ * and their transforms are pitched and rolled to match the normal of the road (see FTrRoadHeightField).
+ *
  * The simulation system uses the Intelligent Driver Model to drive the vehicles,
  * and the Kinematic Bicycle Model to steer the vehicles.
  * It also uses Craig Reynold's path following algorithm to keep the vehicles on track.
@@ -43,12 +133,11 @@ public:
 	 *
 	 * @param SimData Pointer to the simulation configuration data.
 	 * @param GraphComponent Pointer to the spatial graph component used for simulation.
-	 * @param TrafficEntities Array of vehicle representations used for simulation.
-	 * @param TrafficVehicleStarts Array of vehicle path transforms for initial vehicle positions.
+	 * @param NewCapacity Maximum number of vehicles that can be simulated at once.
 	 *
 	 * @details This method initializes the simulation system with the provided simulation configuration
 	 * and data. It sets various parameters, initializes the spatial acceleration structure, and
-	 * sets up timers for traffic signal switching.
+	 * sets up timers for traffic signal switching. Vehicles are added afterwards with AddVehicle.
 	 * 
 	 * @note This method assumes that the SimData and GraphComponent
 	 * parameters are not null and have valid values.
@@ -57,19 +146,148 @@ public:
 	(
 		const UTrSimulationConfiguration* SimData,
 		const UTrSpatialGraphComponent* GraphComponent,
-		const TArray<FTransform>& InitialTransforms,
-		const TArray<FTrVehiclePathTransform>& TrafficVehicleStarts
+		const int32 NewCapacity
+	);
+
+	/**
+	 * @brief Initialize the simulation system with a road network that has already been built, or loaded from baked data.
+	 *
+	 * @param SimData Pointer to the simulation configuration data.
+	 * @param NewNetwork Road network used for simulation. Its arrays are moved into the simulation system.
+	 * @param Intersections Intersections regulated by traffic signals.
+	 * @param NewCapacity Maximum number of vehicles that can be simulated at once.
+	 */
+	void Initialize
+	(
+		const UTrSimulationConfiguration* SimData,
+		FTrRoadNetwork&& NewNetwork,
+		const TArray<FTrIntersection>& Intersections,
+		const int32 NewCapacity
 	);
 
+	/**
+	 * @brief Sets the contraction hierarchy used to plan routes. Must be called before Initialize.
+	 * The hierarchy is ignored if it was not built for the network the simulation is initialized with.
+	 */
+	void SetContractionHierarchy(const FTrContractionHierarchy& NewHierarchy) { ContractionHierarchy = NewHierarchy; }
+
+	/**
+	 * @brief Sets the road height field used to ground vehicles. Must be called before Initialize.
+	 * The field is ignored if grounding is disabled, or if it was not built for the network the simulation is initialized with.
+	 */
+	void SetHeightField(FTrRoadHeightField&& NewHeightField) { HeightField = MoveTemp(NewHeightField); }
+
+	/**
+	 * @brief Adds a vehicle to the simulation, on the given path.
+	 *
+	 * The vehicle is appended to the dense arrays, then swapped into the chunk of its archetype, which broadcasts OnVehiclesSwapped.
+	 * Listeners must have appended their own data for the new vehicle before the call.
+	 * If the path does not match an edge of the network, the vehicle starts on the lane closest to its location.
+	 *
+	 * @param Archetype Name of an archetype of the simulation configuration. The default dynamics are used if it is not found.
+	 * @param Velocity Initial velocity, for vehicles that were already moving, like dormant vehicles.
+	 * @return A handle to the vehicle, that is not set if the simulation is at capacity or has no network.
+	 */
+	FTrVehicleHandle AddVehicle(const FTransform& Transform, const FTrPath& Path, const FName Archetype = NAME_None, const FVector& Velocity = FVector::ZeroVector);
+
+	/**
+	 * @brief Removes a vehicle from the simulation.
+	 *
+	 * The vehicle is swapped to the end of the dense arrays, one chunk at a time, which broadcasts OnVehiclesSwapped,
+	 * then OnVehicleRemoved is broadcast before it is removed.
+	 * @return False if the handle does not refer to a simulated vehicle.
+	 */
+	bool RemoveVehicle(const FTrVehicleHandle Handle);
+
+	// Returns the dense index of a vehicle, or INDEX_NONE if the handle refers to a removed vehicle.
+	int32 GetVehicleIndex(const FTrVehicleHandle Handle) const
+	{
+		return SlotGenerations.IsValidIndex(Handle.Slot) && SlotGenerations[Handle.Slot] == Handle.Generation ? SlotIndices[Handle.Slot] : INDEX_NONE;
+	}
+
+	FTrVehicleHandle GetVehicleHandle(const uint32 Index) const { return {static_cast<int32>(VehicleSlots[Index]), SlotGenerations[VehicleSlots[Index]]}; }
+
+	int32 GetNumVehicles() const { return NumEntities; }
+
+	// Returns the lane of its edge that a vehicle follows.
+	int32 GetVehicleLane(const uint32 Index) const { return VehicleLanes[Index]; }
+
+	int32 GetCapacity() const { return Capacity; }
+
+	/**
+	 * @brief Moves a vehicle onto another path, keeping its speed, and starts a new trip from there.
+	 * Used to recycle vehicles instead of removing and adding them. Paths that do not match an edge are handled like in AddVehicle.
+	 */
+	void TeleportVehicle(const uint32 Index, const FTransform& Transform, const FTrPath& Path);
+
+	/**
+	 * @brief Returns true if a vehicle is closer than Distance to Location, along a lane heading in Direction.
+	 * Vehicles added since the last tick are also taken into account.
+	 */
+	bool IsLaneOccupied(const FVector& Location, const FVector& Direction, const float Distance);
+
+	/**
+	 * @brief Appends the vehicles closer than Radius to Location, found with the spatial hash built at the end of the last tick.
+	 * The hash is built again first if vehicles were added, removed or teleported since, since its indices would be stale.
+	 */
+	void FindVehiclesInRadius(const FVector& Location, const float Radius, TArray<int32>& OutVehicles);
+
 	void DetachVehicle(const uint32 Index);
+
+	/**
+	 * @brief Snaps a detached vehicle back onto the nearest lane, and lets the simulation drive it again.
+	 *
+	 * Lanes heading in the same direction as the vehicle are preferred, so that it does not rejoin traffic against the flow.
+	 * @return False if no lane was found near the vehicle, in which case it stays detached.
+	 */
+	bool ReattachVehicle(const uint32 Index, const FTransform& Transform, const FVector& Velocity);
 	
 	// No implementation required here.
 	void Initialize(FSubsystemCollectionBase& Collection) override {}
 
 	void OverrideTransform(const uint32 Index, const FTransform& Transform);
+
+	// Vehicles are added with the reduced tier, until the representation finds them relevant.
+	void SetSimulationTier(const uint32 Index, const ETrSimulationTier Tier) { SimulationTiers[Index] = Tier; }
+
+	ETrSimulationTier GetSimulationTier(const uint32 Index) const { return SimulationTiers[Index]; }
+
+	/**
+	 * @brief Sets the locations around which regions are loaded, usually the focuses of the representation.
+	 * The view points of the players are used until sources are set. The streaming sources of World Partition are always used.
+	 *
+	 * @param MinLoadingRange Regions are loaded at least this far from the sources, usually the relevancy radius of the representation.
+	 */
+	void SetStreamingSources(const TArray<FVector>& Sources, const float MinLoadingRange)
+	{
+		StreamingSources = Sources;
+		MinStreamingRange = MinLoadingRange;
+	}
 	
 	const TArray<FVector>& GetVelocities() const { return Velocities; }
 
+	// Provides access to traffic signal states and throughput metrics.
+	const FTrIntersectionManager& GetIntersectionManager() const { return IntersectionManager; }
+
+	// Provides access to route planning metrics.
+	const FTrRouter& GetRouter() const { return Router; }
+
+	const FTrRoadNetwork& GetNetwork() const { return Network; }
+
+	const FTrContractionHierarchy& GetContractionHierarchy() const { return ContractionHierarchy; }
+
+	const FTrSegmentTree& GetSegmentTree() const { return SegmentTree; }
+
+	const FTrRoadHeightField& GetHeightField() const { return HeightField; }
+
+	// Average time spent grounding 10 000 vehicles, in milliseconds.
+	double GetGroundingCost() const { return NumGroundedVehicles > 0 ? TotalGroundingTime / NumGroundedVehicles * 10000.0 * 1000.0 : 0.0; }
+
+	const FTrRegionGrid& GetRegions() const { return Regions; }
+
+	// Vehicles waiting for a region to be loaded. Vehicles that are added back must be removed from this array.
+	TArray<FTrDormantVehicle>& GetDormantVehicles(const int32 Region) { return Regions.GetRegion(Region).DormantVehicles; }
+
 	/**
 	 * @brief Update the simulation state of the vehicles.
 	 *
@@ -84,6 +302,7 @@ public:
 	 * This method retrieves the transforms of the vehicles in the simulation system.
 	 * It fills the provided array with the current positions and orientations of the vehicles.
 	 * The positions are relative to the provided position offset.
+	 * When vehicles are grounded, orientations are pitched and rolled to match the normal of the road under each vehicle.
 	 */
 	void GetVehicleTransforms(TArray<FTransform>& OutTransforms, const FVector& PositionOffset);
 	
@@ -107,12 +326,21 @@ public:
 	 */
 	static FVector ProjectPointOnPathClamped(const FVector& Point, const FTrPath& Path);
 
+	/**
+	 * @brief Projects a point onto a segment defined by its start, unit direction and length.
+	 *
+	 * Cheaper variant of ProjectPointOnPathClamped, used with the precomputed segments of the road network.
+	 *
+	 * @return The projection point, clamped to the segment.
+	 */
+	static FVector ProjectPointOnSegmentClamped(const FVector& Point, const FVector& Start, const FVector& Direction, const float Length);
+
 	/**
 	 * @brief Find the nearest path to a given entity in the simulation system.
 	 *
-	 * This method finds the nearest path to the entity with the specified index.
-	 * It calculates the distance between the entity's current position and its projection on each path in the simulation system.
-	 * The index of the path closest to the entity is returned as the nearest path.
+	 * This method finds the lane segment closest to the position the entity will reach after the look-ahead distance,
+	 * using the segment tree built over the road network.
+	 * The id of the edge of that segment is returned, or INDEX_NONE if the network is empty.
 	 */
 	int FindNearestPath(int EntityIndex, FVector& NearestProjection) const;
 
@@ -160,6 +388,14 @@ private:
 	 */
 	void HandleGoals();
 
+	/**
+	 * @brief Feeds the approach detectors of the intersections.
+	 *
+	 * A vehicle is counted in the queue of the node at the end of its path,
+	 * if it is within the detector range of that node.
+	 */
+	void UpdateDetectors();
+
 	/**
 	 * @brief Update the kinematics of all vehicles in the simulation system.
 	 *
@@ -191,53 +427,195 @@ private:
 	 */
 	void UpdateCollisionData();
 
+	/**
+	 * @brief Sorts vehicles by lane and by distance along their lane, and finds the leader and follower of every vehicle
+	 * on its lane and on the neighbouring lanes of its edge, with a single merge of each pair of neighbouring lanes.
+	 */
+	void UpdateLaneOccupancy();
+
+	/**
+	 * @brief Moves vehicles to a neighbouring lane when MOBIL finds it worthwhile and safe.
+	 * The new lane is only followed from the next goal update, so vehicles steer into it smoothly.
+	 */
+	void UpdateLaneChanges();
+
+	// IDM acceleration of a vehicle following another vehicle on the same edge, or driving freely if there is no leader.
+	float ComputeLaneAcceleration(const int32 Follower, const int32 Leader) const;
+
+	// Places vehicles on the road surface, and samples the normal of the road under them, from the road height field.
+	void UpdateGrounding();
+
 	/**
 	 * @brief Update the path of a simulation system at the given index.
 	 *
 	 * This method updates the path of a simulation system at the specified index.
-	 * It determines the new start and end node indices for the path based on the current path's end node index, connections, and eligible connections.
-	 * If there are only two connections, it chooses the other connection as the new end node index.
-	 * If there are more than two connections, it calculates the angle between the current path direction and each target path direction.
-	 * Eligible connections are those with an angle less than PI / 2.
-	 * If there are one or more eligible connections, it randomly selects one of them as the new end node index.
-	 * If there is more than one eligible connection and the node at the new start node index is blocked, the method returns without updating the path.
-	 *
+	 * The next edge is taken from the route of the vehicle. While its route is being computed, or if it has none,
+	 * the next edge is picked at random from the precomputed turn table of the current edge (see FTrRoadNetwork).
+	 * If there is more than one eligible turn and the node at the end of the current edge is blocked, the method returns without updating the path.
+	 * A new trip is started once the vehicle has reached the end of its route.
 	 */
 	void UpdatePath(const uint32 Index);
 
+	// Picks a random destination for a vehicle, and requests a route to it from its current edge.
+	void StartTrip(const uint32 Index);
+
+	// Assigns the routes completed by the router to their vehicles.
+	void UpdateRoutes();
+
+	// Exchanges the data of two vehicles, and of their slots.
+	void SwapVehicles(const uint32 IndexA, const uint32 IndexB);
+
+	// Returns the archetype of the chunk that contains a vehicle.
+	int32 GetVehicleArchetype(const uint32 Index) const;
+
+	// Returns the edge matching a path, or the edge of the lane closest to Location if there is none.
+	int32 FindStartEdge(const FVector& Location, const FTrPath& Path) const;
+
+	// Queues a vehicle for hand over if its edge belongs to another region.
+	void HandOverVehicle(const uint32 Index);
+
+	/**
+	 * @brief Moves the vehicles of the boundary queue to their new region, and streams regions in and out around the streaming sources.
+	 * Vehicles of unloaded regions become dormant.
+	 */
+	void UpdateRegions(const float DeltaSeconds);
+
+	// Stores a vehicle in its region as a dormant record, and removes it from the simulation.
+	void MakeVehicleDormant(const uint32 Index);
+
+public:
+
+	FTrOnVehiclesSwapped OnVehiclesSwapped;
+	FTrOnVehicleRemoved OnVehicleRemoved;
+	FTrOnVehicleDormant OnVehicleDormant;
+	FTrOnRegionLoaded OnRegionLoaded;
+
 protected:
 
 	FTrVehicleDynamics VehicleConfig;
+
+#pragma region Archetypes
+
+	// The first archetype uses the default vehicle dynamics.
+	TArray<FName> ArchetypeNames;
+	TArray<FTrArchetypeConstants> Archetypes;
+
+	// First vehicle and number of vehicles of the chunk of each archetype.
+	TArray<int32> ChunkStarts;
+	TArray<int32> ChunkCounts;
+
+#pragma endregion
 	FTrPathFollowingConfiguration PathFollowingConfig;
+	FTrIntersectionConfiguration IntersectionConfig;
+	FTrRoutingConfiguration RoutingConfig;
+	FTrRegionConfiguration RegionConfig;
+	FTrGroundingConfiguration GroundingConfig;
+	FTrLaneChangeConfiguration LaneChangeConfig;
 	
-	int NumEntities;
+	int NumEntities = 0;
+	int32 Capacity = 0;
 	TArray<FVector> Positions;
 	TArray<FVector> Velocities;
 	TArray<FVector> Headings;
 	TArray<FVector> Goals;
 	TArray<FTrVehiclePathTransform> PathTransforms;
+
+	// Id of the road network edge that each vehicle is following.
+	TArray<uint32> PathEdges;
+	// Destination and route of each vehicle.
+	TArray<FTrVehicleRoute> Routes;
 	TArray<int> LeadingVehicleIndices;
 	TSet<uint32> DetachedVehicles;
 
 	// todo : Use bit flags instead of bools when more than one state is available.
 	TArray<bool> PathFollowingStates;
 
+	// Region of the edge of each vehicle, or INDEX_NONE when regions are disabled.
+	TArray<int32> VehicleRegions;
+
+	// Normal of the road under each vehicle.
+	TArray<FVector> GroundNormals;
+
+	TArray<ETrSimulationTier> SimulationTiers;
+
+#pragma region Lanes
+
+	// Lane of its edge that each vehicle follows.
+	TArray<uint8> VehicleLanes;
+
+	// Time left before each vehicle may change lane again.
+	TArray<float> LaneChangeTimers;
+
+	// A vehicle on a lane, sorted by lane id then by distance.
+	struct FLaneEntry
+	{
+		uint32 Lane;
+		float Distance;
+		int32 Vehicle;
+	};
+
+	// Occupancy of the lanes, rebuilt every tick.
+	TArray<FLaneEntry> LaneEntries;
+	TArray<float> LaneDistances;
+	TArray<FTrLaneNeighbors> LaneNeighbors;
+
+#pragma endregion
+
+	// Accelerations computed before positions are integrated, so that vehicles can be updated in parallel.
+	TArray<float> Accelerations;
+
 #if !UE_BUILD_SHIPPING
 	TArray<FColor> DebugColors;
 #endif
 
+#pragma region Handles
+
+	// Slot of each vehicle.
+	TArray<uint32> VehicleSlots;
+
+	// Dense index of the vehicle of each slot, or INDEX_NONE if the slot is free.
+	TArray<int32> SlotIndices;
+	TArray<uint32> SlotGenerations;
+	TArray<uint32> FreeSlots;
+
+#pragma endregion
+
 	/**
-	 * @brief An array of FRpSpatialGraphNode objects representing the spatial graph nodes.
+	 * @brief Baked road network built from the spatial graph.
 	 *
-	 * This variable stores all the spatial graph nodes used in the simulation system.
-	 * Each node in the array represents a location or position in the spatial graph.
-	 * The nodes are used to define the connectivity and relationships between different locations in the graph.
+	 * Stores nodes, edges and turn tables in flat arrays,
+	 * so that the connectivity of the graph can be traversed without chasing pointers.
 	 */
-	TArray<FRpSpatialGraphNode> Nodes;
+	FTrRoadNetwork Network;
 	
 	FTrIntersectionManager IntersectionManager;
+	FTrRouter Router;
+
+	// Spatial index over the lane segments of the network.
+	FTrSegmentTree SegmentTree;
+	FTrContractionHierarchy ContractionHierarchy;
 	FRpImplicitGrid ImplicitGrid;
 
+	// Spatial hash of the vehicles, built at the end of each tick for queries made between ticks.
+	FTrVehicleHash VehicleHash;
+	float HashCellSize = 0.0f;
+	bool bIsVehicleHashDirty = false;
+
+	FTrRegionGrid Regions;
+	FTrRoadHeightField HeightField;
+
+	// Slots of the vehicles that changed region during the tick.
+	TArray<uint32> BoundaryQueue;
+	float RegionStreamingTimer = 0.0f;
+	TArray<FVector> StreamingSources;
+	float MinStreamingRange = 0.0f;
+
+	// Number of vehicles when the implicit grid was last updated.
+	int NumGridEntities = 0;
+
+	double TotalGroundingTime = 0.0;
+	uint64 NumGroundedVehicles = 0;
+
 private:
 
 	float TickRate;
@@ -2,10 +2,27 @@
 
 #include "TrTrafficManager.h"
 #include "RpSpatialGraphComponent.h"
+#include "Misc/Paths.h"
+#include "UObject/ObjectSaveContext.h"
 #include "TrafficAI/Representation/TrRepresentationSystem.h"
+#include "TrafficAI/Simulation/TrBakedTrafficData.h"
 #include "TrafficAI/Simulation/TrSimulationSystem.h"
 #include "TrafficAI/Utility/TrSpatialGraphComponent.h"
 
+constexpr int32 MAX_SIMULATION_STEPS_PER_FRAME = 4; // Beyond this, time is dropped rather than simulated, so a long frame does not make the next one longer.
+
+static bool GUseBakedTrafficData = true;
+static FAutoConsoleCommand CComToggleBakedTrafficData
+(
+	TEXT("Traffic.ToggleBakedData"),
+	TEXT("Toggles between baked traffic data and the spatial graph, the next time vehicles are spawned. Useful to compare startup times."),
+	FConsoleCommandDelegate::CreateLambda([]()
+	{
+		GUseBakedTrafficData = !GUseBakedTrafficData;		
+	}),
+	ECVF_Default
+);
+
 // Sets default values
 ATrTrafficManager::ATrTrafficManager()
 {
@@ -28,27 +45,279 @@ void ATrTrafficManager::BeginPlay()
 
 void ATrTrafficManager::Tick(float DeltaSeconds)
 {
+	// Vehicles are spawned over several frames, whether the simulation runs or not.
+	RepresentationSystem->ProcessSpawnRequests();
+
 	if(!bSimulate)
 	{
 		return;
 	}
-	SimulationSystem->TickSimulation(DeltaSeconds);
-	RepresentationSystem->UpdateLODs();
+
+	// The simulation steps at a fixed rate, and the representation interpolates between its last two steps every frame.
+	const float StepInterval = RepresentationSystem->GetTickRate();
+	float Alpha = 1.0f;
+	if(StepInterval <= 0.0f)
+	{
+		SimulationSystem->TickSimulation(DeltaSeconds);
+		RepresentationSystem->OnSimulationTicked();
+	}
+	else
+	{
+		SimulationTime += DeltaSeconds;
+		for(int32 Step = 0; SimulationTime >= StepInterval; ++Step)
+		{
+			if(Step == MAX_SIMULATION_STEPS_PER_FRAME)
+			{
+				SimulationTime = FMath::Fmod(SimulationTime, StepInterval);
+				break;
+			}
+
+			SimulationSystem->TickSimulation(StepInterval);
+			RepresentationSystem->OnSimulationTicked();
+			SimulationTime -= StepInterval;
+		}
+		Alpha = SimulationTime / StepInterval;
+	}
+
+	RepresentationSystem->UpdateAmbientTraffic();
+	RepresentationSystem->UpdateLODs(Alpha);
+	RepresentationSystem->UpdateVehicleControls(DeltaSeconds);
 	Super::Tick(DeltaSeconds);
 }
 
 void ATrTrafficManager::SpawnVehicles()
 {
-	RepresentationSystem->SpawnVehiclesOnGraph(SpatialGraphComponent, SpawnConfiguration);
-	SimulationSystem->Initialize(SimulationConfiguration, SpatialGraphComponent, RepresentationSystem->GetInitialTransforms(), RepresentationSystem->GetVehicleStarts());
+	check(SimulationConfiguration);
+	check(SpawnConfiguration);
+	const double StartTime = FPlatformTime::Seconds();
+
+	FTrBakedTrafficData BakedData;
+	bool bIsBaked = (HasImportedNetwork() || (bUseBakedData && GUseBakedTrafficData)) && BakedData.Load(GetBakedDataFilename());
+	if(HasImportedNetwork() && !bIsBaked)
+	{
+		UE_LOG(LogTrafficAI, Warning, TEXT("%s : Failed to load the imported network %s, falling back to the spatial graph."), *GetName(), *GetBakedDataFilename());
+	}
+	else if(bIsBaked && !HasImportedNetwork() && BakedData.GetSourceHash() != GetSourceHash())
+	{
+		UE_LOG(LogTrafficAI, Warning, TEXT("%s : Baked data %s is out of date, falling back to the spatial graph. Bake traffic data again to update it."), *GetName(), *GetBakedDataFilename());
+		bIsBaked = false;
+	}
+
+	// Ambient traffic is spawned around the player at runtime, so no starts are needed.
+	const bool bNeedsStarts = !SpawnConfiguration->bAmbientTraffic;
+	FTrRoadNetwork Network;
+	TArray<FTrVehiclePathTransform> GeneratedStarts;
+	if(bIsBaked)
+	{
+		// Imported networks do not contain vehicle starts, they depend on the spawn configuration.
+		if(bNeedsStarts && BakedData.GetVehicleStarts().IsEmpty())
+		{
+			FTrVehicleStartCreator::CreateVehicleStartsOnNetwork(BakedData.GetNetwork(), SpawnConfiguration, RepresentationSystem->GetMaxInstances(), GeneratedStarts);
+		}
+		Network = MoveTemp(BakedData.GetNetwork());
+	}
+	else
+	{
+		Network.Build(SpatialGraphComponent, SimulationConfiguration->PathFollowingConfig.PathFollowOffset);
+		if(bNeedsStarts)
+		{
+			FTrVehicleStartCreator::CreateVehicleStartsOnGraph(SpatialGraphComponent, SpawnConfiguration, RepresentationSystem->GetMaxInstances(), GeneratedStarts);
+		}
+	}
+	const double DataTime = FPlatformTime::Seconds();
+
+	// Height fields are only sampled at startup when they have not been baked, for instance on imported networks.
+	FTrRoadHeightField HeightField;
+	if(SimulationConfiguration->GroundingConfig.bEnableGrounding)
+	{
+		if(bIsBaked && BakedData.GetHeightField().IsValidFor(Network))
+		{
+			HeightField = MoveTemp(BakedData.GetHeightField());
+		}
+		else
+		{
+			UE_LOG(LogTrafficAI, Warning, TEXT("%s : No baked road height field matches the road network, sampling it with line traces at startup. %s"), *GetName(),
+				HasImportedNetwork() ? TEXT("Imported networks are baked without one.") : TEXT("Bake traffic data to avoid this cost."));
+			HeightField.Build(Network, GetWorld(), SimulationConfiguration->GroundingConfig);
+		}
+	}
+	const double GroundingTime = FPlatformTime::Seconds();
+
+	const TArray<FTrIntersection>& Intersections = bIsBaked ? BakedData.GetIntersections() : SpatialGraphComponent->GetIntersections();
+	// Both branches are lvalues, so the hierarchy is only copied once, into the simulation.
+	static const FTrContractionHierarchy NoHierarchy;
+	SimulationSystem->SetContractionHierarchy(bUseContractionHierarchy ? ContractionHierarchy : NoHierarchy);
+	SimulationSystem->SetHeightField(MoveTemp(HeightField));
+	SimulationSystem->Initialize(SimulationConfiguration, MoveTemp(Network), Intersections, RepresentationSystem->GetMaxInstances());
+	RepresentationSystem->SpawnVehicles(GeneratedStarts.IsEmpty() ? BakedData.GetVehicleStarts() : GeneratedStarts, SpawnConfiguration);
+
+	const double EndTime = FPlatformTime::Seconds();
+	UE_LOG(LogTrafficAI, Log, TEXT("Traffic startup from %s data : %d vehicles queued, network and vehicle starts %.2f ms, height field %.2f ms, total %.2f ms"),
+		bIsBaked ? TEXT("baked") : TEXT("spatial graph"), RepresentationSystem->GetNumPendingSpawns(), (DataTime - StartTime) * 1000.0, (GroundingTime - DataTime) * 1000.0, (EndTime - StartTime) * 1000.0);
 }
 
 void ATrTrafficManager::StartSimulation()
 {
 	bSimulate = true;
+	SimulationTime = 0.0f;
 }
 
 void ATrTrafficManager::StopSimulation()
 {
 	bSimulate = false;
 }
+
+bool ATrTrafficManager::BuildNetwork(FTrRoadNetwork& OutNetwork) const
+{
+	if(HasImportedNetwork())
+	{
+		FTrBakedTrafficData ImportedData;
+		if(!ImportedData.Load(GetBakedDataFilename()))
+		{
+			return false;
+		}
+		OutNetwork = MoveTemp(ImportedData.GetNetwork());
+		return true;
+	}
+
+	if(!SimulationConfiguration)
+	{
+		return false;
+	}
+	OutNetwork.Build(SpatialGraphComponent, SimulationConfiguration->PathFollowingConfig.PathFollowOffset);
+	return !OutNetwork.IsEmpty();
+}
+
+uint32 ATrTrafficManager::GetSourceHash() const
+{
+	if(!SpatialGraphComponent || !SpawnConfiguration || !SimulationConfiguration)
+	{
+		return 0;
+	}
+
+	uint32 Hash = 0;
+	const auto HashValue = [&Hash](const auto& Value)
+	{
+		Hash = FCrc::MemCrc32(&Value, sizeof(Value), Hash);
+	};
+	const auto HashArray = [&Hash](const auto& Array)
+	{
+		Hash = FCrc::MemCrc32(Array.GetData(), Array.Num() * Array.GetTypeSize(), Hash);
+	};
+
+	for(const FRpSpatialGraphNode& Node : SpatialGraphComponent->GetNodes())
+	{
+		HashValue(Node.GetLocation());
+		HashArray(Node.GetConnections());
+	}
+	for(const FTrIntersection& Intersection : SpatialGraphComponent->GetIntersections())
+	{
+		HashArray(Intersection.Nodes);
+	}
+	for(const FTrRoadLanes& Road : SpatialGraphComponent->GetRoads())
+	{
+		HashArray(Road.Nodes);
+		HashValue(Road.NumLanes);
+	}
+	HashValue(SpatialGraphComponent->GetDefaultLaneCount());
+
+	// Vehicle starts.
+	HashValue(SpawnConfiguration->Separation.GetLowerBoundValue());
+	HashValue(SpawnConfiguration->Separation.GetUpperBoundValue());
+	HashValue(SpawnConfiguration->IntersectionCutoff);
+	HashValue(SpawnConfiguration->LaneWidth);
+	HashValue(GetDefault<UTrRepresentationSystem>()->GetMaxInstances());
+
+	// Lanes and height field.
+	const FTrGroundingConfiguration& GroundingConfig = SimulationConfiguration->GroundingConfig;
+	HashValue(SimulationConfiguration->PathFollowingConfig.PathFollowOffset);
+	HashValue(GroundingConfig.bEnableGrounding);
+	HashValue(GroundingConfig.SampleSpacing);
+	HashValue(GroundingConfig.Width);
+	HashValue(GroundingConfig.NumLateralSamples);
+	HashValue(GroundingConfig.TraceHeight);
+	HashValue(GroundingConfig.TraceChannel);
+
+	// Zero is reserved for data that is not baked from a spatial graph.
+	return FMath::Max(Hash, 1u);
+}
+
+FString ATrTrafficManager::GetBakedDataFilename() const
+{
+	if(HasImportedNetwork())
+	{
+		return FPaths::IsRelative(ImportedNetworkFile.FilePath) ? FPaths::ProjectContentDir() / ImportedNetworkFile.FilePath : ImportedNetworkFile.FilePath;
+	}
+
+	const FString WorldName = GetWorld() ? UWorld::RemovePIEPrefix(GetWorld()->GetName()) : TEXT("None");
+	return FPaths::ProjectContentDir() / TEXT("Traffic") / FString::Printf(TEXT("%s_%s.trdata"), *WorldName, *GetName());
+}
+
+#if WITH_EDITOR
+void ATrTrafficManager::BakeTrafficData()
+{
+	if(!SpawnConfiguration || !SimulationConfiguration)
+	{
+		UE_LOG(LogTrafficAI, Warning, TEXT("%s : Traffic data can not be baked without a spawn and a simulation configuration."), *GetName());
+		return;
+	}
+
+	if(HasImportedNetwork())
+	{
+		UE_LOG(LogTrafficAI, Warning, TEXT("%s : Traffic data is imported from %s, re-run the importer to update it."), *GetName(), *GetBakedDataFilename());
+		return;
+	}
+
+	FTrRoadNetwork Network;
+	Network.Build(SpatialGraphComponent, SimulationConfiguration->PathFollowingConfig.PathFollowOffset);
+
+	TArray<FTrVehiclePathTransform> VehicleStarts;
+	FTrVehicleStartCreator::CreateVehicleStartsOnGraph(SpatialGraphComponent, SpawnConfiguration, GetDefault<UTrRepresentationSystem>()->GetMaxInstances(), VehicleStarts);
+
+	FTrRoadHeightField HeightField;
+	if(SimulationConfiguration->GroundingConfig.bEnableGrounding)
+	{
+		HeightField.Build(Network, GetWorld(), SimulationConfiguration->GroundingConfig);
+	}
+
+	const FString Filename = GetBakedDataFilename();
+	if(FTrBakedTrafficData::Save(Filename, Network, SpatialGraphComponent->GetIntersections(), VehicleStarts, HeightField, GetSourceHash()))
+	{
+		UE_LOG(LogTrafficAI, Log, TEXT("Baked %d nodes, %d edges, %d vehicle starts and %d height samples to %s"),
+			Network.GetNumNodes(), Network.GetNumEdges(), VehicleStarts.Num(), HeightField.GetNumSamples(), *Filename);
+	}
+	else
+	{
+		UE_LOG(LogTrafficAI, Error, TEXT("Failed to write baked traffic data to %s"), *Filename);
+	}
+}
+
+void ATrTrafficManager::BuildContractionHierarchy()
+{
+	FTrRoadNetwork Network;
+	if(!BuildNetwork(Network))
+	{
+		UE_LOG(LogTrafficAI, Warning, TEXT("%s : The contraction hierarchy can not be built without a road network."), *GetName());
+		return;
+	}
+
+	const double StartTime = FPlatformTime::Seconds();
+	Modify();
+	ContractionHierarchy.Build(Network);
+	UE_LOG(LogTrafficAI, Log, TEXT("%s : Built a contraction hierarchy over %d edges with %d shortcuts in %.2f s"),
+		*GetName(), Network.GetNumEdges(), ContractionHierarchy.GetNumShortcuts(), FPlatformTime::Seconds() - StartTime);
+}
+
+void ATrTrafficManager::PreSave(FObjectPreSaveContext SaveContext)
+{
+	Super::PreSave(SaveContext);
+	if(SaveContext.IsCooking() && bUseContractionHierarchy && !HasAnyFlags(RF_ClassDefaultObject | RF_ArchetypeObject))
+	{
+		BuildContractionHierarchy();
+	}
+	if(SaveContext.IsCooking() && bUseBakedData && !HasImportedNetwork() && !HasAnyFlags(RF_ClassDefaultObject | RF_ArchetypeObject))
+	{
+		BakeTrafficData();
+	}
+}
+#endif
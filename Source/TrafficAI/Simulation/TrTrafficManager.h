@@ -4,6 +4,7 @@
 
 #include "CoreMinimal.h"
 #include "GameFramework/Actor.h"
+#include "TrContractionHierarchy.h"
 #include "TrTrafficManager.generated.h"
 
 /**
@@ -33,6 +34,24 @@ public:
 	// Stops the simulation.
 	UFUNCTION(CallInEditor, BlueprintCallable)
 	void StopSimulation();
+
+#if WITH_EDITOR
+	/**
+	 * Bakes the road network, intersections, vehicle starts and road height field into a binary file that is loaded by SpawnVehicles.
+	 * This is done automatically when the level is cooked.
+	 */
+	UFUNCTION(CallInEditor)
+	void BakeTrafficData();
+
+	/**
+	 * Builds the contraction hierarchy used to plan routes, and stores it with the level.
+	 * This is done automatically when the level is cooked, if bUseContractionHierarchy is set.
+	 */
+	UFUNCTION(CallInEditor)
+	void BuildContractionHierarchy();
+
+	virtual void PreSave(FObjectPreSaveContext SaveContext) override;
+#endif
 	
 	virtual void Tick(float DeltaSeconds) override;
 	
@@ -40,6 +59,20 @@ protected:
 	
 	virtual void BeginPlay() override;
 
+	// Builds the road network from the imported network file when there is one, otherwise from the spatial graph.
+	bool BuildNetwork(FTrRoadNetwork& OutNetwork) const;
+
+	// Path of the baked traffic data file of this traffic manager, or of the imported network when there is one.
+	FString GetBakedDataFilename() const;
+
+	bool HasImportedNetwork() const { return !ImportedNetworkFile.FilePath.IsEmpty(); }
+
+	/**
+	 * @brief Hash of the spatial graph and of the configurations that baked data depends on.
+	 * Baked data with another hash was baked before an edit, and is not loaded.
+	 */
+	uint32 GetSourceHash() const;
+
 protected:
 
 	UPROPERTY(VisibleDefaultsOnly, Category = "Configs")
@@ -50,6 +83,24 @@ protected:
 
 	UPROPERTY(EditAnywhere, Category = "Configs")
 	TObjectPtr<class UTrSimulationConfiguration> SimulationConfiguration;
+
+	// Load the road network and vehicle starts from baked data when available, instead of building them from the spatial graph.
+	UPROPERTY(EditAnywhere, Category = "Configs")
+	bool bUseBakedData = true;
+	
+	/**
+	 * Traffic data imported from a real-world road network with the TrImportRoadNetwork commandlet.
+	 * When set, it replaces the spatial graph and is never overwritten by baking. Vehicle starts are generated at runtime.
+	 */
+	UPROPERTY(EditAnywhere, Category = "Configs", meta = (RelativeToGameContentDir, FilePathFilter = "trdata"))
+	FFilePath ImportedNetworkFile;
+	
+	// Plan routes with a precomputed contraction hierarchy instead of A*. Recommended for large networks.
+	UPROPERTY(EditAnywhere, Category = "Configs")
+	bool bUseContractionHierarchy = false;
+
+	UPROPERTY()
+	FTrContractionHierarchy ContractionHierarchy;
 	
 	UPROPERTY()
 	TObjectPtr<class UTrRepresentationSystem> RepresentationSystem;
@@ -60,5 +111,8 @@ protected:
 private:
 
 	bool bSimulate;
+
+	// Time accumulated since the last simulation step, when the simulation ticks at a fixed rate.
+	float SimulationTime = 0.0f;
 	
 };
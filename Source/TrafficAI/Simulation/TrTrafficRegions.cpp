@@ -0,0 +1,79 @@
+﻿// Copyright Anupam Sahu. All Rights Reserved.
+
+#include "TrTrafficRegions.h"
+#include "TrRoadNetwork.h"
+
+void FTrRegionGrid::Build(const FTrRoadNetwork& Network, const float NewCellSize)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(FTrRegionGrid::Build)
+
+	Reset();
+	CellSize = NewCellSize;
+	if(CellSize <= 0.0f)
+	{
+		return;
+	}
+
+	TMap<FIntPoint, int32> CellRegions;
+	TArray<int32> NodeRegions;
+	NodeRegions.SetNumUninitialized(Network.GetNumNodes());
+	for(int32 Node = 0; Node < Network.GetNumNodes(); ++Node)
+	{
+		const FIntPoint Cell = GetCell(Network.GetNodeLocation(Node));
+		if(const int32* Region = CellRegions.Find(Cell))
+		{
+			NodeRegions[Node] = *Region;
+			continue;
+		}
+
+		const FVector2D Min = FVector2D(Cell) * CellSize;
+		FTrTrafficRegion& NewRegion = Regions.AddDefaulted_GetRef();
+		NewRegion.Cell = Cell;
+		NewRegion.Bounds = FBox2D(Min, Min + FVector2D(CellSize));
+		NodeRegions[Node] = CellRegions.Add(Cell, Regions.Num() - 1);
+	}
+
+	EdgeRegions.SetNumUninitialized(Network.GetNumEdges());
+	for(int32 Edge = 0; Edge < Network.GetNumEdges(); ++Edge)
+	{
+		EdgeRegions[Edge] = NodeRegions[Network.GetEdgeStartNode(Edge)];
+	}
+}
+
+void FTrRegionGrid::Reset()
+{
+	Regions.Reset();
+	EdgeRegions.Reset();
+}
+
+void FTrRegionGrid::UpdateStreaming(const TArray<FVector>& StreamingSources, const float LoadingRange, TArray<int32>& OutLoaded, TArray<int32>& OutUnloaded)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(FTrRegionGrid::UpdateStreaming)
+
+	const float LoadingRangeSquared = FMath::Square(LoadingRange);
+	for(int32 Region = 0; Region < Regions.Num(); ++Region)
+	{
+		FTrTrafficRegion& CurrentRegion = Regions[Region];
+		bool bShouldLoad = false;
+		for(const FVector& Source : StreamingSources)
+		{
+			if(CurrentRegion.Bounds.ComputeSquaredDistanceToPoint(FVector2D(Source)) <= LoadingRangeSquared)
+			{
+				bShouldLoad = true;
+				break;
+			}
+		}
+
+		if(bShouldLoad != CurrentRegion.bIsLoaded)
+		{
+			CurrentRegion.bIsLoaded = bShouldLoad;
+			(bShouldLoad ? OutLoaded : OutUnloaded).Push(Region);
+		}
+	}
+}
+
+FIntPoint FTrRegionGrid::GetCell(const FVector& Location) const
+{
+	// Runtime grid cells are aligned with the world origin.
+	return FIntPoint(FMath::FloorToInt32(Location.X / CellSize), FMath::FloorToInt32(Location.Y / CellSize));
+}
@@ -0,0 +1,79 @@
+﻿// Copyright Anupam Sahu. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "TrTypes.h"
+
+class FTrRoadNetwork;
+class UStaticMesh;
+
+// A vehicle of an unloaded region, stored until the region is loaded again.
+struct FTrDormantVehicle
+{
+	FTransform Transform;
+	FTrPath Path;
+	FVector Velocity = FVector::ZeroVector;
+	FName Archetype;
+
+	// Variant of the vehicle, filled by the representation so that the vehicle looks the same once it is loaded again.
+	UStaticMesh* Mesh = nullptr;
+	UClass* ActorClass = nullptr;
+};
+
+// A square cell of the road network, that is simulated only while it is loaded.
+struct FTrTrafficRegion
+{
+	FIntPoint Cell;
+	FBox2D Bounds;
+	bool bIsLoaded = true;
+	TArray<FTrDormantVehicle> DormantVehicles;
+};
+
+/**
+ * @class FTrRegionGrid
+ *
+ * Splits a road network into square regions, aligned with the cells of a World Partition runtime grid of the same size.
+ *
+ * Every edge belongs to the region that contains its start node, so that a vehicle changes region when it turns onto another edge.
+ * Regions are loaded while they are within the loading range of a streaming source, and unloaded otherwise.
+ * Only regions that contain at least one node are created, so empty parts of a large world cost nothing.
+ */
+class TRAFFICAI_API FTrRegionGrid
+{
+public:
+
+	void Build(const FTrRoadNetwork& Network, const float NewCellSize);
+
+	void Reset();
+
+	bool IsEmpty() const { return Regions.Num() == 0; }
+
+	int32 GetNumRegions() const { return Regions.Num(); }
+
+	int32 GetEdgeRegion(const uint32 Edge) const { return EdgeRegions[Edge]; }
+
+	bool IsLoaded(const int32 Region) const { return Regions[Region].bIsLoaded; }
+
+	FTrTrafficRegion& GetRegion(const int32 Region) { return Regions[Region]; }
+
+	const FTrTrafficRegion& GetRegion(const int32 Region) const { return Regions[Region]; }
+
+	/**
+	 * @brief Loads the regions within LoadingRange of a streaming source, and unloads the others.
+	 *
+	 * @param OutLoaded Regions that have just been loaded.
+	 * @param OutUnloaded Regions that have just been unloaded.
+	 */
+	void UpdateStreaming(const TArray<FVector>& StreamingSources, const float LoadingRange, TArray<int32>& OutLoaded, TArray<int32>& OutUnloaded);
+
+private:
+
+	FIntPoint GetCell(const FVector& Location) const;
+
+private:
+
+	float CellSize = 0.0f;
+	TArray<FTrTrafficRegion> Regions;
+	TArray<int32> EdgeRegions;
+};
@@ -0,0 +1,97 @@
+﻿// Copyright Anupam Sahu. All Rights Reserved.
+
+#include "TrVehicleHash.h"
+#include "Algo/Unique.h"
+
+void FTrVehicleHash::Build(const TArray<FVector>& Positions, const int32 NumVehicles, const float NewCellSize)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(FTrVehicleHash::Build)
+
+	Reset();
+	if(NewCellSize <= 0.0f)
+	{
+		return;
+	}
+
+	InverseCellSize = 1.0f / NewCellSize;
+	const int32 NumBuckets = FMath::RoundUpToPowerOfTwo(FMath::Max(NumVehicles, 1));
+	BucketStarts.SetNumZeroed(NumBuckets + 1, false);
+	VehicleBuckets.SetNumUninitialized(NumVehicles, false);
+	for(int32 Index = 0; Index < NumVehicles; ++Index)
+	{
+		VehicleBuckets[Index] = GetBucket(GetCell(Positions[Index]));
+		++BucketStarts[VehicleBuckets[Index] + 1];
+	}
+
+	for(int32 Bucket = 0; Bucket < NumBuckets; ++Bucket)
+	{
+		BucketStarts[Bucket + 1] += BucketStarts[Bucket];
+	}
+
+	// Bucket starts are used as write cursors, then shifted back by one bucket.
+	Vehicles.SetNumUninitialized(NumVehicles, false);
+	for(int32 Index = 0; Index < NumVehicles; ++Index)
+	{
+		Vehicles[BucketStarts[VehicleBuckets[Index]]++] = Index;
+	}
+
+	for(int32 Bucket = NumBuckets; Bucket > 0; --Bucket)
+	{
+		BucketStarts[Bucket] = BucketStarts[Bucket - 1];
+	}
+	BucketStarts[0] = 0;
+}
+
+void FTrVehicleHash::Reset()
+{
+	InverseCellSize = 0.0f;
+	BucketStarts.Reset();
+	Vehicles.Reset();
+}
+
+void FTrVehicleHash::FindCandidates(const FVector& Location, const float Radius, TArray<int32>& OutVehicles) const
+{
+	if(Vehicles.IsEmpty())
+	{
+		return;
+	}
+
+	const int32 NumBuckets = BucketStarts.Num() - 1;
+	const FIntPoint MinCell = GetCell(Location - FVector(Radius));
+	const FIntPoint MaxCell = GetCell(Location + FVector(Radius));
+	const int64 NumCells = static_cast<int64>(MaxCell.X - MinCell.X + 1) * (MaxCell.Y - MinCell.Y + 1);
+	if(NumCells >= NumBuckets)
+	{
+		OutVehicles.Append(Vehicles);
+		return;
+	}
+
+	// Cells of the circle may share a bucket, which must only be visited once.
+	TArray<uint32, TInlineAllocator<256>> Buckets;
+	for(int32 X = MinCell.X; X <= MaxCell.X; ++X)
+	{
+		for(int32 Y = MinCell.Y; Y <= MaxCell.Y; ++Y)
+		{
+			Buckets.Push(GetBucket(FIntPoint(X, Y)));
+		}
+	}
+	Buckets.Sort();
+	Buckets.SetNum(Algo::Unique(Buckets), false);
+
+	for(const uint32 Bucket : Buckets)
+	{
+		OutVehicles.Append(Vehicles.GetData() + BucketStarts[Bucket], BucketStarts[Bucket + 1] - BucketStarts[Bucket]);
+	}
+}
+
+FIntPoint FTrVehicleHash::GetCell(const FVector& Location) const
+{
+	return FIntPoint(FMath::FloorToInt32(Location.X * InverseCellSize), FMath::FloorToInt32(Location.Y * InverseCellSize));
+}
+
+uint32 FTrVehicleHash::GetBucket(const FIntPoint& Cell) const
+{
+	// Large primes spread neighbouring cells over the table, which has a power of two size.
+	const uint32 Hash = static_cast<uint32>(Cell.X) * 73856093u ^ static_cast<uint32>(Cell.Y) * 19349663u;
+	return Hash & static_cast<uint32>(BucketStarts.Num() - 2);
+}
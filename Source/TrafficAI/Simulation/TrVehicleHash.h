@@ -0,0 +1,51 @@
+﻿// Copyright Anupam Sahu. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * @class FTrVehicleHash
+ *
+ * A spatial hash of vehicle positions, that finds the vehicles around a location without visiting all of them.
+ *
+ * Vehicles are binned into square cells of CellSize in the horizontal plane, and cells are hashed into a table
+ * with as many buckets as vehicles, so that the hash covers a world of any size with memory proportional to the traffic.
+ * Vehicles are sorted by bucket with a counting sort, so a build is linear and does not allocate once the arrays are warm.
+ * Unlike the implicit grid, queries are not bounded in range nor in number of results.
+ */
+class TRAFFICAI_API FTrVehicleHash
+{
+public:
+
+	// Hashes the first NumVehicles positions.
+	void Build(const TArray<FVector>& Positions, const int32 NumVehicles, const float NewCellSize);
+
+	void Reset();
+
+	// Number of vehicles hashed by the last build.
+	int32 GetNumVehicles() const { return Vehicles.Num(); }
+
+	/**
+	 * @brief Appends the vehicles hashed in the cells overlapping a circle, in the horizontal plane.
+	 * Candidates may lie outside of the circle, or in other cells of the same bucket, and must be filtered by distance.
+	 */
+	void FindCandidates(const FVector& Location, const float Radius, TArray<int32>& OutVehicles) const;
+
+private:
+
+	FIntPoint GetCell(const FVector& Location) const;
+
+	uint32 GetBucket(const FIntPoint& Cell) const;
+
+private:
+
+	float InverseCellSize = 0.0f;
+
+	// First vehicle of each bucket, followed by the number of vehicles. Vehicles are stored bucket by bucket.
+	TArray<int32> BucketStarts;
+	TArray<int32> Vehicles;
+
+	// Bucket of each vehicle, kept between builds to avoid allocations.
+	TArray<uint32> VehicleBuckets;
+};
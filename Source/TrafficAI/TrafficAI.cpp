@@ -1,6 +1,7 @@
 // Copyright Anupam Sahu. All Rights Reserved.
 
 #include "TrafficAI.h"
+#include "TrTypes.h"
 
 #if UE_EDITOR
 #include "ISettingsContainer.h"
@@ -11,6 +12,8 @@
 #include "Modules/ModuleManager.h"
 #include "Representation/TrRepresentationSystem.h"
 
+DEFINE_LOG_CATEGORY(LogTrafficAI);
+
 bool FTrafficAIModule::SupportsDynamicReloading()
 {
 	return true;
@@ -0,0 +1,693 @@
+﻿// Copyright Anupam Sahu. All Rights Reserved.
+
+#include "TrImportRoadNetworkCommandlet.h"
+#include "Algo/Count.h"
+#include "Algo/Unique.h"
+#include "Async/ParallelFor.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "TrafficAI/Simulation/TrBakedTrafficData.h"
+
+constexpr int64 MIN_CHUNK_SIZE = 1 << 20; // Chunks smaller than 1MB are not worth a parallel task.
+constexpr double EARTH_RADIUS = 6371000.0 * 100.0; // Mean radius of the Earth in centimeters, used to project coordinates.
+constexpr float MAX_APPROACH_RATIO = 0.4f; // Approach nodes are never placed further than this ratio of the length of a road.
+
+namespace TrRoadNetworkImport
+{
+	enum class ERecordType : uint8
+	{
+		Node,
+		Way,
+		WayNode,
+		WayHighway,
+		WayOneWay,
+		WayReverse,
+		WayEnd,
+		Edge
+	};
+
+	/**
+	 * An element parsed from the input file.
+	 * OSM nodes store their longitude and latitude in Location. Way nodes and CSV edges reference nodes by their id.
+	 */
+	struct FRecord
+	{
+		ERecordType Type;
+		bool bOneWay = false;
+		int64 Id = 0;
+		int64 OtherId = 0;
+		FVector Location = FVector::ZeroVector;
+	};
+
+	// A directed road graph, before junctions are expanded into intersections.
+	struct FRawGraph
+	{
+		TArray<FVector> Locations;
+		TArray<TPair<int32, int32>> Edges;
+	};
+
+#pragma region Parsing
+
+	const ANSICHAR* FindChar(const ANSICHAR* Cursor, const ANSICHAR* End, const ANSICHAR Char)
+	{
+		while(Cursor < End && *Cursor != Char)
+		{
+			++Cursor;
+		}
+		return Cursor;
+	}
+
+	bool StartsWith(const ANSICHAR* Begin, const ANSICHAR* End, const ANSICHAR* Prefix)
+	{
+		const int32 Length = FCStringAnsi::Strlen(Prefix);
+		return End - Begin >= Length && FCStringAnsi::Strncmp(Begin, Prefix, Length) == 0;
+	}
+
+	// Returns the value of an XML attribute of the element [Begin, End), or nullptr if the element does not have this attribute.
+	const ANSICHAR* FindAttribute(const ANSICHAR* Begin, const ANSICHAR* End, const ANSICHAR* Name)
+	{
+		const int32 Length = FCStringAnsi::Strlen(Name);
+		for(const ANSICHAR* Cursor = Begin + 1; Cursor + Length + 2 <= End; ++Cursor)
+		{
+			// Attribute names are preceded by whitespace, so that "id" does not match "uid".
+			if(FCharAnsi::IsWhitespace(Cursor[-1]) && FCStringAnsi::Strncmp(Cursor, Name, Length) == 0 && Cursor[Length] == '=')
+			{
+				const ANSICHAR Quote = Cursor[Length + 1];
+				if(Quote == '"' || Quote == '\'')
+				{
+					return Cursor + Length + 2;
+				}
+			}
+		}
+		return nullptr;
+	}
+
+	bool AttributeEquals(const ANSICHAR* Value, const ANSICHAR* Expected)
+	{
+		const int32 Length = FCStringAnsi::Strlen(Expected);
+		return Value && FCStringAnsi::Strncmp(Value, Expected, Length) == 0 && (Value[Length] == '"' || Value[Length] == '\'');
+	}
+
+	bool IsDrivableHighway(const ANSICHAR* Value)
+	{
+		static const ANSICHAR* DrivableTypes[] =
+		{
+			"motorway", "trunk", "primary", "secondary", "tertiary", "unclassified", "residential", "living_street", "service", "road",
+			"motorway_link", "trunk_link", "primary_link", "secondary_link", "tertiary_link"
+		};
+
+		for(const ANSICHAR* Type : DrivableTypes)
+		{
+			if(AttributeEquals(Value, Type))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Parses the OSM XML elements that begin in [Cursor, ChunkEnd). Elements may end after ChunkEnd.
+	void ParseOsmChunk(const ANSICHAR* Cursor, const ANSICHAR* ChunkEnd, const ANSICHAR* End, TArray<FRecord>& OutRecords)
+	{
+		while((Cursor = FindChar(Cursor, ChunkEnd, '<')) < ChunkEnd)
+		{
+			const ANSICHAR* ElementBegin = Cursor + 1;
+			const ANSICHAR* ElementEnd = FindChar(ElementBegin, End, '>');
+			Cursor = ElementEnd;
+
+			FRecord Record;
+			if(StartsWith(ElementBegin, ElementEnd, "node "))
+			{
+				const ANSICHAR* Id = FindAttribute(ElementBegin, ElementEnd, "id");
+				const ANSICHAR* Latitude = FindAttribute(ElementBegin, ElementEnd, "lat");
+				const ANSICHAR* Longitude = FindAttribute(ElementBegin, ElementEnd, "lon");
+				if(Id && Latitude && Longitude)
+				{
+					Record.Type = ERecordType::Node;
+					Record.Id = FCStringAnsi::Strtoi64(Id, nullptr, 10);
+					Record.Location = FVector(FCStringAnsi::Atod(Longitude), FCStringAnsi::Atod(Latitude), 0.0);
+					OutRecords.Push(Record);
+				}
+			}
+			else if(StartsWith(ElementBegin, ElementEnd, "way "))
+			{
+				Record.Type = ERecordType::Way;
+				OutRecords.Push(Record);
+				if(ElementEnd[-1] == '/')
+				{
+					Record.Type = ERecordType::WayEnd;
+					OutRecords.Push(Record);
+				}
+			}
+			else if(StartsWith(ElementBegin, ElementEnd, "nd "))
+			{
+				if(const ANSICHAR* Reference = FindAttribute(ElementBegin, ElementEnd, "ref"))
+				{
+					Record.Type = ERecordType::WayNode;
+					Record.Id = FCStringAnsi::Strtoi64(Reference, nullptr, 10);
+					OutRecords.Push(Record);
+				}
+			}
+			else if(StartsWith(ElementBegin, ElementEnd, "tag "))
+			{
+				const ANSICHAR* Key = FindAttribute(ElementBegin, ElementEnd, "k");
+				const ANSICHAR* Value = FindAttribute(ElementBegin, ElementEnd, "v");
+				if(AttributeEquals(Key, "highway") && IsDrivableHighway(Value))
+				{
+					Record.Type = ERecordType::WayHighway;
+					OutRecords.Push(Record);
+				}
+				else if((AttributeEquals(Key, "oneway") && (AttributeEquals(Value, "yes") || AttributeEquals(Value, "1") || AttributeEquals(Value, "true")))
+					|| (AttributeEquals(Key, "junction") && AttributeEquals(Value, "roundabout")))
+				{
+					Record.Type = ERecordType::WayOneWay;
+					OutRecords.Push(Record);
+				}
+				else if(AttributeEquals(Key, "oneway") && AttributeEquals(Value, "-1"))
+				{
+					Record.Type = ERecordType::WayReverse;
+					OutRecords.Push(Record);
+				}
+			}
+			else if(StartsWith(ElementBegin, ElementEnd, "/way"))
+			{
+				Record.Type = ERecordType::WayEnd;
+				OutRecords.Push(Record);
+			}
+		}
+	}
+
+	// Returns the beginning of the next comma separated field, or LineEnd.
+	const ANSICHAR* NextField(const ANSICHAR* Cursor, const ANSICHAR* LineEnd)
+	{
+		Cursor = FindChar(Cursor, LineEnd, ',');
+		return Cursor < LineEnd ? Cursor + 1 : LineEnd;
+	}
+
+	// Parses the CSV lines that begin in [Cursor, ChunkEnd).
+	void ParseCsvChunk(const ANSICHAR* Cursor, const ANSICHAR* ChunkEnd, const ANSICHAR* End, TArray<FRecord>& OutRecords)
+	{
+		while(Cursor < ChunkEnd)
+		{
+			const ANSICHAR* LineEnd = FindChar(Cursor, End, '\n');
+
+			FRecord Record;
+			if(StartsWith(Cursor, LineEnd, "node,"))
+			{
+				const ANSICHAR* Field = NextField(Cursor, LineEnd);
+				Record.Type = ERecordType::Node;
+				Record.Id = FCStringAnsi::Strtoi64(Field, nullptr, 10);
+				Field = NextField(Field, LineEnd);
+				Record.Location.X = FCStringAnsi::Atod(Field);
+				Field = NextField(Field, LineEnd);
+				Record.Location.Y = FCStringAnsi::Atod(Field);
+				Field = NextField(Field, LineEnd);
+				Record.Location.Z = Field < LineEnd ? FCStringAnsi::Atod(Field) : 0.0;
+				OutRecords.Push(Record);
+			}
+			else if(StartsWith(Cursor, LineEnd, "edge,"))
+			{
+				const ANSICHAR* Field = NextField(Cursor, LineEnd);
+				Record.Type = ERecordType::Edge;
+				Record.Id = FCStringAnsi::Strtoi64(Field, nullptr, 10);
+				Field = NextField(Field, LineEnd);
+				Record.OtherId = FCStringAnsi::Strtoi64(Field, nullptr, 10);
+				Field = NextField(Field, LineEnd);
+				Record.bOneWay = Field < LineEnd && *Field == '1';
+				OutRecords.Push(Record);
+			}
+
+			Cursor = LineEnd + 1;
+		}
+	}
+
+	/**
+	 * Splits [Begin, End) into chunks that begin at a delimiter and parses them in parallel.
+	 * Records of each chunk are stored separately, in the order they appear in the file.
+	 */
+	template<typename ChunkParserType>
+	void ParseInParallel(const ANSICHAR* Begin, const ANSICHAR* End, const ANSICHAR Delimiter, const bool bSkipDelimiter, ChunkParserType ChunkParser, TArray<TArray<FRecord>>& OutChunks)
+	{
+		const int64 Size = End - Begin;
+		const int32 NumChunks = static_cast<int32>(FMath::Clamp<int64>(Size / MIN_CHUNK_SIZE, 1, FPlatformMisc::NumberOfCoresIncludingHyperthreads() * 4));
+
+		auto GetChunkBoundary = [Begin, End, Size, NumChunks, Delimiter, bSkipDelimiter](const int32 ChunkIndex) -> const ANSICHAR*
+		{
+			if(ChunkIndex == 0 || ChunkIndex == NumChunks)
+			{
+				return ChunkIndex == 0 ? Begin : End;
+			}
+
+			const ANSICHAR* Boundary = FindChar(Begin + Size * ChunkIndex / NumChunks, End, Delimiter);
+			return bSkipDelimiter && Boundary < End ? Boundary + 1 : Boundary;
+		};
+
+		OutChunks.SetNum(NumChunks);
+		ParallelFor(NumChunks, [&](const int32 ChunkIndex)
+		{
+			ChunkParser(GetChunkBoundary(ChunkIndex), GetChunkBoundary(ChunkIndex + 1), End, OutChunks[ChunkIndex]);
+		});
+	}
+
+#pragma endregion
+
+#pragma region Graph
+
+	bool BuildOsmGraph(const TArray<TArray<FRecord>>& Chunks, FRawGraph& OutGraph)
+	{
+		// Coordinates of all nodes in the extract, most of them do not belong to roads.
+		int32 NumNodes = 0;
+		for(const TArray<FRecord>& Records : Chunks)
+		{
+			NumNodes += Algo::CountIf(Records, [](const FRecord& Record) { return Record.Type == ERecordType::Node; });
+		}
+
+		TMap<int64, int32> NodeIndices;
+		TArray<FVector> Coordinates;
+		NodeIndices.Reserve(NumNodes);
+		Coordinates.Reserve(NumNodes);
+		for(const TArray<FRecord>& Records : Chunks)
+		{
+			for(const FRecord& Record : Records)
+			{
+				if(Record.Type == ERecordType::Node)
+				{
+					NodeIndices.Add(Record.Id, Coordinates.Num());
+					Coordinates.Push(Record.Location);
+				}
+			}
+		}
+
+		// Ways are assembled sequentially, since they may span several chunks.
+		TArray<TPair<int32, int32>> Edges;
+		TArray<int32> WayNodes;
+		bool bIsInWay = false;
+		bool bIsDrivable = false;
+		int32 Direction = 0;
+		int32 NumSkippedSegments = 0;
+		for(const TArray<FRecord>& Records : Chunks)
+		{
+			for(const FRecord& Record : Records)
+			{
+				switch(Record.Type)
+				{
+				case ERecordType::Way:
+					bIsInWay = true;
+					bIsDrivable = false;
+					Direction = 0;
+					WayNodes.Reset();
+					break;
+				case ERecordType::WayNode:
+					// Nodes missing from the extract break the way, rather than joining the nodes around them.
+					if(bIsInWay)
+					{
+						const int32* NodeIndex = NodeIndices.Find(Record.Id);
+						WayNodes.Push(NodeIndex ? *NodeIndex : INDEX_NONE);
+					}
+					break;
+				case ERecordType::WayHighway:
+					bIsDrivable |= bIsInWay;
+					break;
+				case ERecordType::WayOneWay:
+					Direction = bIsInWay ? 1 : Direction;
+					break;
+				case ERecordType::WayReverse:
+					Direction = bIsInWay ? -1 : Direction;
+					break;
+				case ERecordType::WayEnd:
+					for(int Index = 0; bIsInWay && bIsDrivable && Index < WayNodes.Num() - 1; ++Index)
+					{
+						if(WayNodes[Index] == INDEX_NONE || WayNodes[Index + 1] == INDEX_NONE)
+						{
+							++NumSkippedSegments;
+							continue;
+						}
+						if(Direction >= 0)
+						{
+							Edges.Push({WayNodes[Index], WayNodes[Index + 1]});
+						}
+						if(Direction <= 0)
+						{
+							Edges.Push({WayNodes[Index + 1], WayNodes[Index]});
+						}
+					}
+					bIsInWay = false;
+					break;
+				default:
+					break;
+				}
+			}
+		}
+
+		if(NumSkippedSegments > 0)
+		{
+			UE_LOG(LogTrafficAI, Warning, TEXT("Skipped %d road segments whose nodes are missing from the extract."), NumSkippedSegments);
+		}
+
+		// Keep the nodes that belong to roads only, and project them on a plane tangent to the center of the extract.
+		TArray<int32> Remap;
+		Remap.Init(INDEX_NONE, Coordinates.Num());
+		FVector Center = FVector::ZeroVector;
+		int32 NumRoadNodes = 0;
+		for(const TPair<int32, int32>& Edge : Edges)
+		{
+			for(const int32 Node : {Edge.Key, Edge.Value})
+			{
+				if(Remap[Node] == INDEX_NONE)
+				{
+					Remap[Node] = NumRoadNodes++;
+					Center += Coordinates[Node];
+				}
+			}
+		}
+
+		if(NumRoadNodes == 0)
+		{
+			return false;
+		}
+		Center /= NumRoadNodes;
+
+		// Unreal's Y axis points south when X points east, seen from above.
+		const double CosLatitude = FMath::Cos(FMath::DegreesToRadians(Center.Y));
+		OutGraph.Locations.SetNumUninitialized(NumRoadNodes);
+		for(int32 Node = 0; Node < Coordinates.Num(); ++Node)
+		{
+			if(Remap[Node] != INDEX_NONE)
+			{
+				const FVector Offset = Coordinates[Node] - Center;
+				OutGraph.Locations[Remap[Node]] = FVector
+				(
+					FMath::DegreesToRadians(Offset.X) * CosLatitude * EARTH_RADIUS,
+					-FMath::DegreesToRadians(Offset.Y) * EARTH_RADIUS,
+					0.0
+				);
+			}
+		}
+
+		OutGraph.Edges.Reset(Edges.Num());
+		for(const TPair<int32, int32>& Edge : Edges)
+		{
+			OutGraph.Edges.Push({Remap[Edge.Key], Remap[Edge.Value]});
+		}
+		return true;
+	}
+
+	bool BuildCsvGraph(const TArray<TArray<FRecord>>& Chunks, FRawGraph& OutGraph)
+	{
+		TMap<int64, int32> NodeIndices;
+		for(const TArray<FRecord>& Records : Chunks)
+		{
+			for(const FRecord& Record : Records)
+			{
+				if(Record.Type == ERecordType::Node)
+				{
+					NodeIndices.Add(Record.Id, OutGraph.Locations.Num());
+					OutGraph.Locations.Push(Record.Location);
+				}
+			}
+		}
+
+		for(const TArray<FRecord>& Records : Chunks)
+		{
+			for(const FRecord& Record : Records)
+			{
+				const int32* From = NodeIndices.Find(Record.Id);
+				const int32* To = NodeIndices.Find(Record.OtherId);
+				if(Record.Type == ERecordType::Edge && From && To)
+				{
+					OutGraph.Edges.Push({*From, *To});
+					if(!Record.bOneWay)
+					{
+						OutGraph.Edges.Push({*To, *From});
+					}
+				}
+			}
+		}
+
+		return OutGraph.Edges.Num() > 0;
+	}
+
+	/**
+	 * Replaces every node shared by three or more roads with an intersection.
+	 *
+	 * For each road leading to the junction, an entry node and an exit node are placed on the road, ApproachDistance away from the junction.
+	 * Entry nodes are connected to the exits of all other roads and form the intersection, so each road gets its own signal phase.
+	 * Exits are not signalized, so vehicles leaving the intersection never wait for a green light.
+	 */
+	void ExpandIntersections(FRawGraph& Graph, const float ApproachDistance, TArray<FTrIntersection>& OutIntersections)
+	{
+		Graph.Edges.RemoveAllSwap([](const TPair<int32, int32>& Edge) { return Edge.Key == Edge.Value; });
+		Graph.Edges.Sort([](const TPair<int32, int32>& A, const TPair<int32, int32>& B)
+		{
+			return A.Key != B.Key ? A.Key < B.Key : A.Value < B.Value;
+		});
+		Graph.Edges.SetNum(Algo::Unique(Graph.Edges));
+
+		const int32 NumNodes = Graph.Locations.Num();
+		TSet<TPair<int32, int32>> EdgeSet(Graph.Edges);
+		TArray<TArray<int32>> Neighbors;
+		Neighbors.SetNum(NumNodes);
+		for(const TPair<int32, int32>& Edge : Graph.Edges)
+		{
+			Neighbors[Edge.Key].AddUnique(Edge.Value);
+			Neighbors[Edge.Value].AddUnique(Edge.Key);
+		}
+
+		// Approach nodes of each (junction, neighbor) pair.
+		TMap<TPair<int32, int32>, int32> Entries;
+		TMap<TPair<int32, int32>, int32> Exits;
+		for(int32 Junction = 0; Junction < NumNodes; ++Junction)
+		{
+			if(Neighbors[Junction].Num() < 3)
+			{
+				continue;
+			}
+
+			for(const int32 Neighbor : Neighbors[Junction])
+			{
+				const FVector ToNeighbor = Graph.Locations[Neighbor] - Graph.Locations[Junction];
+				const FVector Location = Graph.Locations[Junction] + ToNeighbor.GetSafeNormal() * FMath::Min<double>(ApproachDistance, ToNeighbor.Length() * MAX_APPROACH_RATIO);
+				if(EdgeSet.Contains({Neighbor, Junction}))
+				{
+					Entries.Add({Junction, Neighbor}, Graph.Locations.Add(Location));
+				}
+				if(EdgeSet.Contains({Junction, Neighbor}))
+				{
+					Exits.Add({Junction, Neighbor}, Graph.Locations.Add(Location));
+				}
+			}
+		}
+
+		TArray<TPair<int32, int32>> NewEdges;
+		NewEdges.Reserve(Graph.Edges.Num() + Entries.Num() * 3);
+		for(const TPair<int32, int32>& Edge : Graph.Edges)
+		{
+			const int32* Source = Exits.Find({Edge.Key, Edge.Value});
+			const int32* Target = Entries.Find({Edge.Value, Edge.Key});
+			NewEdges.Push({Source ? *Source : Edge.Key, Target ? *Target : Edge.Value});
+		}
+
+		for(int32 Junction = 0; Junction < NumNodes; ++Junction)
+		{
+			if(Neighbors[Junction].Num() < 3)
+			{
+				continue;
+			}
+
+			FTrIntersection Intersection;
+			for(const int32 From : Neighbors[Junction])
+			{
+				const int32* Entry = Entries.Find({Junction, From});
+				if(!Entry)
+				{
+					continue;
+				}
+
+				Intersection.Nodes.Push(*Entry);
+				for(const int32 To : Neighbors[Junction])
+				{
+					const int32* Exit = Exits.Find({Junction, To});
+					if(To != From && Exit)
+					{
+						NewEdges.Push({*Entry, *Exit});
+					}
+				}
+			}
+
+			if(Intersection.Nodes.Num() > 1)
+			{
+				OutIntersections.Push(Intersection);
+			}
+		}
+
+		Graph.Edges = MoveTemp(NewEdges);
+	}
+
+	/**
+	 * Converts the graph to the CSR form expected by FTrRoadNetwork, and removes nodes without connections.
+	 * Connections to plain road nodes are listed before connections to approach nodes,
+	 * so that a vehicle leaving an intersection through a road node continues on the road instead of turning back.
+	 */
+	void BuildAdjacency
+	(
+		FRawGraph& Graph,
+		const int32 NumRoadNodes,
+		TArray<FVector>& OutLocations,
+		TArray<uint32>& OutOffsets,
+		TArray<uint32>& OutAdjacency,
+		TArray<FTrIntersection>& InOutIntersections
+	)
+	{
+		TArray<int32> Remap;
+		Remap.Init(INDEX_NONE, Graph.Locations.Num());
+		for(const TPair<int32, int32>& Edge : Graph.Edges)
+		{
+			Remap[Edge.Key] = 0;
+			Remap[Edge.Value] = 0;
+		}
+
+		OutLocations.Reset();
+		for(int32 Node = 0; Node < Graph.Locations.Num(); ++Node)
+		{
+			if(Remap[Node] != INDEX_NONE)
+			{
+				Remap[Node] = OutLocations.Add(Graph.Locations[Node]);
+			}
+		}
+
+		Graph.Edges.StableSort([NumRoadNodes](const TPair<int32, int32>& A, const TPair<int32, int32>& B)
+		{
+			const bool bIsApproachA = A.Value >= NumRoadNodes;
+			const bool bIsApproachB = B.Value >= NumRoadNodes;
+			return A.Key != B.Key ? A.Key < B.Key : bIsApproachA < bIsApproachB;
+		});
+
+		OutOffsets.Init(0, OutLocations.Num() + 1);
+		OutAdjacency.Reset(Graph.Edges.Num());
+		for(const TPair<int32, int32>& Edge : Graph.Edges)
+		{
+			++OutOffsets[Remap[Edge.Key] + 1];
+			OutAdjacency.Push(Remap[Edge.Value]);
+		}
+		for(int32 Node = 0; Node < OutLocations.Num(); ++Node)
+		{
+			OutOffsets[Node + 1] += OutOffsets[Node];
+		}
+
+		for(FTrIntersection& Intersection : InOutIntersections)
+		{
+			for(uint32& Node : Intersection.Nodes)
+			{
+				Node = Remap[Node];
+			}
+		}
+	}
+
+#pragma endregion
+}
+
+UTrImportRoadNetworkCommandlet::UTrImportRoadNetworkCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = false;
+	LogToConsole = true;
+
+	HelpDescription = TEXT("Imports an OpenStreetMap XML extract or a CSV node/edge list into baked traffic data.");
+	HelpUsage = TEXT("-run=TrImportRoadNetwork -input=<file.osm|file.csv> -output=<file.trdata> [-laneoffset=250] [-lanes=1] [-approachdistance=1000]");
+}
+
+int32 UTrImportRoadNetworkCommandlet::Main(const FString& Params)
+{
+	using namespace TrRoadNetworkImport;
+
+	FString InputFilename;
+	FString OutputFilename;
+	float LaneOffset = 250.0f;
+	float ApproachDistance = 1000.0f;
+	int32 NumLanes = 1;
+	if(!FParse::Value(*Params, TEXT("input="), InputFilename) || !FParse::Value(*Params, TEXT("output="), OutputFilename))
+	{
+		UE_LOG(LogTrafficAI, Error, TEXT("Usage : %s"), *HelpUsage);
+		return 1;
+	}
+	FParse::Value(*Params, TEXT("laneoffset="), LaneOffset);
+	FParse::Value(*Params, TEXT("approachdistance="), ApproachDistance);
+	FParse::Value(*Params, TEXT("lanes="), NumLanes);
+
+	const FString Extension = FPaths::GetExtension(InputFilename).ToLower();
+	if(Extension == TEXT("pbf"))
+	{
+		UE_LOG(LogTrafficAI, Error, TEXT("PBF extracts are not supported, convert them to OSM XML first (e.g. osmium cat extract.osm.pbf -o extract.osm)."));
+		return 1;
+	}
+	if(Extension != TEXT("osm") && Extension != TEXT("csv"))
+	{
+		UE_LOG(LogTrafficAI, Error, TEXT("Unsupported input format '%s', expected .osm or .csv."), *Extension);
+		return 1;
+	}
+
+	const double StartTime = FPlatformTime::Seconds();
+	TArray64<uint8> Buffer;
+	if(!FFileHelper::LoadFileToArray(Buffer, *InputFilename))
+	{
+		UE_LOG(LogTrafficAI, Error, TEXT("Failed to read %s"), *InputFilename);
+		return 1;
+	}
+
+	// Numbers are parsed with C string functions, that require a terminator at the end of the buffer.
+	Buffer.Add(0);
+	const ANSICHAR* Begin = reinterpret_cast<const ANSICHAR*>(Buffer.GetData());
+	const ANSICHAR* End = Begin + Buffer.Num() - 1;
+	const double ReadTime = FPlatformTime::Seconds();
+
+	TArray<TArray<FRecord>> Chunks;
+	FRawGraph Graph;
+	bool bIsValid;
+	if(Extension == TEXT("osm"))
+	{
+		ParseInParallel(Begin, End, '<', false, &ParseOsmChunk, Chunks);
+		bIsValid = BuildOsmGraph(Chunks, Graph);
+	}
+	else
+	{
+		ParseInParallel(Begin, End, '\n', true, &ParseCsvChunk, Chunks);
+		bIsValid = BuildCsvGraph(Chunks, Graph);
+	}
+	const double ParseTime = FPlatformTime::Seconds();
+
+	if(!bIsValid)
+	{
+		UE_LOG(LogTrafficAI, Error, TEXT("%s does not contain any road."), *InputFilename);
+		return 1;
+	}
+
+	TArray<FTrIntersection> Intersections;
+	const int32 NumRoadNodes = Graph.Locations.Num();
+	ExpandIntersections(Graph, ApproachDistance, Intersections);
+
+	TArray<FVector> Locations;
+	TArray<uint32> Offsets;
+	TArray<uint32> Adjacency;
+	BuildAdjacency(Graph, NumRoadNodes, Locations, Offsets, Adjacency, Intersections);
+
+	FTrRoadNetwork Network;
+	Network.Build(Locations, Offsets, Adjacency, LaneOffset);
+
+	TArray<uint8> LaneCounts;
+	LaneCounts.Init(FMath::Clamp(NumLanes, 1, MAX_uint8), Network.GetNumEdges());
+	Network.SetLaneCounts(LaneCounts);
+	const double BuildTime = FPlatformTime::Seconds();
+
+	// Vehicle starts are generated at runtime from the spawn configuration of the traffic manager.
+	if(!FTrBakedTrafficData::Save(OutputFilename, Network, Intersections, TArray<FTrVehiclePathTransform>(), FTrRoadHeightField()))
+	{
+		UE_LOG(LogTrafficAI, Error, TEXT("Failed to write %s"), *OutputFilename);
+		return 1;
+	}
+
+	UE_LOG(LogTrafficAI, Display, TEXT("Imported %d nodes, %d edges and %d intersections to %s"), Network.GetNumNodes(), Network.GetNumEdges(), Intersections.Num(), *OutputFilename);
+	UE_LOG(LogTrafficAI, Display, TEXT("Read %.2f s, parse (%d chunks) %.2f s, build %.2f s, total %.2f s"),
+		ReadTime - StartTime, Chunks.Num(), ParseTime - ReadTime, BuildTime - ParseTime, FPlatformTime::Seconds() - StartTime);
+	return 0;
+}
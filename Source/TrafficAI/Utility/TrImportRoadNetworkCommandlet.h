@@ -0,0 +1,33 @@
+﻿// Copyright Anupam Sahu. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "TrImportRoadNetworkCommandlet.generated.h"
+
+/**
+ * Imports a large road network into baked traffic data (see FTrBakedTrafficData), that a traffic manager can load instead of its spatial graph.
+ *
+ * Supported inputs:
+ * - OpenStreetMap XML extracts (.osm). Only ways tagged as drivable highways are imported, one-way tags are respected.
+ * - A simple CSV format (.csv), with one element per line, coordinates in centimeters :
+ *		node,<id>,<x>,<y>,<z>
+ *		edge,<from id>,<to id>[,<1 if one-way>]
+ *
+ * The input is split into chunks that are parsed in parallel.
+ * Every node shared by three or more roads is expanded into an intersection, with one signalized entry node and one exit node per approach.
+ *
+ * Usage : UnrealEditor-Cmd TrafficAI.uproject -run=TrImportRoadNetwork -input=<file> -output=<file.trdata> [-laneoffset=250] [-approachdistance=1000]
+ */
+UCLASS()
+class TRAFFICAI_API UTrImportRoadNetworkCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+
+	UTrImportRoadNetworkCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+};
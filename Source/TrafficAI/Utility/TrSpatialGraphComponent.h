@@ -16,6 +16,20 @@ struct FTrIntersection
 	TArray<uint32> Nodes;
 };
 
+// A road with more lanes than the default, defined by the sequence of nodes it goes through.
+USTRUCT()
+struct FTrRoadLanes
+{
+	GENERATED_BODY()
+
+	UPROPERTY(EditAnywhere)
+	TArray<uint32> Nodes;
+
+	// Number of lanes in each direction.
+	UPROPERTY(EditAnywhere, meta = (UIMin = 1, ClampMin = 1))
+	uint8 NumLanes = 2;
+};
+
 UCLASS(ClassGroup=(Custom), meta=(BlueprintSpawnableComponent))
 class TRAFFICAI_API UTrSpatialGraphComponent : public URpSpatialGraphComponent
 {
@@ -24,10 +38,21 @@ class TRAFFICAI_API UTrSpatialGraphComponent : public URpSpatialGraphComponent
 public:
 
 	const TArray<FTrIntersection>& GetIntersections() const { return Intersections; }
+
+	const TArray<FTrRoadLanes>& GetRoads() const { return Roads; }
+
+	uint8 GetDefaultLaneCount() const { return DefaultLaneCount; }
 	
 private:
 
 	UPROPERTY(EditAnywhere, Category = "Intersections")
 	TArray<FTrIntersection> Intersections;	
+
+	// Number of lanes in each direction of the roads that are not listed in Roads.
+	UPROPERTY(EditAnywhere, Category = "Lanes", meta = (UIMin = 1, ClampMin = 1))
+	uint8 DefaultLaneCount = 1;
+
+	UPROPERTY(EditAnywhere, Category = "Lanes")
+	TArray<FTrRoadLanes> Roads;
 	
 };
@@ -1,51 +1,36 @@
 ﻿// Copyright Anupam Sahu. All Rights Reserved.
 
 #include "TrVehicle.h"
+#include "TrVehicleMovementComponent.h"
 
-#include "ChaosVehicleMovementComponent.h"
 #include "GameFramework/PlayerController.h"
 
-void ATrVehicle::BeginPlay()
+ATrVehicle::ATrVehicle(const FObjectInitializer& ObjectInitializer)
+	: Super(ObjectInitializer.SetDefaultSubobjectClass<UTrVehicleMovementComponent>(AWheeledVehiclePawn::VehicleMovementComponentName))
 {
-	ThrottleController.Tune(ThrottleKp, ThrottleKi, ThrottleKd);
-	SteeringController.Tune(SteeringKp, SteeringKi, SteeringKd);
-	Super::BeginPlay();
-}
-
-void ATrVehicle::Tick(float DeltaSeconds)
-{
-	Super::Tick(DeltaSeconds);
-	if(!IsPlayerControlled())
-	{
-		USkeletalMeshComponent* Root = GetMesh();
-		UChaosVehicleMovementComponent* VehicleMovement = GetVehicleMovementComponent();
-
-		const FVector VecToTarget = DesiredTransform.GetLocation() - Root->GetComponentLocation();
-		const float LocationError = VecToTarget.Length();
-
-		const float PIDThrust = ThrottleController.Evaluate(LocationError, DeltaSeconds);
-		Root->AddForce(PIDThrust * VecToTarget.GetSafeNormal(), NAME_None, true);
-
-		const FVector& DesiredHeading = DesiredTransform.GetRotation().GetForwardVector();
-		const FVector& CurrentHeading = GetActorForwardVector();
-
-		const FVector& TurningAxis = FVector::UpVector;
-		const float HeadingError = FMath::Acos(DesiredHeading.Dot(CurrentHeading)) * -1 * FMath::Sign((DesiredHeading.Cross(CurrentHeading).Dot(TurningAxis)));
-		const float PIDSteering = SteeringController.Evaluate(HeadingError, DeltaSeconds);
-		VehicleMovement->SetSteeringInput(PIDSteering);
-	}
+	// Controllers of all active vehicles are evaluated in a single batch, see FTrVehicleControlBatch.
+	PrimaryActorTick.bCanEverTick = false;
 }
 
 void ATrVehicle::OnActivated(const FTransform& Transform, const FVector& Velocity)
 {
-	SetActorTransform(Transform, false, nullptr, ETeleportType::TeleportPhysics);
+	// Pooled actors represent a different vehicle at each activation, so the physics state of the previous one is cleared.
+	SetActorTransform(Transform, false, nullptr, ETeleportType::ResetPhysics);
 	GetMesh()->SetPhysicsLinearVelocity(Velocity);
-	DesiredTransform = Transform;
 }
 
-void ATrVehicle::SetDesiredTransform(const FTransform& Transform)
+void ATrVehicle::SetPhysicsEnabled(const bool bEnable)
 {
-	DesiredTransform = Transform;
+	if(GetMesh()->IsSimulatingPhysics() == bEnable)
+	{
+		return;
+	}
+
+	GetMesh()->SetSimulatePhysics(bEnable);
+	if(UTrVehicleMovementComponent* MovementComponent = Cast<UTrVehicleMovementComponent>(GetVehicleMovementComponent()))
+	{
+		MovementComponent->SetSimulationEnabled(bEnable);
+	}
 }
 
 void ATrVehicle::PossessedBy(AController* NewController)
@@ -53,3 +38,9 @@ void ATrVehicle::PossessedBy(AController* NewController)
 	OnPossessed.Broadcast();
 	Super::PossessedBy(NewController);
 }
+
+void ATrVehicle::UnPossessed()
+{
+	Super::UnPossessed();
+	OnUnpossessed.Broadcast();
+}
@@ -4,33 +4,42 @@
 
 #include "CoreMinimal.h"
 #include "WheeledVehiclePawn.h"
-#include "PIDController/FRpPIDController.h"
 #include "TrVehicle.generated.h"
 
 /**
- *
+ * Actor of a vehicle within the actor relevancy range, that can be possessed by the player.
+ * Actors do not tick, they are driven by the PID controllers of FTrVehicleControlBatch while they are not possessed,
+ * or placed directly at the simulated transforms while their physics is disabled.
  */
 UCLASS()
 class TRAFFICAI_API ATrVehicle : public AWheeledVehiclePawn
 {
 	GENERATED_BODY()
 
+	friend class FTrVehicleControlBatch;
+
 public:
-	
-	virtual void BeginPlay() override;
 
-	virtual void Tick(float DeltaSeconds) override;
+	ATrVehicle(const FObjectInitializer& ObjectInitializer);
 
 	void OnActivated(const FTransform& Transform, const FVector& Velocity);
-	
-	void SetDesiredTransform(const FTransform& Transform);
+
+	/**
+	 * @brief Switches the rigid body and the vehicle simulation of the actor.
+	 * Without physics, the actor is placed at the transforms of the simulation, and only shows the details of its skeletal mesh.
+	 */
+	void SetPhysicsEnabled(const bool bEnable);
 	
 	virtual void PossessedBy(AController* NewController) override;
 
+	virtual void UnPossessed() override;
+
 public:
 
 	FSimpleMulticastDelegate OnPossessed;
 
+	FSimpleMulticastDelegate OnUnpossessed;
+
 private:
 
 	UPROPERTY(EditAnywhere, Category = "Throttle PID Controller")
@@ -53,8 +62,7 @@ private:
 	
 private:
 
-	FTransform DesiredTransform;
-	FRpPIDController<float> ThrottleController{0.0f};
-	FRpPIDController<float> SteeringController{0.0f};
+	// Slot of the actor in the control batch, or INDEX_NONE while it is not active.
+	int32 ControlSlot = INDEX_NONE;
 	
 };
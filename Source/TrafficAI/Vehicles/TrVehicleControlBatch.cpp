@@ -0,0 +1,149 @@
+﻿// Copyright Anupam Sahu. All Rights Reserved.
+
+#include "TrVehicleControlBatch.h"
+#include "TrVehicle.h"
+#include "TrVehicleMovementComponent.h"
+
+FRpPIDController<float> FTrVehicleControlBatch::MakeController(const FVector3f& Gains)
+{
+	FRpPIDController<float> Controller{0.0f};
+	Controller.Tune(Gains.X, Gains.Y, Gains.Z);
+	return Controller;
+}
+
+float FTrVehicleControlBatch::GetHeadingError(const FVector& DesiredHeading, const FVector& Heading)
+{
+	return -FMath::Acos(FMath::Clamp(DesiredHeading.Dot(Heading), -1.0, 1.0)) * FMath::Sign(DesiredHeading.Cross(Heading).Z);
+}
+
+void FTrVehicleControlBatch::Add(ATrVehicle* Vehicle, const FTransform& DesiredTransform)
+{
+	check(Vehicle && Vehicle->ControlSlot == INDEX_NONE);
+
+	Vehicle->ControlSlot = Vehicles.Push(Vehicle);
+	MovementComponents.Push(Cast<UTrVehicleMovementComponent>(Vehicle->GetVehicleMovementComponent()));
+	DesiredLocations.Push(DesiredTransform.GetLocation());
+	DesiredHeadings.Push(DesiredTransform.GetRotation().GetForwardVector());
+	ThrottleGains.Push(FVector3f(Vehicle->ThrottleKp, Vehicle->ThrottleKi, Vehicle->ThrottleKd));
+	SteeringGains.Push(FVector3f(Vehicle->SteeringKp, Vehicle->SteeringKi, Vehicle->SteeringKd));
+
+	// The actor starts at its desired transform, so both errors start at zero.
+	ThrottleControllers.Push(MakeController(ThrottleGains.Last()));
+	SteeringControllers.Push(MakeController(SteeringGains.Last()));
+	Activations.Push(++NextActivation);
+}
+
+void FTrVehicleControlBatch::Remove(ATrVehicle* Vehicle)
+{
+	const int32 Slot = Vehicle->ControlSlot;
+	if(Slot == INDEX_NONE)
+	{
+		return;
+	}
+
+	// The actor goes back to the pool, so its controllers on the physics thread must stop.
+	PublishTarget(Slot, false);
+
+	Vehicles.RemoveAtSwap(Slot, 1, false);
+	MovementComponents.RemoveAtSwap(Slot, 1, false);
+	DesiredLocations.RemoveAtSwap(Slot, 1, false);
+	DesiredHeadings.RemoveAtSwap(Slot, 1, false);
+	ThrottleGains.RemoveAtSwap(Slot, 1, false);
+	SteeringGains.RemoveAtSwap(Slot, 1, false);
+	ThrottleControllers.RemoveAtSwap(Slot, 1, false);
+	SteeringControllers.RemoveAtSwap(Slot, 1, false);
+	Activations.RemoveAtSwap(Slot, 1, false);
+
+	if(Vehicles.IsValidIndex(Slot))
+	{
+		Vehicles[Slot]->ControlSlot = Slot;
+	}
+	Vehicle->ControlSlot = INDEX_NONE;
+}
+
+void FTrVehicleControlBatch::SetDesiredTransform(const ATrVehicle* Vehicle, const FTransform& DesiredTransform)
+{
+	const int32 Slot = Vehicle->ControlSlot;
+	if(Slot != INDEX_NONE)
+	{
+		DesiredLocations[Slot] = DesiredTransform.GetLocation();
+		DesiredHeadings[Slot] = DesiredTransform.GetRotation().GetForwardVector();
+	}
+}
+
+void FTrVehicleControlBatch::Update(const float DeltaSeconds)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(FTrVehicleControlBatch::Update)
+
+	const int32 NumVehicles = Vehicles.Num();
+	if(NumVehicles == 0 || DeltaSeconds <= 0.0f)
+	{
+		return;
+	}
+
+	IsControlled.SetNumUninitialized(NumVehicles, false);
+	Locations.SetNumUninitialized(NumVehicles, false);
+	Headings.SetNumUninitialized(NumVehicles, false);
+	Forces.SetNumUninitialized(NumVehicles, false);
+	SteeringInputs.SetNumUninitialized(NumVehicles, false);
+
+	for(int32 Slot = 0; Slot < NumVehicles; ++Slot)
+	{
+		const ATrVehicle* Vehicle = Vehicles[Slot];
+		IsControlled[Slot] = !Vehicle->IsPlayerControlled();
+		if(PublishTarget(Slot, IsControlled[Slot]))
+		{
+			IsControlled[Slot] = false;
+			continue;
+		}
+		Locations[Slot] = Vehicle->GetMesh()->GetComponentLocation();
+		Headings[Slot] = Vehicle->GetActorForwardVector();
+	}
+
+	for(int32 Slot = 0; Slot < NumVehicles; ++Slot)
+	{
+		// Controllers of possessed vehicles start over when the player leaves.
+		// Controllers on the physics thread are skipped, and reset there.
+		if(!IsControlled[Slot])
+		{
+			ThrottleControllers[Slot] = MakeController(ThrottleGains[Slot]);
+			SteeringControllers[Slot] = MakeController(SteeringGains[Slot]);
+			continue;
+		}
+
+		const FVector ToTarget = DesiredLocations[Slot] - Locations[Slot];
+		const float Thrust = ThrottleControllers[Slot].Evaluate(ToTarget.Length(), DeltaSeconds);
+		Forces[Slot] = Thrust * ToTarget.GetSafeNormal();
+
+		const float HeadingError = GetHeadingError(DesiredHeadings[Slot], Headings[Slot]);
+		SteeringInputs[Slot] = SteeringControllers[Slot].Evaluate(HeadingError, DeltaSeconds);
+	}
+
+	for(int32 Slot = 0; Slot < NumVehicles; ++Slot)
+	{
+		if(IsControlled[Slot])
+		{
+			ATrVehicle* Vehicle = Vehicles[Slot];
+			Vehicle->GetMesh()->AddForce(Forces[Slot], NAME_None, true);
+			Vehicle->GetVehicleMovementComponent()->SetSteeringInput(SteeringInputs[Slot]);
+		}
+	}
+}
+
+bool FTrVehicleControlBatch::PublishTarget(const int32 Slot, const bool bIsActive) const
+{
+	UTrVehicleMovementComponent* MovementComponent = MovementComponents[Slot];
+	if(!MovementComponent)
+	{
+		return false;
+	}
+
+	FTrVehicleControlTarget Target;
+	Target.Location = DesiredLocations[Slot];
+	Target.Heading = DesiredHeadings[Slot];
+	Target.ThrottleGains = ThrottleGains[Slot];
+	Target.SteeringGains = SteeringGains[Slot];
+	Target.bIsActive = bIsActive;
+	Target.Activation = Activations[Slot];
+	return MovementComponent->SetControlTarget(Target);
+}
@@ -0,0 +1,75 @@
+﻿// Copyright Anupam Sahu. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PIDController/FRpPIDController.h"
+
+class ATrVehicle;
+class UTrVehicleMovementComponent;
+
+/**
+ * @class FTrVehicleControlBatch
+ *
+ * Drives the actors of active vehicles towards the transforms given by the simulation, with a throttle and a steering PID controller each.
+ *
+ * Actors do not tick. Instead, the states of all controllers are stored in contiguous arrays and evaluated in a single pass,
+ * between a pass that reads the transforms of the actors and a pass that applies forces and steering inputs to them.
+ * Actors are removed by swapping the last one into their slot, so the arrays stay dense.
+ *
+ * Actors with a UTrVehicleMovementComponent only publish their desired transforms, and their controllers are evaluated
+ * by the vehicle simulation at every physics step instead, so that control does not depend on the frame rate.
+ */
+class TRAFFICAI_API FTrVehicleControlBatch
+{
+public:
+
+	// Adds an actor that has just been placed at its desired transform, with the gains of its controllers.
+	void Add(ATrVehicle* Vehicle, const FTransform& DesiredTransform);
+
+	void Remove(ATrVehicle* Vehicle);
+
+	void SetDesiredTransform(const ATrVehicle* Vehicle, const FTransform& DesiredTransform);
+
+	int32 Num() const { return Vehicles.Num(); }
+
+	// Evaluates the controllers of all actors that are not controlled by a player, and applies their outputs.
+	void Update(const float DeltaSeconds);
+
+	// Returns a controller without error, tuned with proportional, integral and derivative gains.
+	static FRpPIDController<float> MakeController(const FVector3f& Gains);
+
+	// Angle between two horizontal headings, signed by the side the actor has to turn to.
+	static float GetHeadingError(const FVector& DesiredHeading, const FVector& Heading);
+
+private:
+
+	// Publishes the target of an actor controlled on the physics thread. Returns false if the actor is controlled here.
+	bool PublishTarget(const int32 Slot, const bool bIsActive) const;
+
+private:
+
+	TArray<ATrVehicle*> Vehicles;
+	TArray<UTrVehicleMovementComponent*> MovementComponents;
+	TArray<FVector> DesiredLocations;
+	TArray<FVector> DesiredHeadings;
+
+	// Proportional, integral and derivative gains of the throttle and steering controllers.
+	TArray<FVector3f> ThrottleGains;
+	TArray<FVector3f> SteeringGains;
+
+	// Throttle and steering controllers, that keep the same behaviour as when each actor evaluated its own.
+	TArray<FRpPIDController<float>> ThrottleControllers;
+	TArray<FRpPIDController<float>> SteeringControllers;
+
+	// Activation of each actor, that lets controllers on the physics thread detect teleports.
+	TArray<uint32> Activations;
+	uint32 NextActivation = 0;
+
+	// Transforms read from the actors, and outputs applied to them. Kept between updates to avoid allocations.
+	TArray<bool> IsControlled;
+	TArray<FVector> Locations;
+	TArray<FVector> Headings;
+	TArray<FVector> Forces;
+	TArray<float> SteeringInputs;
+};
@@ -1,19 +1,67 @@
 ﻿// Copyright Anupam Sahu. All Rights Reserved.
 
 #include "TrVehicleMovementComponent.h"
+#include "TrVehicleControlBatch.h"
+#include "PhysicsProxy/SingleParticlePhysicsProxy.h"
 
 void UTrVehicleSimulation::SetSimulationEnabled(const bool bInEnable)
 {
 	bIsSimEnabled = bInEnable;
 }
 
+void UTrVehicleSimulation::SetControlTarget(const FTrVehicleControlTarget& Target)
+{
+	FScopeLock Lock(&TargetLock);
+	PublishedTarget = Target;
+}
+
+void UTrVehicleSimulation::UpdateSimulation(float DeltaTime, const FChaosVehicleAsyncInput& InputData, Chaos::FRigidBodyHandle_Internal* Handle)
+{
+	FTrVehicleControlTarget Target;
+	{
+		FScopeLock Lock(&TargetLock);
+		Target = PublishedTarget;
+	}
+
+	// Controllers start over when the vehicle is teleported, or when the player leaves it.
+	if(Target.Activation != Activation || !Target.bIsActive)
+	{
+		Activation = Target.Activation;
+		ThrottleController = FTrVehicleControlBatch::MakeController(Target.ThrottleGains);
+		SteeringController = FTrVehicleControlBatch::MakeController(Target.SteeringGains);
+	}
+
+	bIsControlled = bIsSimEnabled && Target.bIsActive && Handle && DeltaTime > 0.0f;
+	if(bIsControlled)
+	{
+		const FVector ToTarget = Target.Location - FVector(Handle->X());
+		const float Thrust = ThrottleController.Evaluate(ToTarget.Length(), DeltaTime);
+		AddForce(Thrust * ToTarget.GetSafeNormal(), true, true);
+
+		const float HeadingError = FTrVehicleControlBatch::GetHeadingError(Target.Heading, FQuat(Handle->R()).GetForwardVector());
+		ControlledSteering = SteeringController.Evaluate(HeadingError, DeltaTime);
+	}
+
+	UChaosWheeledVehicleSimulation::UpdateSimulation(DeltaTime, InputData, Handle);
+}
+
+FControlInputs UTrVehicleSimulation::GetControlledInputs(const FControlInputs& ControlInputs) const
+{
+	FControlInputs Inputs = ControlInputs;
+	if(bIsControlled)
+	{
+		Inputs.SteeringInput = FMath::Clamp(ControlledSteering, -1.0f, 1.0f);
+	}
+	return Inputs;
+}
+
 void UTrVehicleSimulation::ApplyInput(const FControlInputs& ControlInputs, float DeltaTime)
 {
 	if(!bIsSimEnabled)
 	{
 		return;
 	}
-	UChaosWheeledVehicleSimulation::ApplyInput(ControlInputs, DeltaTime);
+	UChaosWheeledVehicleSimulation::ApplyInput(GetControlledInputs(ControlInputs), DeltaTime);
 }
 
 void UTrVehicleSimulation::ProcessMechanicalSimulation(float DeltaTime)
@@ -31,7 +79,7 @@ void UTrVehicleSimulation::ProcessSteering(const FControlInputs& ControlInputs)
 	{
 		return;
 	}
-	UChaosWheeledVehicleSimulation::ProcessSteering(ControlInputs);
+	UChaosWheeledVehicleSimulation::ProcessSteering(GetControlledInputs(ControlInputs));
 }
 
 void UTrVehicleMovementComponent::SetSimulationEnabled(const bool bInEnable)
@@ -39,6 +87,16 @@ void UTrVehicleMovementComponent::SetSimulationEnabled(const bool bInEnable)
 	static_cast<UTrVehicleSimulation*>(VehicleSimulationPT.Get())->SetSimulationEnabled(bInEnable);
 }
 
+bool UTrVehicleMovementComponent::SetControlTarget(const FTrVehicleControlTarget& Target)
+{
+	if(!VehicleSimulationPT)
+	{
+		return false;
+	}
+	static_cast<UTrVehicleSimulation*>(VehicleSimulationPT.Get())->SetControlTarget(Target);
+	return true;
+}
+
 TUniquePtr<Chaos::FSimpleWheeledVehicle> UTrVehicleMovementComponent::CreatePhysicsVehicle()
 {
 	// Make the Vehicle Simulation class that will be updated from the physics thread async callback
@@ -4,8 +4,25 @@
 
 #include "CoreMinimal.h"
 #include "ChaosWheeledVehicleMovementComponent.h"
+#include "PIDController/FRpPIDController.h"
 #include "TrVehicleMovementComponent.generated.h"
 
+// Transform the PID controllers of a vehicle steer towards, published by the game thread for the physics thread.
+struct FTrVehicleControlTarget
+{
+	FVector Location = FVector::ZeroVector;
+	FVector Heading = FVector::ForwardVector;
+
+	// Proportional, integral and derivative gains of the throttle and steering controllers.
+	FVector3f ThrottleGains = FVector3f::ZeroVector;
+	FVector3f SteeringGains = FVector3f::ZeroVector;
+
+	// Vehicles possessed by a player, or without an actor, are not controlled.
+	bool bIsActive = false;
+
+	// Incremented each time the vehicle is teleported, so that its controllers start over.
+	uint32 Activation = 0;
+};
 
 class TRAFFICAI_API UTrVehicleSimulation : public UChaosWheeledVehicleSimulation
 {
@@ -13,13 +30,38 @@ public:
 	
 	void SetSimulationEnabled(const bool bInEnable);
 
+	// Publishes the target of the controllers. Called on the game thread.
+	void SetControlTarget(const FTrVehicleControlTarget& Target);
+
+	/**
+	 * Evaluates the throttle and steering controllers at every physics step, before the vehicle is simulated.
+	 * The throttle is applied as an acceleration towards the target, and the steering replaces the steering input.
+	 */
+	virtual void UpdateSimulation(float DeltaTime, const FChaosVehicleAsyncInput& InputData, Chaos::FRigidBodyHandle_Internal* Handle) override;
+
 	virtual void ApplyInput(const FControlInputs& ControlInputs, float DeltaTime) override;
 	virtual void ProcessMechanicalSimulation(float DeltaTime) override;
 	virtual void ProcessSteering(const FControlInputs& ControlInputs) override;
 
+private:
+
+	// Returns the control inputs, with the steering of the controller while it is active.
+	FControlInputs GetControlledInputs(const FControlInputs& ControlInputs) const;
+
 private:
 
 	bool bIsSimEnabled = true;
+
+	// Latest target published by the game thread.
+	FCriticalSection TargetLock;
+	FTrVehicleControlTarget PublishedTarget;
+
+	// Controller states, only accessed on the physics thread.
+	uint32 Activation = 0;
+	bool bIsControlled = false;
+	float ControlledSteering = 0.0f;
+	FRpPIDController<float> ThrottleController{0.0f};
+	FRpPIDController<float> SteeringController{0.0f};
 	
 };
 
@@ -32,6 +74,9 @@ public:
 
 	UFUNCTION(BlueprintCallable)
 	void SetSimulationEnabled(const bool bInEnable);
+
+	// Publishes the target of the controllers that run on the physics thread. Returns false if the physics vehicle has not been created yet.
+	bool SetControlTarget(const FTrVehicleControlTarget& Target);
 	
 	virtual TUniquePtr<Chaos::FSimpleWheeledVehicle> CreatePhysicsVehicle() override;
 };